@@ -172,7 +172,7 @@ int main(int argc, char* argv[]) {
     // command line params
     auto parser = ygl::make_parser(argc, argv, "yimproc", "process images");
     auto command = ygl::parse_arg(parser, "command", "command to execute", ""s,
-        true, {"resize", "tonemap", "bilateral"});
+        true, {"resize", "tonemap", "bilateral", "merge"});
     auto output =
         ygl::parse_opt(parser, "--output", "-o", "output image filename", ""s);
     if (command == "resize") {
@@ -240,6 +240,67 @@ int main(int argc, char* argv[]) {
         auto out = filter_bilateral(
             img, spatial_sigma, range_sigma, features, features_sigma);
         save_hdr(output, out);
+    } else if (command == "merge") {
+        auto exposure =
+            ygl::parse_opt(parser, "--exposure", "-e", "hdr exposure", 0.0f);
+        auto gamma = ygl::parse_opt(parser, "--gamma", "-g", "hdr gamma", 2.2f);
+        auto filmic = ygl::parse_flag(parser, "--filmic", "-F", "hdr filmic");
+        auto filenames = ygl::parse_args(parser, "shards",
+            "ytrace checkpoint filenames", std::vector<std::string>{}, true);
+        // check parsing
+        if (ygl::should_exit(parser)) {
+            printf("%s\n", get_usage(parser).c_str());
+            exit(1);
+        }
+
+        // shards should come from the same render, with each shard once
+        auto pixels = ygl::image<ygl::trace_pixel>();
+        auto first_params = ygl::trace_params();
+        auto shards = std::vector<bool>();
+        for (auto& filename : filenames) {
+            auto params = ygl::trace_params();
+            try {
+                auto shard = ygl::load_trace_pixels(filename, params);
+                if (pixels.empty()) {
+                    pixels = shard;
+                    first_params = params;
+                    shards.assign(std::max(params.nshards, 1), false);
+                } else {
+                    ygl::merge_trace_pixels(pixels, shard);
+                }
+            } catch (std::exception& e) {
+                ygl::log_fatal("cannot merge shard {}: {}", filename, e.what());
+            }
+            auto diffs = ygl::diff_trace_params(first_params, params);
+            diffs.erase(std::remove(diffs.begin(), diffs.end(), "shard"),
+                diffs.end());
+            if (!diffs.empty())
+                ygl::log_fatal("cannot merge shard {} with different {}",
+                    filename, ygl::join(diffs, ", "));
+            if (params.shard < 0 || params.shard >= shards.size())
+                ygl::log_fatal("shard {} has an invalid index", filename);
+            if (shards[params.shard])
+                ygl::log_fatal("shard {} is merged twice", params.shard);
+            shards[params.shard] = true;
+        }
+        for (auto sid = 0; sid < shards.size(); sid++) {
+            if (!shards[sid]) ygl::log_fatal("shard {} is missing", sid);
+        }
+        auto filter = first_params.filter;
+        auto out = ygl::image4f(pixels.width(), pixels.height());
+        for (auto j = 0; j < pixels.height(); j++) {
+            for (auto i = 0; i < pixels.width(); i++) {
+                auto& pxl = pixels.at(i, j);
+                auto weight = (filter == ygl::trace_filter_type::box) ?
+                                  (float)pxl.sample :
+                                  pxl.weight;
+                if (!weight) continue;
+                out.at(i, j) = {pxl.col.x, pxl.col.y, pxl.col.z, pxl.alpha};
+                out.at(i, j) /= weight;
+            }
+        }
+        if (!ygl::save_image(output, out, exposure, gamma, filmic))
+            ygl::log_fatal("cannot save image {}", output);
     } else {
         // check parsing
         if (ygl::should_exit(parser)) {
@@ -123,6 +123,9 @@ bool update(app_state* app) {
         }
         app->update_list.clear();
 
+        // recompile materials and lights
+        app->lights = ygl::make_trace_lights(app->scn);
+
         // render preview
         auto pparams = app->params;
         pparams.nsamples = 1;
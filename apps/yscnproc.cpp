@@ -52,8 +52,8 @@ void validate_texture_paths(ygl::scene* obj, const std::string& filename) {
 
 int main(int argc, char** argv) {
     // command line params
-    auto parser =
-        ygl::make_parser(argc, argv, "yscnproc", "converts obj to gltf");
+    auto parser = ygl::make_parser(
+        argc, argv, "yscnproc", "converts scenes to obj, gltf or ybin");
     auto textures =
         ygl::parse_flag(parser, "--textures", "-t", "process textures");
     auto no_flipy_texcoord = ygl::parse_flag(
@@ -81,6 +81,8 @@ int main(int argc, char** argv) {
         parser, "--validate-textures", "", "validate texture paths");
     auto validate =
         ygl::parse_flag(parser, "--validate", "", "validate after saving");
+    auto bench_json = ygl::parse_opt(parser, "--bench-json", "",
+        "time json parsing with and without a DOM over <val> runs", 0);
     auto output = ygl::parse_opt(
         parser, "--output", "-o", "output scene filename", "out.obj"s);
     auto filenames = ygl::parse_args(
@@ -90,17 +92,53 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
+    // time json parsing of gltf and proc scenes, without loading buffers
+    if (bench_json) {
+        for (auto filename : filenames) {
+            auto ext = ygl::path_extension(filename);
+            auto times = std::vector<double>{1e9, 1e9};
+            for (auto run = 0; run < bench_json; run++) {
+                for (auto dom : {true, false}) {
+                    auto load_timer = ygl::timer();
+                    try {
+                        if (ext == ".gltf") {
+                            delete ygl::load_gltf(
+                                filename, false, false, true, dom);
+                        } else if (ext == ".glb") {
+                            delete ygl::load_binary_gltf(
+                                filename, false, false, true, dom);
+                        } else if (ext == ".json") {
+                            delete ygl::load_proc_scene(filename, dom);
+                        } else {
+                            throw std::runtime_error("no json in file");
+                        }
+                    } catch (const std::exception& e) {
+                        ygl::log_fatal("unable to load file {} with error {}",
+                            filename, e.what());
+                    }
+                    times[dom] = std::min(times[dom], load_timer.elapsed());
+                }
+            }
+            printf("%s: dom %.3fs, reader %.3fs, speedup %.1fx\n",
+                filename.c_str(), times[1], times[0], times[1] / times[0]);
+        }
+        return 0;
+    }
+
     // load obj
     auto scn = std::unique_ptr<ygl::scene>(new ygl::scene());
     for (auto filename : filenames) {
         auto to_merge = std::unique_ptr<ygl::scene>(nullptr);
         try {
             auto opts = ygl::load_options();
-            opts.load_textures = textures;
+            // binary caches embed texture images and store shapes as the
+            // viewers load them
+            auto as_cache = ygl::path_extension(output) == ".ybin";
+            opts.load_textures = textures || as_cache;
             opts.obj_flip_texcoord = !no_flipy_texcoord;
             opts.obj_flip_tr = !no_flip_opacity;
             opts.obj_facet_non_smooth = facet_non_smooth;
-            opts.preserve_quads = true;
+            opts.preserve_quads = !as_cache;
             to_merge = std::unique_ptr<ygl::scene>(load_scene(filename, opts));
 
         } catch (const std::exception& e) {
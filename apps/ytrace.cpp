@@ -46,14 +46,325 @@ struct app_state {
     ygl::vec4f background = {0, 0, 0, 0};
     bool save_batch = false;
     int batch_size = 16;
+    std::string ckfilename;
+    bool resume = false;
+    bool save_aovs = false;
+    bool denoise = false;
+    ygl::trace_aovs aovs;
+    std::string frames;
+    std::string cameras;
+    std::vector<ygl::camera*> views;
+    std::vector<ygl::image4f> view_imgs;
+    std::vector<ygl::image<ygl::trace_pixel>> view_pixels;
+    std::string stats_filename;
+    std::string crop_filename;
+    ygl::image4f crop_base;
+    std::string bake;
+    std::string bake_shapes;
+    ygl::trace_bake_params bake_params;
+    ygl::trace_stats stats;
+    bool exr_half = false;
+    std::vector<std::future<void>> saves;
+    double load_time = 0, bvh_time = 0, lights_time = 0, render_time = 0,
+           save_time = 0;
 
     ~app_state() {
         if (scn) delete scn;
         if (view) delete view;
+        for (auto v : views) delete v;
         if (bvh) delete bvh;
     }
 };
 
+// Save a rendered image, denoised and with AOVs as additional layers if
+// requested
+void save_output(const app_state* app, const std::string& filename,
+    const ygl::image4f& rendered, const ygl::trace_aovs& aovs) {
+    auto ok = false;
+    auto denoised = ygl::image4f();
+    if (app->denoise) {
+        // pixels outside the crop window are not rendered
+        ygl::log_info("denoising image");
+        auto denoise_params = ygl::trace_denoise_params();
+        denoise_params.window = app->params.crop;
+        denoised = ygl::denoise_trace_image(rendered, aovs, denoise_params);
+    }
+    auto img = (app->denoise) ? &denoised : &rendered;
+    auto merged = ygl::image4f();
+    if (!app->crop_base.empty()) {
+        auto& crop = app->params.crop;
+        merged = app->crop_base;
+        for (auto j = crop.y; j < crop.w; j++)
+            for (auto i = crop.x; i < crop.z; i++)
+                merged.at(i, j) = img->at(i, j);
+        img = &merged;
+    }
+    if (app->save_aovs) {
+        auto names = std::vector<std::string>{
+            "", "albedo", "normal", "depth", "id", "variance"};
+        auto layers = std::vector<const ygl::image4f*>{img, &aovs.albedo,
+            &aovs.normal, &aovs.depth, &aovs.id, &aovs.variance};
+        if (app->denoise) {
+            names.push_back("noisy");
+            layers.push_back(&rendered);
+        }
+        ok = ygl::save_image4f_layers(filename, names, layers, app->exr_half);
+    } else {
+        ok = ygl::save_image(
+            filename, *img, app->exposure, app->gamma, app->filmic);
+    }
+    if (!ok) ygl::log_error("cannot save image {}", filename);
+}
+
+// Save the current image and AOVs
+void save_output(app_state* app, const std::string& filename) {
+    auto save_timer = ygl::timer();
+    save_output(app, filename, app->img, app->aovs);
+    app->save_time += save_timer.elapsed();
+}
+
+// Save a copy of the image and AOVs in the background, so that rendering
+// continues while the file is written. Only the copy counts as save time.
+void save_output_async(
+    app_state* app, const std::string& filename, const ygl::image4f& img) {
+    auto save_timer = ygl::timer();
+    auto aovs = (app->save_aovs || app->denoise) ? app->aovs :
+                                                   ygl::trace_aovs();
+    app->saves.push_back(std::async(std::launch::async,
+        [app, filename, img, aovs = std::move(aovs)]() {
+            save_output(app, filename, img, aovs);
+        }));
+    app->save_time += save_timer.elapsed();
+}
+
+// Wait for the background saves to finish, counting the wait as save time
+void wait_saves(app_state* app) {
+    auto save_timer = ygl::timer();
+    for (auto& save : app->saves) save.get();
+    app->saves.clear();
+    app->save_time += save_timer.elapsed();
+}
+
+// Print the phase timings and trace statistics, and save them as JSON if
+// requested
+void report_stats(app_state* app) {
+    auto& stats = app->stats;
+    auto rays = stats.primary_rays + stats.shadow_rays + stats.bounce_rays;
+    auto mrays = (app->render_time) ? rays / app->render_time / 1e6 : 0.0;
+    ygl::log_info("time load {}s bvh {}s lights {}s render {}s save {}s",
+        app->load_time, app->bvh_time, app->lights_time, app->render_time,
+        app->save_time);
+    ygl::log_info("rays primary {} shadow {} bounce {} ({} Mrays/s)",
+        stats.primary_rays, stats.shadow_rays, stats.bounce_rays, mrays);
+    ygl::log_info("bvh nodes {} prims {}, nan samples {}", stats.bvh_nodes,
+        stats.prim_tests, stats.nan_samples);
+    if (app->stats_filename.empty()) return;
+    auto entry = [](const std::string& name, auto val) {
+        return "\"" + name + "\": " + std::to_string(val);
+    };
+    auto js = "{\n  \"time\": {" + entry("load", app->load_time) + ", " +
+              entry("bvh", app->bvh_time) + ", " +
+              entry("lights", app->lights_time) + ", " +
+              entry("render", app->render_time) + ", " +
+              entry("save", app->save_time) + "},\n  \"rays\": {" +
+              entry("primary", stats.primary_rays) + ", " +
+              entry("shadow", stats.shadow_rays) + ", " +
+              entry("bounce", stats.bounce_rays) + ", " +
+              entry("mrays_per_second", mrays) + "},\n  \"bvh\": {" +
+              entry("nodes", stats.bvh_nodes) + ", " +
+              entry("prims", stats.prim_tests) + "},\n  " +
+              entry("nan_samples", stats.nan_samples) + "\n}\n";
+    try {
+        ygl::save_text(app->stats_filename, js);
+    } catch (std::exception e) {
+        ygl::log_error("cannot save stats {}", app->stats_filename);
+    }
+}
+
+// Render the image in batches of samples, starting from the current pixels
+void render_image(
+    app_state* app, const std::string& imfilename, int start_sample) {
+    for (auto cur_sample = start_sample; cur_sample < app->params.nsamples;
+         cur_sample += app->batch_size) {
+        if (app->save_batch && cur_sample) {
+            auto batchname =
+                ygl::format("{}{}.{}{}", ygl::path_dirname(imfilename),
+                    ygl::path_basename(imfilename), cur_sample,
+                    ygl::path_extension(imfilename));
+            wait_saves(app);
+            ygl::log_info("saving image {}", batchname);
+            save_output_async(app, batchname, app->img);
+        }
+        ygl::log_info(
+            "rendering sample {}/{}", cur_sample, app->params.nsamples);
+        auto render_timer = ygl::timer();
+        if (app->params.filter == ygl::trace_filter_type::box) {
+            trace_samples(app->scn, app->cam, app->bvh, app->lights,
+                app->img, app->pixels, app->batch_size, app->params,
+                (app->save_aovs || app->denoise) ? &app->aovs : nullptr,
+                &app->stats);
+        } else {
+            trace_samples_filtered(app->scn, app->cam, app->bvh, app->lights,
+                app->img, app->pixels, app->batch_size, app->params,
+                &app->stats);
+        }
+        app->render_time += render_timer.elapsed();
+        if (!app->ckfilename.empty()) {
+            try {
+                ygl::save_trace_pixels(
+                    app->ckfilename, app->pixels, app->params, app->cam);
+            } catch (std::exception e) {
+                ygl::log_error("cannot save checkpoint {}", app->ckfilename);
+            }
+        }
+    }
+}
+
+// Load lookat cameras from a text file with one camera per line, given as
+// `from.x from.y from.z to.x to.y to.z [yfov]`. Other parameters are copied
+// from the view camera.
+std::vector<ygl::camera*> load_lookat_cameras(
+    const std::string& filename, const ygl::camera* view) {
+    auto cams = std::vector<ygl::camera*>();
+    for (auto& line : ygl::splitlines(ygl::load_text(filename))) {
+        auto toks = ygl::split(line);
+        if (toks.empty() || toks[0][0] == '#') continue;
+        if (toks.size() != 6 && toks.size() != 7)
+            throw std::runtime_error("bad camera line " + line);
+        auto vals = std::vector<float>();
+        for (auto& tok : toks) vals.push_back(std::stof(tok));
+        auto from = ygl::vec3f{vals[0], vals[1], vals[2]};
+        auto to = ygl::vec3f{vals[3], vals[4], vals[5]};
+        auto cam = new ygl::camera(*view);
+        cam->name = ygl::format("cam{}", (int)cams.size());
+        cam->frame = ygl::lookat_frame(from, to, ygl::vec3f{0, 1, 0});
+        cam->focus = ygl::length(to - from);
+        if (vals.size() == 7) cam->yfov = vals[6] * ygl::pif / 180;
+        cams.push_back(cam);
+    }
+    return cams;
+}
+
+// Render all views at once, sharing scene, bvh and lights, and save one
+// image per view. The rows of all views are traced in the same batch.
+void render_views(app_state* app) {
+    auto cams = std::vector<const ygl::camera*>();
+    auto imgs = std::vector<ygl::image4f*>();
+    auto pixels = std::vector<ygl::image<ygl::trace_pixel>*>();
+    for (auto vid = 0; vid < app->views.size(); vid++) {
+        cams.push_back(app->views[vid]);
+        imgs.push_back(&app->view_imgs[vid]);
+        pixels.push_back(&app->view_pixels[vid]);
+    }
+    auto save_views = [app](const std::string& suffix) {
+        wait_saves(app);
+        for (auto vid = 0; vid < app->views.size(); vid++) {
+            auto imfilename = ygl::format("{}{}.{}{}{}",
+                ygl::path_dirname(app->imfilename),
+                ygl::path_basename(app->imfilename), app->views[vid]->name,
+                suffix, ygl::path_extension(app->imfilename));
+            ygl::log_info("saving image {}", imfilename);
+            save_output_async(app, imfilename, app->view_imgs[vid]);
+        }
+    };
+    for (auto cur_sample = 0; cur_sample < app->params.nsamples;
+         cur_sample += app->batch_size) {
+        if (app->save_batch && cur_sample)
+            save_views(ygl::format(".{}", cur_sample));
+        ygl::log_info(
+            "rendering sample {}/{}", cur_sample, app->params.nsamples);
+        auto render_timer = ygl::timer();
+        trace_samples(app->scn, cams, app->bvh, app->lights, imgs, pixels,
+            app->batch_size, app->params, &app->stats);
+        app->render_time += render_timer.elapsed();
+    }
+    save_views("");
+    wait_saves(app);
+}
+
+// Render an animation sequence, updating the scene and the bvh at each frame
+// and saving numbered images. Shape bvhs, lights and textures are reused
+// since animation only changes node transforms.
+void render_frames(app_state* app, float start, float end, float step) {
+    auto scn_cam = (app->scn->cameras.empty()) ? nullptr :
+                                                 app->scn->cameras.at(0);
+    auto ist_frames = std::vector<ygl::frame3f>();
+    auto frame = 0;
+    for (auto time = start; time <= end + step * 0.001f; time += step) {
+        ygl::log_info("updating frame {} at time {}", frame, time);
+        ygl::update_transforms(app->scn, time);
+        if (scn_cam) app->view->frame = scn_cam->frame;
+        auto moved = ist_frames.size() != app->scn->instances.size();
+        for (auto iid = 0; iid < ist_frames.size() && !moved; iid++) {
+            moved = ist_frames[iid] != app->scn->instances[iid]->frame;
+        }
+        if (moved) {
+            auto bvh_timer = ygl::timer();
+            ist_frames.clear();
+            for (auto ist : app->scn->instances)
+                ist_frames.push_back(ist->frame);
+            ygl::refit_bvh(app->bvh, app->scn, false);
+            app->bvh_time += bvh_timer.elapsed();
+        }
+        app->img = ygl::image4f(app->img.width(), app->img.height());
+        app->pixels = ygl::make_trace_pixels(app->img, app->params);
+        if (app->save_aovs || app->denoise)
+            app->aovs = ygl::make_trace_aovs(app->scn, app->img);
+        char num[16];
+        snprintf(num, sizeof(num), "%04d", frame);
+        auto imfilename =
+            ygl::format("{}{}.{}{}", ygl::path_dirname(app->imfilename),
+                ygl::path_basename(app->imfilename), num,
+                ygl::path_extension(app->imfilename));
+        render_image(app, imfilename, 0);
+        wait_saves(app);
+        ygl::log_info("saving image {}", imfilename);
+        save_output_async(app, imfilename, app->img);
+        frame++;
+    }
+    wait_saves(app);
+}
+
+// Bake the shapes with texcoords, or only the named ones, saving one image
+// per instance shape
+void render_bakes(app_state* app) {
+    auto names = std::vector<std::string>();
+    if (!app->bake_shapes.empty()) {
+        auto stream = std::stringstream(app->bake_shapes);
+        auto name = ""s;
+        while (std::getline(stream, name, ',')) names.push_back(name);
+    }
+    auto img =
+        ygl::image4f(app->params.resolution, app->params.resolution);
+    for (auto ist : app->scn->instances) {
+        for (auto sid = 0; sid < ist->shp->shapes.size(); sid++) {
+            auto shp = ist->shp->shapes[sid];
+            if (shp->texcoord.empty()) continue;
+            if (shp->triangles.empty() && shp->quads.empty()) continue;
+            auto name = (ist->shp->shapes.size() == 1) ?
+                            ist->name :
+                            ist->name + "." + shp->name;
+            if (!names.empty() &&
+                std::find(names.begin(), names.end(), name) == names.end())
+                continue;
+            ygl::log_info("baking {}", name);
+            auto render_timer = ygl::timer();
+            ygl::trace_bake(app->scn, app->bvh, app->lights, ist, sid, img,
+                app->params, app->bake_params);
+            app->render_time += render_timer.elapsed();
+            auto imfilename =
+                ygl::format("{}{}.{}{}", ygl::path_dirname(app->imfilename),
+                    ygl::path_basename(app->imfilename), name,
+                    ygl::path_extension(app->imfilename));
+            ygl::log_info("saving image {}", imfilename);
+            auto save_timer = ygl::timer();
+            if (!ygl::save_image4f(imfilename, img))
+                ygl::log_error("cannot save image {}", imfilename);
+            app->save_time += save_timer.elapsed();
+        }
+    }
+}
+
 int main(int argc, char* argv[]) {
     // create empty scene
     auto app = new app_state();
@@ -66,6 +377,30 @@ int main(int argc, char* argv[]) {
         "Compute images in <val> samples batches", 16);
     app->save_batch = ygl::parse_flag(
         parser, "--save-batch", "", "Save images progressively");
+    app->ckfilename = ygl::parse_opt(parser, "--checkpoint", "",
+        "Save the render state to <val> after every batch", ""s);
+    app->resume = ygl::parse_flag(
+        parser, "--resume", "", "Resume rendering from the checkpoint");
+    app->save_aovs = ygl::parse_flag(parser, "--aovs", "",
+        "Save albedo, normal, depth, id and variance as EXR layers");
+    app->exr_half = ygl::parse_flag(parser, "--exr-half", "",
+        "Save EXR layers as half floats");
+    app->denoise = ygl::parse_flag(
+        parser, "--denoise", "", "Denoise saved images using the AOVs");
+    app->frames = ygl::parse_opt(parser, "--frames", "",
+        "Render the animation frames at times <start:end:step>", ""s);
+    app->cameras = ygl::parse_opt(parser, "--cameras", "",
+        "Render all scene cameras or the lookat cameras in file <val>", ""s);
+    app->stats_filename = ygl::parse_opt(parser, "--stats", "",
+        "Save timings and trace statistics as JSON to <val>", ""s);
+    app->crop_filename = ygl::parse_opt(parser, "--crop-merge", "",
+        "Merge the crop window into the HDR image <val> when saving", ""s);
+    app->bake = ygl::parse_opt(parser, "--bake", "",
+        "Bake ao or irradiance for the shapes with texcoords", ""s);
+    app->bake_shapes = ygl::parse_opt(parser, "--bake-shapes", "",
+        "Bake only the comma-separated instance shapes in <val>", ""s);
+    app->bake_params.ao_distance = ygl::parse_opt(parser, "--bake-distance",
+        "", "Maximum ambient occlusion distance, 0 for unlimited", 0.0f);
     app->imfilename = ygl::parse_opt(
         parser, "--output-image", "-o", "Image filename", "out.hdr"s);
     app->filename = ygl::parse_arg(parser, "scene", "Scene filename", ""s);
@@ -73,11 +408,74 @@ int main(int argc, char* argv[]) {
         printf("%s\n", get_usage(parser).c_str());
         exit(1);
     }
+    if (app->resume && app->ckfilename.empty()) {
+        ygl::log_fatal("--resume requires --checkpoint");
+    }
+    if (app->save_aovs &&
+        ygl::path_extension(app->imfilename) != ".exr") {
+        ygl::log_fatal("--aovs requires an EXR output image");
+    }
+    if ((app->save_aovs || app->denoise) && app->resume) {
+        ygl::log_fatal("--aovs and --denoise need AOVs, which are not "
+                       "stored in checkpoints");
+    }
+    auto frame_range = ygl::vec3f{0, 0, 1};
+    if (!app->frames.empty()) {
+        auto nvals = sscanf(app->frames.c_str(), "%f:%f:%f", &frame_range.x,
+            &frame_range.y, &frame_range.z);
+        if (nvals < 2 || frame_range.z <= 0 || frame_range.y < frame_range.x)
+            ygl::log_fatal("--frames should be start:end[:step]");
+        if (app->resume || !app->ckfilename.empty())
+            ygl::log_fatal("--frames does not support checkpoints");
+    }
+    if (!app->cameras.empty()) {
+        if (!app->frames.empty())
+            ygl::log_fatal("--cameras and --frames cannot be used together");
+        if (app->resume || !app->ckfilename.empty())
+            ygl::log_fatal("--cameras does not support checkpoints");
+        if (app->save_aovs || app->denoise)
+            ygl::log_fatal("--cameras does not support --aovs and --denoise");
+    }
+    if (app->params.filter != ygl::trace_filter_type::box &&
+        (app->save_aovs || app->denoise || !app->cameras.empty())) {
+        ygl::log_fatal("--filter only supports single images without AOVs");
+    }
+    if (!app->crop_filename.empty()) {
+        auto& crop = app->params.crop;
+        if (crop.z <= crop.x || crop.w <= crop.y)
+            ygl::log_fatal("--crop-merge requires a --crop window");
+        if (!ygl::is_hdr_filename(app->crop_filename))
+            ygl::log_fatal("--crop-merge requires an HDR image");
+        if (!app->frames.empty() || !app->cameras.empty())
+            ygl::log_fatal("--crop-merge renders a single image");
+    }
+    if (!app->bake.empty()) {
+        if (app->bake == "ao") {
+            app->bake_params.type = ygl::trace_bake_type::ao;
+        } else if (app->bake == "irradiance") {
+            app->bake_params.type = ygl::trace_bake_type::irradiance;
+        } else {
+            ygl::log_fatal("--bake should be ao or irradiance");
+        }
+        if (!ygl::is_hdr_filename(app->imfilename))
+            ygl::log_fatal("--bake requires an HDR output image");
+        if (!app->frames.empty() || !app->cameras.empty() ||
+            !app->ckfilename.empty() || app->save_aovs || app->denoise ||
+            !app->crop_filename.empty())
+            ygl::log_fatal("--bake cannot be used with other render modes");
+    }
+    if (app->params.nshards < 1 || app->params.shard < 0 ||
+        app->params.shard >= app->params.nshards) {
+        ygl::log_fatal("--shard should be in [0,--nshards)");
+    }
 
     // setting up rendering
     ygl::log_info("loading scene {}", app->filename);
+    auto load_timer = ygl::timer();
     try {
-        app->scn = ygl::load_scene(app->filename);
+        auto opts = ygl::load_options();
+        opts.preserve_hierarchy = !app->frames.empty();
+        app->scn = ygl::load_scene(app->filename, opts);
     } catch (std::exception e) {
         ygl::log_fatal("cannot load scene {}", app->filename);
         return 1;
@@ -86,6 +484,7 @@ int main(int argc, char* argv[]) {
     // add elements
     auto opts = ygl::add_elements_options();
     add_elements(app->scn, opts);
+    app->load_time = load_timer.elapsed();
 
     // view camera
     app->view = make_view_camera(app->scn, 0);
@@ -93,42 +492,150 @@ int main(int argc, char* argv[]) {
 
     // build bvh
     ygl::log_info("building bvh");
+    auto bvh_timer = ygl::timer();
     app->bvh = make_bvh(app->scn);
+    app->bvh_time = bvh_timer.elapsed();
 
     // init renderer
     ygl::log_info("initializing tracer");
+    auto lights_timer = ygl::timer();
     app->lights = make_trace_lights(app->scn);
+    app->lights_time = lights_timer.elapsed();
 
     // initialize rendering objects
     app->img =
         ygl::image4f((int)round(app->cam->aspect * app->params.resolution),
             app->params.resolution);
     app->pixels = ygl::make_trace_pixels(app->img, app->params);
+    if (app->save_aovs || app->denoise)
+        app->aovs = ygl::make_trace_aovs(app->scn, app->img);
 
-    // render
-    ygl::log_info("starting renderer");
-    for (auto cur_sample = 0; cur_sample < app->params.nsamples;
-         cur_sample += app->batch_size) {
-        if (app->save_batch && cur_sample) {
-            auto imfilename =
-                ygl::format("{}{}.{}{}", ygl::path_dirname(app->imfilename),
-                    ygl::path_basename(app->imfilename), cur_sample,
-                    ygl::path_extension(app->imfilename));
-            ygl::log_info("saving image {}", imfilename);
-            save_image(
-                imfilename, app->img, app->exposure, app->gamma, app->filmic);
+    // load the image to merge the crop window into
+    if (!app->crop_filename.empty()) {
+        ygl::log_info("loading image {}", app->crop_filename);
+        try {
+            app->crop_base = ygl::load_image4f(app->crop_filename);
+        } catch (std::exception e) {
+            ygl::log_fatal("cannot load image {}", app->crop_filename);
         }
-        ygl::log_info(
-            "rendering sample {}/{}", cur_sample, app->params.nsamples);
-        trace_samples(app->scn, app->cam, app->bvh, app->lights, app->img,
-            app->pixels, app->batch_size, app->params);
+        auto& crop = app->params.crop;
+        if (app->crop_base.width() != app->img.width() ||
+            app->crop_base.height() != app->img.height() || crop.x < 0 ||
+            crop.y < 0 || crop.z > app->img.width() ||
+            crop.w > app->img.height()) {
+            ygl::log_fatal("image {} does not match the crop window",
+                app->crop_filename);
+        }
+    }
+
+    // resume from checkpoint
+    auto start_sample = 0;
+    if (app->resume) {
+        ygl::log_info("loading checkpoint {}", app->ckfilename);
+        auto ck_params = app->params;
+        try {
+            app->pixels =
+                ygl::load_trace_pixels(app->ckfilename, ck_params, app->cam);
+        } catch (std::exception& e) {
+            ygl::log_fatal(
+                "cannot load checkpoint {}: {}", app->ckfilename, e.what());
+        }
+        if (app->pixels.width() != app->img.width() ||
+            app->pixels.height() != app->img.height()) {
+            ygl::log_fatal("checkpoint {} does not match image size",
+                app->ckfilename);
+        }
+        // stratified samples depend on the total number of samples, while
+        // uniform and sobol ones can be extended
+        auto& params = app->params;
+        auto diffs = ygl::diff_trace_params(ck_params, params);
+        diffs.erase(std::remove(diffs.begin(), diffs.end(), "nsamples"),
+            diffs.end());
+        if (!diffs.empty()) {
+            ygl::log_fatal("checkpoint {} was rendered with different {}",
+                app->ckfilename, ygl::join(diffs, ", "));
+        }
+        if (ck_params.nsamples != params.nsamples &&
+            params.rng == ygl::trace_rng_type::stratified) {
+            ygl::log_fatal("checkpoint {} was rendered with {} samples, "
+                           "which the stratified sampler cannot change",
+                app->ckfilename, ck_params.nsamples);
+        }
+        for (auto j = 0; j < app->img.height(); j++) {
+            for (auto i = 0; i < app->img.width(); i++) {
+                auto& pxl = app->pixels.at(i, j);
+                auto weight = (app->params.filter ==
+                                  ygl::trace_filter_type::box) ?
+                                  (float)pxl.sample :
+                                  pxl.weight;
+                if (!weight) continue;
+                app->img.at(i, j) =
+                    ygl::vec4f{pxl.col.x, pxl.col.y, pxl.col.z, pxl.alpha};
+                app->img.at(i, j) /= weight;
+            }
+        }
+        // read the sample count from the first pixel traced by this shard
+        // inside the crop window
+        auto crop = app->params.crop;
+        if (crop.z <= crop.x || crop.w <= crop.y)
+            crop = {0, 0, app->img.width(), app->img.height()};
+        auto width = app->img.width(), height = app->img.height();
+        crop = {ygl::clamp(crop.x, 0, width), ygl::clamp(crop.y, 0, height),
+            ygl::clamp(crop.z, 0, width), ygl::clamp(crop.w, 0, height)};
+        auto first_row = app->params.shard;
+        while (first_row < crop.y) first_row += app->params.nshards;
+        if (first_row < crop.w && crop.x < crop.z)
+            start_sample = app->pixels.at(crop.x, first_row).sample;
+    }
+
+    // bake shapes, or render multiple views
+    if (!app->bake.empty()) {
+        ygl::log_info("starting baker");
+        render_bakes(app);
+        ygl::log_info("baking done");
+    } else if (!app->cameras.empty()) {
+        if (app->cameras == "all") {
+            for (auto cid = 0; cid < app->scn->cameras.size(); cid++) {
+                app->views.push_back(make_view_camera(app->scn, cid));
+                app->views.back()->name = ygl::format("cam{}", cid);
+            }
+        } else {
+            try {
+                app->views = load_lookat_cameras(app->cameras, app->view);
+            } catch (std::exception e) {
+                ygl::log_fatal("cannot load cameras {}", app->cameras);
+            }
+        }
+        if (app->views.empty()) ygl::log_fatal("no cameras to render");
+        for (auto cam : app->views) {
+            app->view_imgs.push_back(
+                ygl::image4f((int)round(cam->aspect * app->params.resolution),
+                    app->params.resolution));
+            app->view_pixels.push_back(
+                ygl::make_trace_pixels(app->view_imgs.back(), app->params));
+        }
+        ygl::log_info("starting renderer for {} cameras", app->views.size());
+        render_views(app);
+        ygl::log_info("rendering done");
+    } else if (!app->frames.empty()) {
+        // render animation
+        ygl::log_info("starting renderer");
+        render_frames(app, frame_range.x, frame_range.y, frame_range.z);
+        ygl::log_info("rendering done");
+    } else {
+        // render
+        ygl::log_info("starting renderer");
+        render_image(app, app->imfilename, start_sample);
+        ygl::log_info("rendering done");
+
+        // save image
+        wait_saves(app);
+        ygl::log_info("saving image {}", app->imfilename);
+        save_output(app, app->imfilename);
     }
-    ygl::log_info("rendering done");
 
-    // save image
-    ygl::log_info("saving image {}", app->imfilename);
-    ygl::save_image(
-        app->imfilename, app->img, app->exposure, app->gamma, app->filmic);
+    // report statistics
+    report_stats(app);
 
     // cleanup
     delete app;
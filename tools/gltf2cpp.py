@@ -97,10 +97,15 @@ void serialize(glTFProperty& val, json& js, bool reading) {
 parse_fmt = '''
 {{#types}}
 {{#enums}}
+// Values of a {{name}} enum
+const std::vector<std::pair<{{item}}, {{name}}>>& enum_values({{name}}) {
+    static auto table = std::vector<std::pair<{{item}}, {{name}}>>{ {{#values}} { {{enum}}, {{name}}::{{label}} },{{/values}} };
+    return table;
+}
+
 // Parse a {{name}} enum
 void serialize({{name}}& val, json& js, bool reading) {
-    static std::vector<std::pair<{{item}}, {{name}}>> table = { {{#values}} { {{enum}}, {{name}}::{{label}} },{{/values}} };
-    serialize(val, js, reading, table);
+    serialize(val, js, reading, enum_values(val));
 }
 
 {{/enums}}
@@ -130,6 +135,56 @@ void serialize({{name}}& val, json& js, bool reading) {
 {{/types}}
 '''
 
+read_func = '''
+// Reads an id.
+template <typename T>
+void read_json(glTFid<T>& val, json_reader& jr) {
+    auto v = 0;
+    read_json(v, jr);
+    val = glTFid<T>(v);
+}
+
+// Reads glTFProperty attributes
+void read_json_attrs(glTFProperty& val, json_reader& jr, json_key& key) {
+#if YGL_GLTFJSON
+    read_json_attr(val.extensions, jr, key, "extensions", false);
+    read_json_attr(val.extras, jr, key, "extras", false);
+#endif
+}
+
+'''
+
+read_fmt = '''
+{{#types}}
+{{#enums}}
+// Reads a {{name}} enum
+void read_json({{name}}& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+{{/enums}}
+
+// Reads {{name}} attributes
+void read_json_attrs({{name}}& val, json_reader& jr, json_key& key) {
+    {{#has_extensions}}
+    // extensions are small, so they are read through the json DOM
+    if (!key.found && key.name == "extensions") {
+        static auto def = {{name}}();
+        auto js_ext = json();
+        read_json(js_ext, jr);
+        {{#properties}}{{#extension}}serialize_attr(val.{{name}}, js_ext, "{{extension}}", true, false, def.{{name}});{{/extension}}{{/properties}}
+#if YGL_GLTFJSON
+        serialize(val.extensions, js_ext, true);
+#endif
+        key.found = true;
+    }
+    {{/has_extensions}}
+    {{#base}}read_json_attrs(({{base}}&)val, jr, key);{{/base}}
+    {{#properties}}{{^extension}}read_json_attr(val.{{name}}, jr, key, "{{name}}", {{#required}}true{{/required}}{{^required}}false{{/required}});{{/extension}}{{/properties}}
+}
+{{/types}}
+'''
+
 def substitute(filename, val, key):
     with open(filename) as f: cpp = f.read()
     ncpp = ''
@@ -246,8 +301,15 @@ funcs += parse_func + '\n\n';
 funcs += mustache.render(parse_fmt, {'types': schemas})
 funcs += '\n\n';
 
+# make readers
+reads = ''
+reads += read_func + '\n\n';
+reads += mustache.render(read_fmt, {'types': schemas})
+reads += '\n\n';
+
 # substitute
 substitute('yocto/yocto_gl.h', types, 'gltf-type')
 substitute('yocto/yocto_gl.cpp', funcs, 'gltf-func')
+substitute('yocto/yocto_gl.cpp', reads, 'gltf-read')
 os.system('/usr/local/bin/clang-format -i -style=file yocto/yocto_gl.h')
 os.system('/usr/local/bin/clang-format -i -style=file yocto/yocto_gl.cpp')
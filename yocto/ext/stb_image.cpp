@@ -47,6 +47,7 @@
 #include "stb_image_resize.h"
 
 #define TINYEXR_IMPLEMENTATION
+#define TINYEXR_USE_THREAD 1
 #include "tinyexr.h"
 
 #endif
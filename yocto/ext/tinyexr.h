@@ -105,6 +105,12 @@ extern "C" {
 // http://computation.llnl.gov/projects/floating-point-compression
 #endif
 
+// Decode and encode scanline blocks in parallel with std::thread instead of
+// OpenMP. C++11 required.
+#ifndef TINYEXR_USE_THREAD
+#define TINYEXR_USE_THREAD (0)
+#endif
+
 #define TINYEXR_SUCCESS (0)
 #define TINYEXR_ERROR_INVALID_MAGIC_NUMBER (-1)
 #define TINYEXR_ERROR_INVALID_EXR_VERSION (-2)
@@ -437,6 +443,11 @@ extern int LoadEXRFromMemory(float *out_rgba, const unsigned char *memory,
 #include <omp.h>
 #endif
 
+#if TINYEXR_USE_THREAD
+#include <atomic>
+#include <thread>
+#endif
+
 #if TINYEXR_USE_MINIZ
 #else
 #include "zlib.h"
@@ -10423,10 +10434,22 @@ static int DecodeChunk(EXRImage *exr_image, const EXRHeader *exr_header,
         num_channels, exr_header->channels, exr_header->requested_pixel_types,
         data_width, data_height);
 
+#if TINYEXR_USE_THREAD
+    std::atomic<int> y_count(0);
+    int num_threads = (std::max)(
+        1, (std::min)(static_cast<int>(std::thread::hardware_concurrency()),
+                      static_cast<int>(num_blocks)));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) {
+      workers.emplace_back(std::thread([&]() {
+        int y = 0;
+        while ((y = y_count++) < static_cast<int>(num_blocks)) {
+#else
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
     for (int y = 0; y < static_cast<int>(num_blocks); y++) {
+#endif
       size_t y_idx = static_cast<size_t>(y);
       const unsigned char *data_ptr =
           reinterpret_cast<const unsigned char *>(head + offsets[y_idx]);
@@ -10461,7 +10484,14 @@ static int DecodeChunk(EXRImage *exr_image, const EXRHeader *exr_header,
           exr_header->custom_attributes,
           static_cast<size_t>(exr_header->num_channels), exr_header->channels,
           channel_offset_list);
+#if TINYEXR_USE_THREAD
+        }
+      }));
+    }
+    for (auto &t : workers) t.join();
+#else
     }  // omp parallel
+#endif
   }
 
   // Overwrite `pixel_type` with `requested_pixel_type`.
@@ -11161,10 +11191,22 @@ size_t SaveEXRImageToMemory(const EXRImage *exr_image,
 
 // Use signed int since some OpenMP compiler doesn't allow unsigned type for
 // `parallel for`
+#if TINYEXR_USE_THREAD
+  std::atomic<int> i_count(0);
+  int num_threads = (std::max)(
+      1, (std::min)(static_cast<int>(std::thread::hardware_concurrency()),
+                    num_blocks));
+  std::vector<std::thread> workers;
+  for (int t = 0; t < num_threads; t++) {
+    workers.emplace_back(std::thread([&]() {
+      int i = 0;
+      while ((i = i_count++) < num_blocks) {
+#else
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
   for (int i = 0; i < num_blocks; i++) {
+#endif
     size_t ii = static_cast<size_t>(i);
     int start_y = num_scanlines * i;
     int endY = (std::min)(num_scanlines * (i + 1), exr_image->height);
@@ -11409,7 +11451,14 @@ size_t SaveEXRImageToMemory(const EXRImage *exr_image,
     } else {
       assert(0);
     }
+#if TINYEXR_USE_THREAD
+      }
+    }));
+  }
+  for (auto &t : workers) t.join();
+#else
   }  // omp parallel
+#endif
 
   for (size_t i = 0; i < static_cast<size_t>(num_blocks); i++) {
     data.insert(data.end(), data_list[i].begin(), data_list[i].end());
@@ -90,6 +90,13 @@
 #include "ext/nanosvg.h"
 #endif
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if YGL_OPENGL
 #ifdef __APPLE__
 #include <OpenGL/gl3.h>
@@ -1329,8 +1336,7 @@ bool save_image4f(const std::string& filename, const image4f& img) {
         return stbi_write_hdr(
             filename.c_str(), img.width(), img.height(), 4, (float*)data(img));
     } else if (path_extension(filename) == ".exr") {
-        return !SaveEXR(
-            (float*)data(img), img.width(), img.height(), 4, filename.c_str());
+        return save_image4f_layers(filename, {""}, {&img}, true);
     } else {
         return false;
     }
@@ -1378,6 +1384,140 @@ std::vector<byte> load_image_from_memory(const std::string& filename,
     return ret;
 }
 
+// Image to decode, read from a file or from encoded data in memory.
+struct image_decode_job {
+    std::string filename;        // filename, also selects the format
+    const byte* data = nullptr;  // encoded data, if not read from file
+    int size = 0;                // encoded data size
+    int width = 0, height = 0, ncomp = 0;  // decoded size
+    std::vector<byte> datab;               // decoded ldr data
+    std::vector<float> dataf;              // decoded hdr data
+};
+
+// Hash of a block of bytes, used to find duplicated images and buffers.
+inline uint64_t hash_bytes(const byte* data, size_t size) {
+    auto h = (uint64_t)0xcbf29ce484222325ull ^ (uint64_t)size;
+    auto i = (size_t)0;
+    for (; i + 8 <= size; i += 8) {
+        auto v = (uint64_t)0;
+        memcpy(&v, data + i, 8);
+        h = (h ^ v) * 0x100000001b3ull;
+        h ^= h >> 32;
+    }
+    for (; i < size; i++) h = (h ^ data[i]) * 0x100000001b3ull;
+    return h;
+}
+
+// Runs func(idx) for all jobs on a pool of threads. Jobs are picked one at a
+// time since images have very different sizes.
+template <typename Func>
+void run_image_jobs(int njobs, const Func& func) {
+    auto nthreads = min((int)std::thread::hardware_concurrency(), njobs);
+    if (nthreads <= 1) {
+        for (auto idx = 0; idx < njobs; idx++) func(idx);
+        return;
+    }
+    std::atomic<int> next(0);
+    auto threads = std::vector<std::thread>();
+    for (auto tid = 0; tid < nthreads; tid++) {
+        threads.push_back(std::thread([&]() {
+            for (auto idx = next++; idx < njobs; idx = next++) func(idx);
+        }));
+    }
+    for (auto& t : threads) t.join();
+}
+
+// Decodes images in parallel. Images with the same filename or with the same
+// encoded contents are decoded once. Failed images are left empty.
+void decode_images(std::vector<image_decode_job>& jobs) {
+    auto njobs = (int)jobs.size();
+
+    // duplicated filenames point to their first occurrence
+    auto source = std::vector<int>(njobs, -1);
+    auto filenames = std::unordered_map<std::string, int>();
+    for (auto idx = 0; idx < njobs; idx++) {
+        if (jobs[idx].data) continue;
+        auto it = filenames.find(jobs[idx].filename);
+        if (it != filenames.end()) {
+            source[idx] = it->second;
+        } else {
+            filenames[jobs[idx].filename] = idx;
+        }
+    }
+
+    // read files and hash contents
+    auto contents = std::vector<std::vector<byte>>(njobs);
+    auto hashes = std::vector<uint64_t>(njobs, 0);
+    run_image_jobs(njobs, [&](int idx) {
+        auto& job = jobs[idx];
+        if (source[idx] >= 0) return;
+        if (!job.data) {
+            try {
+                contents[idx] = load_binary(job.filename);
+            } catch (std::exception&) { return; }
+            job.data = contents[idx].data();
+            job.size = (int)contents[idx].size();
+        }
+        hashes[idx] = hash_bytes(job.data, job.size);
+    });
+
+    // duplicated contents point to their first occurrence
+    auto hashed = std::unordered_map<uint64_t, int>();
+    for (auto idx = 0; idx < njobs; idx++) {
+        auto& job = jobs[idx];
+        if (source[idx] >= 0 || !job.data) continue;
+        auto it = hashed.find(hashes[idx]);
+        if (it == hashed.end()) {
+            hashed[hashes[idx]] = idx;
+            continue;
+        }
+        auto& first = jobs[it->second];
+        if (first.size == job.size &&
+            is_hdr_filename(first.filename) == is_hdr_filename(job.filename) &&
+            !memcmp(first.data, job.data, job.size))
+            source[idx] = it->second;
+    }
+
+    // decode unique images, reporting progress for large sets
+    auto ndecode = 0;
+    for (auto idx = 0; idx < njobs; idx++)
+        if (source[idx] < 0 && jobs[idx].data) ndecode++;
+    auto ndone = 0;
+    std::mutex progress_mutex;
+    run_image_jobs(njobs, [&](int idx) {
+        auto& job = jobs[idx];
+        if (source[idx] >= 0 || !job.data) return;
+        if (is_hdr_filename(job.filename)) {
+            job.dataf = load_imagef_from_memory(job.filename, job.data,
+                job.size, job.width, job.height, job.ncomp);
+        } else {
+            job.datab = load_image_from_memory(job.filename, job.data,
+                job.size, job.width, job.height, job.ncomp);
+        }
+        if (ndecode < 16) return;
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        ndone++;
+        if (ndone * 10 / ndecode != (ndone - 1) * 10 / ndecode)
+            log_info("decoded {}/{} images", ndone, ndecode);
+    });
+
+    // copy duplicates and clear references to the file contents
+    for (auto idx = 0; idx < njobs; idx++) {
+        auto& job = jobs[idx];
+        if (!contents[idx].empty()) {
+            job.data = nullptr;
+            job.size = 0;
+        }
+        if (source[idx] < 0) continue;
+        auto& src = jobs[source[idx]];
+        job.width = src.width;
+        job.height = src.height;
+        job.ncomp = src.ncomp;
+        job.datab = src.datab;
+        job.dataf = src.dataf;
+    }
+}
+
 // Saves an image
 bool save_imagef(const std::string& filename, int width, int height, int ncomp,
     const float* hdr) {
@@ -1412,6 +1552,74 @@ bool save_image(const std::string& filename, const image4f& hdr, float exposure,
     }
 }
 
+// Saves hdr images as layers of an exr file. Scanline blocks are zip
+// compressed in parallel by tinyexr.
+bool save_image4f_layers(const std::string& filename,
+    const std::vector<std::string>& names,
+    const std::vector<const image4f*>& layers, bool half) {
+    if (path_extension(filename) != ".exr") return false;
+    if (layers.empty() || names.size() != layers.size()) return false;
+    auto width = layers[0]->width(), height = layers[0]->height();
+    for (auto layer : layers) {
+        if (layer->width() != width || layer->height() != height)
+            return false;
+    }
+
+    // exr requires channels sorted by name
+    auto channels = std::vector<std::tuple<std::string, int, int>>();
+    for (auto lid = 0; lid < layers.size(); lid++) {
+        auto prefix = (names[lid].empty()) ? ""s : names[lid] + ".";
+        for (auto c = 0; c < 4; c++) {
+            channels.push_back({prefix + "RGBA"[c], lid, c});
+        }
+    }
+    std::sort(channels.begin(), channels.end());
+
+    // split channels
+    auto npixels = (size_t)width * (size_t)height;
+    auto planes = std::vector<std::vector<float>>(channels.size());
+    auto plane_ptrs = std::vector<float*>(channels.size());
+    for (auto cid = 0; cid < channels.size(); cid++) {
+        auto layer = layers[std::get<1>(channels[cid])];
+        auto c = std::get<2>(channels[cid]);
+        planes[cid].resize(npixels);
+        for (auto idx = (size_t)0; idx < npixels; idx++)
+            planes[cid][idx] = layer->pixels[idx][c];
+        plane_ptrs[cid] = planes[cid].data();
+    }
+
+    // header
+    auto header = EXRHeader();
+    InitEXRHeader(&header);
+    auto channel_infos = std::vector<EXRChannelInfo>(channels.size());
+    auto pixel_types =
+        std::vector<int>(channels.size(), TINYEXR_PIXELTYPE_FLOAT);
+    auto requested_pixel_types = std::vector<int>(channels.size(),
+        (half) ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT);
+    for (auto cid = 0; cid < channels.size(); cid++) {
+        auto& name = std::get<0>(channels[cid]);
+        strncpy(channel_infos[cid].name, name.c_str(), 255);
+        channel_infos[cid].name[min((int)name.size(), 255)] = '\0';
+    }
+    header.num_channels = (int)channels.size();
+    header.channels = channel_infos.data();
+    header.pixel_types = pixel_types.data();
+    header.requested_pixel_types = requested_pixel_types.data();
+    header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+
+    // image
+    auto exr = EXRImage();
+    InitEXRImage(&exr);
+    exr.num_channels = (int)channels.size();
+    exr.images = (unsigned char**)plane_ptrs.data();
+    exr.width = width;
+    exr.height = height;
+
+    const char* err = nullptr;
+    return SaveEXRImageToFile(&exr, &header, filename.c_str(), &err) ==
+           TINYEXR_SUCCESS;
+}
+
 // Resize image.
 void resize_image(const image4f& img, image4f& res_img, resize_filter filter,
     resize_edge edge, bool premultiplied_alpha) {
@@ -2191,6 +2399,62 @@ bool intersect_check_bbox(const ray3f& ray, const vec3f& ray_dinv,
     return tmin <= tmax;
 }
 
+// Intersect a ray with the part of a Bezier curve in [u0,u1], given with the
+// radius in the last component of the control points.
+bool intersect_bezier(const ray3f& ray, const vec4f& p0, const vec4f& p1,
+    const vec4f& p2, const vec4f& p3, float u0, float u1, int depth,
+    float& ray_t, vec2f& euv) {
+    // check the bounds of the control points
+    auto bbox = bezier_bbox(vec3f{p0.x, p0.y, p0.z}, vec3f{p1.x, p1.y, p1.z},
+        vec3f{p2.x, p2.y, p2.z}, vec3f{p3.x, p3.y, p3.z}, p0.w, p1.w, p2.w,
+        p3.w);
+    if (!intersect_check_bbox(ray, bbox)) return false;
+
+    // intersect the chord once flat
+    if (!depth) {
+        auto luv = zero2f;
+        if (!intersect_line(ray, {p0.x, p0.y, p0.z}, {p3.x, p3.y, p3.z}, p0.w,
+                p3.w, ray_t, luv))
+            return false;
+        euv = {lerp(u0, u1, luv.x), luv.y};
+        return true;
+    }
+
+    // split in the middle with de Casteljau and intersect the closest first
+    auto p01 = (p0 + p1) / 2, p12 = (p1 + p2) / 2, p23 = (p2 + p3) / 2;
+    auto p012 = (p01 + p12) / 2, p123 = (p12 + p23) / 2;
+    auto pm = (p012 + p123) / 2;
+    auto um = (u0 + u1) / 2;
+    auto hit = false;
+    auto sray = ray;
+    if (intersect_bezier(
+            sray, p0, p01, p012, pm, u0, um, depth - 1, ray_t, euv)) {
+        hit = true;
+        sray.tmax = ray_t;
+    }
+    if (intersect_bezier(
+            sray, pm, p123, p23, p3, um, u1, depth - 1, ray_t, euv)) {
+        hit = true;
+    }
+    return hit;
+}
+
+// Intersect a ray with a Bezier curve. The subdivision depth bounds the
+// distance of the curve from its chords to a fraction of the radius.
+bool intersect_bezier(const ray3f& ray, const vec3f& v0, const vec3f& v1,
+    const vec3f& v2, const vec3f& v3, float r0, float r1, float r2, float r3,
+    float& ray_t, vec2f& euv) {
+    auto flatness =
+        max(length(v0 - 2 * v1 + v2), length(v1 - 2 * v2 + v3)) * 6 / 8;
+    auto eps = max(max(r0, r1), max(r2, r3)) / 4;
+    auto depth = 0;
+    if (eps > 0 && flatness > eps)
+        depth = min((int)std::ceil(std::log2(flatness / eps) / 2), 5);
+    return intersect_bezier(ray, {v0.x, v0.y, v0.z, r0},
+        {v1.x, v1.y, v1.z, r1}, {v2.x, v2.y, v2.z, r2}, {v3.x, v3.y, v3.z, r3},
+        0, 1, depth, ray_t, euv);
+}
+
 }  // namespace ygl
 
 // -----------------------------------------------------------------------------
@@ -2399,6 +2663,29 @@ bvh_tree::~bvh_tree() {
 // number of primitives to avoid splitting on
 const int bvh_minprims = 4;
 
+// maximum number of references for a line
+const int bvh_line_maxsplits = 8;
+
+// Bounds of the part of a line in the parameter range.
+bbox3f line_range_bbox(const vec3f& v0, const vec3f& v1, float r0, float r1,
+    const vec2f& range) {
+    return line_bbox(lerp(v0, v1, range.x), lerp(v0, v1, range.y),
+        lerp(r0, r1, range.x), lerp(r0, r1, range.y));
+}
+
+// Number of references for a line. Lines that are not aligned to an axis,
+// as in hair, have loose bounds, so they are split in parts whose bounds
+// have their second largest size within a few line diameters.
+int line_bvh_splits(const vec3f& v0, const vec3f& v1, float r0, float r1) {
+    auto size = bbox_diagonal(line_bbox(v0, v1, r0, r1));
+    auto middle = size.x + size.y + size.z - max_element_value(size) -
+                  min_element_value(size);
+    auto diameter = 2 * max(r0, r1);
+    if (diameter <= 0) return 1;
+    return clamp(
+        (int)std::ceil(middle / (8 * diameter)), 1, bvh_line_maxsplits);
+}
+
 // Initializes the BVH node node that contains the primitives sorted_prims
 // from start to end, by either splitting it into two other nodes,
 // or initializing it as a leaf. When splitting, the heuristic heuristic is
@@ -2508,15 +2795,26 @@ std::tuple<std::vector<bvh_node>, std::vector<int>> make_bvh_nodes(
 void make_bvh_nodes(bvh_tree* bvh, bool equal_size) {
     // get the number of primitives and the primitive type
     auto bboxes = std::vector<bbox3f>();
+    auto line_refs = std::vector<int>();
+    auto line_ranges = std::vector<vec2f>();
     if (!bvh->points.empty()) {
         for (auto& p : bvh->points) {
             bboxes.push_back(point_bbox(bvh->pos[p], bvh->radius[p]));
         }
         bvh->type = bvh_node_type::point;
     } else if (!bvh->lines.empty()) {
-        for (auto& l : bvh->lines) {
-            bboxes.push_back(line_bbox(bvh->pos[l.x], bvh->pos[l.y],
-                bvh->radius[l.x], bvh->radius[l.y]));
+        for (auto lid = 0; lid < bvh->lines.size(); lid++) {
+            auto& l = bvh->lines[lid];
+            auto nsplits = line_bvh_splits(bvh->pos[l.x], bvh->pos[l.y],
+                bvh->radius[l.x], bvh->radius[l.y]);
+            for (auto k = 0; k < nsplits; k++) {
+                auto range =
+                    vec2f{(float)k / nsplits, (float)(k + 1) / nsplits};
+                line_refs.push_back(lid);
+                line_ranges.push_back(range);
+                bboxes.push_back(line_range_bbox(bvh->pos[l.x], bvh->pos[l.y],
+                    bvh->radius[l.x], bvh->radius[l.y], range));
+            }
         }
         bvh->type = bvh_node_type::line;
     } else if (!bvh->triangles.empty()) {
@@ -2531,6 +2829,13 @@ void make_bvh_nodes(bvh_tree* bvh, bool equal_size) {
                 bvh->pos[q.x], bvh->pos[q.y], bvh->pos[q.z], bvh->pos[q.w]));
         }
         bvh->type = bvh_node_type::quad;
+    } else if (!bvh->beziers.empty()) {
+        for (auto& b : bvh->beziers) {
+            bboxes.push_back(bezier_bbox(bvh->pos[b.x], bvh->pos[b.y],
+                bvh->pos[b.z], bvh->pos[b.w], bvh->radius[b.x],
+                bvh->radius[b.y], bvh->radius[b.z], bvh->radius[b.w]));
+        }
+        bvh->type = bvh_node_type::bezier;
     } else if (!bvh->pos.empty()) {
         for (auto i = 0; i < bvh->pos.size(); i++) {
             bboxes.push_back(point_bbox(bvh->pos[i], bvh->radius[i]));
@@ -2547,10 +2852,20 @@ void make_bvh_nodes(bvh_tree* bvh, bool equal_size) {
     std::tie(bvh->nodes, bvh->sorted_prim) =
         make_bvh_nodes(bboxes, bvh->type, equal_size);
 
-    // sort primitives
+    // map line references back to lines
+    if (!line_refs.empty()) {
+        bvh->line_ranges.resize(bvh->sorted_prim.size());
+        for (auto i = 0; i < bvh->sorted_prim.size(); i++) {
+            bvh->line_ranges[i] = line_ranges[bvh->sorted_prim[i]];
+            bvh->sorted_prim[i] = line_refs[bvh->sorted_prim[i]];
+        }
+    }
+
+    // sort primitives, duplicating the ones referenced more than once
     auto sort_prims = [bvh](auto& prims) {
         if (prims.empty()) return;
         auto sprims = prims;
+        prims.resize(bvh->sorted_prim.size());
         for (auto i = 0; i < bvh->sorted_prim.size(); i++) {
             prims[i] = sprims[bvh->sorted_prim[i]];
         }
@@ -2559,14 +2874,16 @@ void make_bvh_nodes(bvh_tree* bvh, bool equal_size) {
     sort_prims(bvh->lines);
     sort_prims(bvh->triangles);
     sort_prims(bvh->quads);
+    sort_prims(bvh->beziers);
     sort_prims(bvh->instances);
 }
 
 // Build a BVH from a set of primitives.
 bvh_tree* make_bvh(const std::vector<int>& points,
     const std::vector<vec2i>& lines, const std::vector<vec3i>& triangles,
-    const std::vector<vec4i>& quads, const std::vector<vec3f>& pos,
-    const std::vector<float>& radius, float def_radius, bool equal_size) {
+    const std::vector<vec4i>& quads, const std::vector<vec4i>& beziers,
+    const std::vector<vec3f>& pos, const std::vector<float>& radius,
+    float def_radius, bool equal_size) {
     // allocate the bvh
     auto bvh = new bvh_tree();
 
@@ -2575,6 +2892,7 @@ bvh_tree* make_bvh(const std::vector<int>& points,
     bvh->lines = lines;
     bvh->triangles = triangles;
     bvh->quads = quads;
+    bvh->beziers = beziers;
     bvh->pos = pos;
     bvh->radius =
         (radius.empty()) ? std::vector<float>(pos.size(), def_radius) : radius;
@@ -2626,8 +2944,8 @@ void refit_bvh(bvh_tree* bvh, int nodeid) {
         case bvh_node_type::line: {
             for (auto i = node.start; i < node.start + node.count; i++) {
                 auto& l = bvh->lines[i];
-                node.bbox += line_bbox(bvh->pos[l.x], bvh->pos[l.y],
-                    bvh->radius[l.x], bvh->radius[l.y]);
+                node.bbox += line_range_bbox(bvh->pos[l.x], bvh->pos[l.y],
+                    bvh->radius[l.x], bvh->radius[l.y], bvh->line_ranges[i]);
             }
         } break;
         case bvh_node_type::triangle: {
@@ -2644,6 +2962,14 @@ void refit_bvh(bvh_tree* bvh, int nodeid) {
                     bvh->pos[q.x], bvh->pos[q.y], bvh->pos[q.z], bvh->pos[q.w]);
             }
         } break;
+        case bvh_node_type::bezier: {
+            for (auto i = node.start; i < node.start + node.count; i++) {
+                auto& b = bvh->beziers[i];
+                node.bbox += bezier_bbox(bvh->pos[b.x], bvh->pos[b.y],
+                    bvh->pos[b.z], bvh->pos[b.w], bvh->radius[b.x],
+                    bvh->radius[b.y], bvh->radius[b.z], bvh->radius[b.w]);
+            }
+        } break;
         case bvh_node_type::vertex: {
             for (auto i = node.start; i < node.start + node.count; i++) {
                 auto idx = bvh->sorted_prim[i];
@@ -2678,6 +3004,11 @@ void refit_bvh(bvh_tree* bvh, const std::vector<frame3f>& frames,
     refit_bvh(bvh, 0);
 }
 
+// Per-thread counters of BVH nodes visited and primitives tested, read by the
+// trace statistics.
+thread_local uint64_t bvh_stats_nodes = 0;
+thread_local uint64_t bvh_stats_prims = 0;
+
 // Intersect ray with a bvh.
 bool intersect_bvh(const bvh_tree* bvh, const ray3f& ray_, bool find_any,
     float& ray_t, int& iid, int& sid, int& eid, vec2f& euv) {
@@ -2686,6 +3017,9 @@ bool intersect_bvh(const bvh_tree* bvh, const ray3f& ray_, bool find_any,
     auto node_cur = 0;
     node_stack[node_cur++] = 0;
 
+    // statistics, kept local for speed
+    auto nnodes = (uint64_t)0, nprims = (uint64_t)0;
+
     // shared variables
     auto hit = false;
 
@@ -2703,10 +3037,14 @@ bool intersect_bvh(const bvh_tree* bvh, const ray3f& ray_, bool find_any,
     while (node_cur) {
         // grab node
         auto& node = bvh->nodes[node_stack[--node_cur]];
+        nnodes += 1;
 
         // intersect bbox
         if (!intersect_check_bbox(ray, ray_dinv, ray_dsign, node.bbox))
             continue;
+        if (node.type != bvh_node_type::internal &&
+            node.type != bvh_node_type::instance)
+            nprims += node.count;
 
         // intersect node, switching based on node type
         // for each type, iterate over the the primitive list
@@ -2767,6 +3105,19 @@ bool intersect_bvh(const bvh_tree* bvh, const ray3f& ray_, bool find_any,
                     }
                 }
             } break;
+            case bvh_node_type::bezier: {
+                for (auto i = node.start; i < node.start + node.count; i++) {
+                    auto& b = bvh->beziers[i];
+                    if (intersect_bezier(ray, bvh->pos[b.x], bvh->pos[b.y],
+                            bvh->pos[b.z], bvh->pos[b.w], bvh->radius[b.x],
+                            bvh->radius[b.y], bvh->radius[b.z],
+                            bvh->radius[b.w], ray_t, euv)) {
+                        hit = true;
+                        ray.tmax = ray_t;
+                        eid = bvh->sorted_prim[i];
+                    }
+                }
+            } break;
             case bvh_node_type::vertex: {
                 for (auto i = node.start; i < node.start + node.count; i++) {
                     auto idx = bvh->sorted_prim[i];
@@ -2795,9 +3146,11 @@ bool intersect_bvh(const bvh_tree* bvh, const ray3f& ray_, bool find_any,
         }
 
         // check for early exit
-        if (find_any && hit) return true;
+        if (find_any && hit) break;
     }
 
+    bvh_stats_nodes += nnodes;
+    bvh_stats_prims += nprims;
     return hit;
 }
 
@@ -2877,6 +3230,24 @@ bool overlap_bvh(const bvh_tree* bvh, const vec3f& pos, float max_dist,
                     }
                 }
             } break;
+            case bvh_node_type::bezier: {
+                // approximated by the lines of the control polygon
+                for (auto i = node.start; i < node.start + node.count; i++) {
+                    auto& b = bvh->beziers[i];
+                    for (auto k = 0; k < 3; k++) {
+                        auto v0 = b[k], v1 = b[k + 1];
+                        auto luv = zero2f;
+                        if (overlap_line(pos, max_dist, bvh->pos[v0],
+                                bvh->pos[v1], bvh->radius[v0], bvh->radius[v1],
+                                dist, luv)) {
+                            hit = true;
+                            max_dist = dist;
+                            eid = bvh->sorted_prim[i];
+                            euv = {(k + luv.x) / 3, luv.y};
+                        }
+                    }
+                }
+            } break;
             case bvh_node_type::vertex: {
                 for (auto i = node.start; i < node.start + node.count; i++) {
                     auto idx = bvh->sorted_prim[i];
@@ -3056,6 +3427,8 @@ T eval_elem(const shape* shp, const std::vector<T>& vals, int eid,
         return interpolate_point(vals, shp->points[eid]);
     } else if (!shp->quads.empty()) {
         return interpolate_quad(vals, shp->quads[eid], euv);
+    } else if (!shp->beziers.empty()) {
+        return interpolate_bezier(vals, shp->beziers[eid], euv.x);
     } else {
         return vals[eid];  // points
     }
@@ -3207,6 +3580,9 @@ void compute_normals(shape* shp) {
         compute_normals(shp->triangles, shp->pos, shp->norm);
     } else if (!shp->quads.empty()) {
         compute_normals(shp->quads, shp->pos, shp->norm);
+    } else if (!shp->beziers.empty()) {
+        compute_tangents(
+            convert_bezier_to_lines(shp->beziers), shp->pos, shp->norm);
     }
 }
 
@@ -3345,7 +3721,7 @@ void add_elements(scene* scn, const add_elements_options& opts) {
                 if (!shp->norm.empty()) continue;
                 shp->norm.resize(shp->pos.size(), {0, 0, 1});
                 if (!shp->lines.empty() || !shp->triangles.empty() ||
-                    !shp->quads.empty()) {
+                    !shp->quads.empty() || !shp->beziers.empty()) {
                     compute_normals(shp);
                 }
                 if (!shp->quads_pos.empty()) {
@@ -3565,7 +3941,7 @@ void flatten_instances(scene* scn) {
 // Build a shape BVH
 bvh_tree* make_bvh(const shape* shp, float def_radius, bool equalsize) {
     return make_bvh(shp->points, shp->lines, shp->triangles, shp->quads,
-        shp->pos, shp->radius, def_radius, equalsize);
+        shp->beziers, shp->pos, shp->radius, def_radius, equalsize);
 }
 
 // Build a scene BVH
@@ -3615,11 +3991,15 @@ void refit_bvh(
             }
         }
     }
+    // one bvh instance per shape, in the same order as make_bvh()
     auto ist_frames = std::vector<frame3f>();
     auto ist_frames_inv = std::vector<frame3f>();
     for (auto ist : scn->instances) {
-        ist_frames.push_back(ist->frame);
-        ist_frames_inv.push_back(inverse(ist->frame));
+        auto frame_inv = inverse(ist->frame);
+        for (auto sid = 0; sid < ist->shp->shapes.size(); sid++) {
+            ist_frames.push_back(ist->frame);
+            ist_frames_inv.push_back(frame_inv);
+        }
     }
     refit_bvh(bvh, ist_frames, ist_frames_inv);
 }
@@ -3667,24 +4047,53 @@ void print_info(const scene* scn) {
     printf("\n");
 }
 
+// Hash for obj vertex indices.
+inline uint32_t hash_obj_index(int idx) {
+    auto h = (uint32_t)idx * 0x9e3779b1u;
+    return h ^ (h >> 16);
+}
+inline uint32_t hash_obj_index(const obj_vertex& vert) {
+    auto h = (uint32_t)0;
+    for (auto v : {vert.pos, vert.texcoord, vert.norm, vert.color, vert.radius})
+        h = (h ^ (uint32_t)v) * 0x9e3779b1u;
+    return h ^ (h >> 16);
+}
+
+// Open-addressing map from obj indices to consecutive ids, assigned in
+// insertion order. The table is sized once from the number of inserted
+// keys, so it never rehashes.
+template <typename T>
+struct obj_index_map {
+    std::vector<T> keys;
+    std::vector<int> table;
+    uint32_t mask = 0;
+
+    obj_index_map(int nkeys) {
+        auto size = (uint32_t)16;
+        while (size < 2 * (uint32_t)nkeys) size *= 2;
+        table.assign(size, -1);
+        mask = size - 1;
+        keys.reserve(nkeys);
+    }
+
+    // Returns the id of key, inserting it if not present.
+    int insert(const T& key) {
+        auto h = hash_obj_index(key) & mask;
+        while (table[h] >= 0) {
+            if (keys[table[h]] == key) return table[h];
+            h = (h + 1) & mask;
+        }
+        table[h] = (int)keys.size();
+        keys.push_back(key);
+        return table[h];
+    }
+};
+
 // Flattens an scene
 scene* obj_to_scene(const obj_scene* obj, const load_options& opts) {
     // clear scene
     auto scn = new scene();
 
-    struct obj_vertex_hash {
-        std::hash<int> Th;
-        size_t operator()(const obj_vertex& vv) const {
-            auto v = (const int*)&vv;
-            size_t h = 0;
-            for (auto i = 0; i < sizeof(obj_vertex) / sizeof(int); i++) {
-                // embads hash_combine below
-                h ^= (Th(v[i]) + 0x9e3779b9 + (h << 6) + (h >> 2));
-            }
-            return h;
-        }
-    };
-
     // convert textures
     auto tmap = std::unordered_map<std::string, texture*>{{"", nullptr}};
     for (auto otxt : obj->textures) {
@@ -3775,291 +4184,318 @@ scene* obj_to_scene(const obj_scene* obj, const load_options& opts) {
     }
 
     // convert meshes
-    auto omap = std::unordered_map<std::string, shape_group*>{{"", nullptr}};
-    for (auto omsh : obj->objects) {
-        auto sgr = new shape_group();
-        sgr->name = omsh->name;
-        for (auto oshp : omsh->groups) {
-            if (oshp->verts.empty()) continue;
-            if (oshp->elems.empty()) continue;
+    auto convert_shape = [&](const obj_group* oshp) -> shape* {
+        if (oshp->verts.empty()) return nullptr;
+        if (oshp->elems.empty()) return nullptr;
 
-            auto shp = new shape();
-            shp->name = oshp->groupname;
-            shp->mat = mmap[oshp->matname];
-            if (oshp->props.find("subdivision") != oshp->props.end()) {
-                shp->subdivision =
-                    atoi(oshp->props.at("subdivision").at(0).c_str());
-            }
-            if (oshp->props.find("catmullclark") != oshp->props.end()) {
-                shp->catmullclark =
-                    (bool)atoi(oshp->props.at("catmullclark").at(1).c_str());
-            }
-
-            // check to see if this shuold be face-varying or flat
-            // quads
-            auto as_facevarying = false, as_quads = false;
-            if (opts.preserve_quads || opts.preserve_facevarying) {
-                auto face_max = 0;
-                for (auto& elem : oshp->elems) {
-                    if (elem.type != obj_element_type::face) {
-                        face_max = 0;
-                        break;
-                    } else {
-                        face_max = max(face_max, (int)elem.size);
-                    }
+        auto shp = new shape();
+        shp->name = oshp->groupname;
+        // lookup without inserting, since groups are converted concurrently
+        auto mit = mmap.find(oshp->matname);
+        shp->mat = (mit != mmap.end()) ? mit->second : nullptr;
+        if (oshp->props.find("subdivision") != oshp->props.end()) {
+            shp->subdivision =
+                atoi(oshp->props.at("subdivision").at(0).c_str());
+        }
+        if (oshp->props.find("catmullclark") != oshp->props.end()) {
+            shp->catmullclark =
+                (bool)atoi(oshp->props.at("catmullclark").at(1).c_str());
+        }
+
+        // check to see if this shuold be face-varying or flat
+        // quads
+        auto as_facevarying = false, as_quads = false;
+        if (opts.preserve_quads || opts.preserve_facevarying) {
+            auto face_max = 0;
+            for (auto& elem : oshp->elems) {
+                if (elem.type != obj_element_type::face) {
+                    face_max = 0;
+                    break;
+                } else {
+                    face_max = max(face_max, (int)elem.size);
                 }
-                as_quads = opts.preserve_quads && face_max > 3;
-                as_facevarying = opts.preserve_facevarying && face_max > 2;
-                // in case of facevarying, check if there is really
-                // need for it
-                if (as_facevarying) {
-                    auto need_facevarying = false;
-                    for (auto& elem : oshp->elems) {
-                        for (auto i = elem.start; i < elem.start + elem.size;
-                             i++) {
-                            auto& v = oshp->verts[i];
-                            if ((v.norm >= 0 && v.pos != v.norm) ||
-                                (v.texcoord >= 0 && v.pos != v.texcoord) ||
-                                (v.norm >= 0 && v.texcoord >= 0 &&
-                                    v.norm != v.texcoord))
-                                need_facevarying = true;
-                            if (v.color >= 0 || v.radius >= 0)
-                                as_facevarying = false;
-                        }
-                        if (!as_facevarying) break;
+            }
+            as_quads = opts.preserve_quads && face_max > 3;
+            as_facevarying = opts.preserve_facevarying && face_max > 2;
+            // in case of facevarying, check if there is really
+            // need for it
+            if (as_facevarying) {
+                auto need_facevarying = false;
+                for (auto& elem : oshp->elems) {
+                    for (auto i = elem.start; i < elem.start + elem.size;
+                         i++) {
+                        auto& v = oshp->verts[i];
+                        if ((v.norm >= 0 && v.pos != v.norm) ||
+                            (v.texcoord >= 0 && v.pos != v.texcoord) ||
+                            (v.norm >= 0 && v.texcoord >= 0 &&
+                                v.norm != v.texcoord))
+                            need_facevarying = true;
+                        if (v.color >= 0 || v.radius >= 0)
+                            as_facevarying = false;
                     }
-                    as_facevarying = need_facevarying;
+                    if (!as_facevarying) break;
                 }
+                as_facevarying = need_facevarying;
             }
+        }
 
-            if (!as_facevarying) {
-                // insert all vertices
-                std::unordered_map<obj_vertex, int, obj_vertex_hash> vert_map;
-                std::vector<int> vert_ids;
-                for (auto& vert : oshp->verts) {
-                    if (vert_map.find(vert) == vert_map.end()) {
-                        auto s = (int)vert_map.size();
-                        vert_map[vert] = s;
-                    }
-                    vert_ids.push_back(vert_map.at(vert));
-                }
+        if (!as_facevarying) {
+            // insert all vertices
+            auto vert_map = obj_index_map<obj_vertex>((int)oshp->verts.size());
+            auto vert_ids = std::vector<int>(oshp->verts.size());
+            for (auto i = 0; i < oshp->verts.size(); i++) {
+                vert_ids[i] = vert_map.insert(oshp->verts[i]);
+            }
 
-                // convert elements
-                for (auto& elem : oshp->elems) {
-                    switch (elem.type) {
-                        case obj_element_type::point: {
-                            for (auto i = elem.start;
+            // convert elements
+            for (auto& elem : oshp->elems) {
+                switch (elem.type) {
+                    case obj_element_type::point: {
+                        for (auto i = elem.start;
+                             i < elem.start + elem.size; i++) {
+                            shp->points.push_back(vert_ids[i]);
+                        }
+                    } break;
+                    case obj_element_type::line: {
+                        for (auto i = elem.start;
+                             i < elem.start + elem.size - 1; i++) {
+                            shp->lines.push_back(
+                                {vert_ids[i], vert_ids[i + 1]});
+                        }
+                    } break;
+                    case obj_element_type::face: {
+                        if (as_quads && elem.size == 4) {
+                            shp->quads.push_back({vert_ids[elem.start + 0],
+                                vert_ids[elem.start + 1],
+                                vert_ids[elem.start + 2],
+                                vert_ids[elem.start + 3]});
+                        } else if (as_quads && elem.size != 4) {
+                            for (auto i = elem.start + 2;
                                  i < elem.start + elem.size; i++) {
-                                shp->points.push_back(vert_ids[i]);
-                            }
-                        } break;
-                        case obj_element_type::line: {
-                            for (auto i = elem.start;
-                                 i < elem.start + elem.size - 1; i++) {
-                                shp->lines.push_back(
-                                    {vert_ids[i], vert_ids[i + 1]});
-                            }
-                        } break;
-                        case obj_element_type::face: {
-                            if (as_quads && elem.size == 4) {
-                                shp->quads.push_back({vert_ids[elem.start + 0],
-                                    vert_ids[elem.start + 1],
-                                    vert_ids[elem.start + 2],
-                                    vert_ids[elem.start + 3]});
-                            } else if (as_quads && elem.size != 4) {
-                                for (auto i = elem.start + 2;
-                                     i < elem.start + elem.size; i++) {
-                                    shp->quads.push_back(
-                                        {vert_ids[elem.start], vert_ids[i - 1],
-                                            vert_ids[i], vert_ids[i]});
-                                }
-                            } else {
-                                for (auto i = elem.start + 2;
-                                     i < elem.start + elem.size; i++) {
-                                    shp->triangles.push_back(
-                                        {vert_ids[elem.start], vert_ids[i - 1],
-                                            vert_ids[i]});
-                                }
+                                shp->quads.push_back(
+                                    {vert_ids[elem.start], vert_ids[i - 1],
+                                        vert_ids[i], vert_ids[i]});
                             }
-                        } break;
-                        case obj_element_type::bezier: {
-                            if ((elem.size - 1) % 3)
-                                throw std::runtime_error("bad obj bezier");
-                            for (auto i = elem.start + 1;
-                                 i < elem.start + elem.size; i += 3) {
-                                shp->beziers.push_back(
-                                    {vert_ids[i - 1], vert_ids[i],
-                                        vert_ids[i + 1], vert_ids[i + 2]});
+                        } else {
+                            for (auto i = elem.start + 2;
+                                 i < elem.start + elem.size; i++) {
+                                shp->triangles.push_back(
+                                    {vert_ids[elem.start], vert_ids[i - 1],
+                                        vert_ids[i]});
                             }
-                        } break;
-                        default: { assert(false); }
-                    }
+                        }
+                    } break;
+                    case obj_element_type::bezier: {
+                        if ((elem.size - 1) % 3)
+                            throw std::runtime_error("bad obj bezier");
+                        for (auto i = elem.start + 1;
+                             i < elem.start + elem.size; i += 3) {
+                            shp->beziers.push_back(
+                                {vert_ids[i - 1], vert_ids[i],
+                                    vert_ids[i + 1], vert_ids[i + 2]});
+                        }
+                    } break;
+                    default: { assert(false); }
                 }
+            }
 
-                // copy vertex data
-                auto v = oshp->verts[0];
-                if (v.pos >= 0) shp->pos.resize(vert_map.size());
-                if (v.texcoord >= 0) shp->texcoord.resize(vert_map.size());
-                if (v.norm >= 0) shp->norm.resize(vert_map.size());
-                if (v.color >= 0) shp->color.resize(vert_map.size());
-                if (v.radius >= 0) shp->radius.resize(vert_map.size());
-                for (auto& kv : vert_map) {
-                    auto idx = kv.second;
-                    auto vert = kv.first;
-                    if (v.pos >= 0 && vert.pos >= 0)
-                        shp->pos[idx] = obj->pos[vert.pos];
-                    if (v.texcoord >= 0 && vert.texcoord >= 0)
-                        shp->texcoord[idx] = obj->texcoord[vert.texcoord];
-                    if (v.norm >= 0 && vert.norm >= 0)
-                        shp->norm[idx] = obj->norm[vert.norm];
-                    if (v.color >= 0 && vert.color >= 0)
-                        shp->color[idx] = obj->color[vert.color];
-                    if (v.radius >= 0 && vert.radius >= 0)
-                        shp->radius[idx] = obj->radius[vert.radius];
+            // copy vertex data
+            auto v = oshp->verts[0];
+            auto nverts = vert_map.keys.size();
+            if (v.pos >= 0) shp->pos.resize(nverts);
+            if (v.texcoord >= 0) shp->texcoord.resize(nverts);
+            if (v.norm >= 0) shp->norm.resize(nverts);
+            if (v.color >= 0) shp->color.resize(nverts);
+            if (v.radius >= 0) shp->radius.resize(nverts);
+            for (auto idx = 0; idx < nverts; idx++) {
+                auto& vert = vert_map.keys[idx];
+                if (v.pos >= 0 && vert.pos >= 0)
+                    shp->pos[idx] = obj->pos[vert.pos];
+                if (v.texcoord >= 0 && vert.texcoord >= 0)
+                    shp->texcoord[idx] = obj->texcoord[vert.texcoord];
+                if (v.norm >= 0 && vert.norm >= 0)
+                    shp->norm[idx] = obj->norm[vert.norm];
+                if (v.color >= 0 && vert.color >= 0)
+                    shp->color[idx] = obj->color[vert.color];
+                if (v.radius >= 0 && vert.radius >= 0)
+                    shp->radius[idx] = obj->radius[vert.radius];
+            }
+
+            // fix smoothing
+            if (!oshp->smoothing && opts.obj_facet_non_smooth) {
+                auto faceted = new shape();
+                faceted->name = shp->name;
+                auto pidx = std::vector<int>();
+                for (auto point : shp->points) {
+                    faceted->points.push_back((int)pidx.size());
+                    pidx.push_back(point);
+                }
+                for (auto line : shp->lines) {
+                    faceted->lines.push_back(
+                        {(int)pidx.size() + 0, (int)pidx.size() + 1});
+                    pidx.push_back(line.x);
+                    pidx.push_back(line.y);
+                }
+                for (auto triangle : shp->triangles) {
+                    faceted->triangles.push_back({(int)pidx.size() + 0,
+                        (int)pidx.size() + 1, (int)pidx.size() + 2});
+                    pidx.push_back(triangle.x);
+                    pidx.push_back(triangle.y);
+                    pidx.push_back(triangle.z);
+                }
+                for (auto idx : pidx) {
+                    if (!shp->pos.empty())
+                        faceted->pos.push_back(shp->pos[idx]);
+                    if (!shp->norm.empty())
+                        faceted->norm.push_back(shp->norm[idx]);
+                    if (!shp->texcoord.empty())
+                        faceted->texcoord.push_back(shp->texcoord[idx]);
+                    if (!shp->color.empty())
+                        faceted->color.push_back(shp->color[idx]);
+                    if (!shp->radius.empty())
+                        faceted->radius.push_back(shp->radius[idx]);
+                }
+                delete shp;
+                shp = faceted;
+            }
+        } else {
+            // insert all vertices
+            auto nverts = (int)oshp->verts.size();
+            auto pos_map = obj_index_map<int>(nverts);
+            auto norm_map = obj_index_map<int>(nverts);
+            auto texcoord_map = obj_index_map<int>(nverts);
+            std::vector<int> pos_ids, norm_ids, texcoord_ids;
+            for (auto& vert : oshp->verts) {
+                if (vert.pos >= 0) {
+                    pos_ids.push_back(pos_map.insert(vert.pos));
+                } else {
+                    if (!pos_ids.empty())
+                        throw std::runtime_error("malformed obj");
+                }
+                if (vert.norm >= 0) {
+                    norm_ids.push_back(norm_map.insert(vert.norm));
+                } else {
+                    if (!norm_ids.empty())
+                        throw std::runtime_error("malformed obj");
                 }
+                if (vert.texcoord >= 0) {
+                    texcoord_ids.push_back(texcoord_map.insert(vert.texcoord));
+                } else {
+                    if (!texcoord_ids.empty())
+                        throw std::runtime_error("malformed obj");
+                }
+            }
 
-                // fix smoothing
-                if (!oshp->smoothing && opts.obj_facet_non_smooth) {
-                    auto faceted = new shape();
-                    faceted->name = shp->name;
-                    auto pidx = std::vector<int>();
-                    for (auto point : shp->points) {
-                        faceted->points.push_back((int)pidx.size());
-                        pidx.push_back(point);
-                    }
-                    for (auto line : shp->lines) {
-                        faceted->lines.push_back(
-                            {(int)pidx.size() + 0, (int)pidx.size() + 1});
-                        pidx.push_back(line.x);
-                        pidx.push_back(line.y);
+            // convert elements
+            for (auto elem : oshp->elems) {
+                if (elem.size == 4) {
+                    if (!pos_ids.empty()) {
+                        shp->quads_pos.push_back({pos_ids[elem.start + 0],
+                            pos_ids[elem.start + 1],
+                            pos_ids[elem.start + 2],
+                            pos_ids[elem.start + 3]});
                     }
-                    for (auto triangle : shp->triangles) {
-                        faceted->triangles.push_back({(int)pidx.size() + 0,
-                            (int)pidx.size() + 1, (int)pidx.size() + 2});
-                        pidx.push_back(triangle.x);
-                        pidx.push_back(triangle.y);
-                        pidx.push_back(triangle.z);
+                    if (!texcoord_ids.empty()) {
+                        shp->quads_texcoord.push_back(
+                            {texcoord_ids[elem.start + 0],
+                                texcoord_ids[elem.start + 1],
+                                texcoord_ids[elem.start + 2],
+                                texcoord_ids[elem.start + 3]});
                     }
-                    for (auto idx : pidx) {
-                        if (!shp->pos.empty())
-                            faceted->pos.push_back(shp->pos[idx]);
-                        if (!shp->norm.empty())
-                            faceted->norm.push_back(shp->norm[idx]);
-                        if (!shp->texcoord.empty())
-                            faceted->texcoord.push_back(shp->texcoord[idx]);
-                        if (!shp->color.empty())
-                            faceted->color.push_back(shp->color[idx]);
-                        if (!shp->radius.empty())
-                            faceted->radius.push_back(shp->radius[idx]);
+                    if (!norm_ids.empty()) {
+                        shp->quads_norm.push_back({norm_ids[elem.start + 0],
+                            norm_ids[elem.start + 1],
+                            norm_ids[elem.start + 2],
+                            norm_ids[elem.start + 3]});
                     }
-                    delete shp;
-                    shp = faceted;
-                }
-            } else {
-                // insert all vertices
-                std::unordered_map<int, int> pos_map, norm_map, texcoord_map;
-                std::vector<int> pos_ids, norm_ids, texcoord_ids;
-                for (auto& vert : oshp->verts) {
-                    if (vert.pos >= 0) {
-                        if (pos_map.find(vert.pos) == pos_map.end()) {
-                            auto s = (int)pos_map.size();
-                            pos_map[vert.pos] = s;
+                } else {
+                    if (!pos_ids.empty()) {
+                        for (auto i = elem.start + 2;
+                             i < elem.start + elem.size; i++) {
+                            shp->quads_pos.push_back({pos_ids[elem.start],
+                                pos_ids[i - 1], pos_ids[i], pos_ids[i]});
                         }
-                        pos_ids.push_back(pos_map.at(vert.pos));
-                    } else {
-                        if (!pos_ids.empty())
-                            throw std::runtime_error("malformed obj");
                     }
-                    if (vert.norm >= 0) {
-                        if (norm_map.find(vert.norm) == norm_map.end()) {
-                            auto s = (int)norm_map.size();
-                            norm_map[vert.norm] = s;
+                    if (!texcoord_ids.empty()) {
+                        for (auto i = elem.start + 2;
+                             i < elem.start + elem.size; i++) {
+                            shp->quads_texcoord.push_back(
+                                {texcoord_ids[elem.start],
+                                    texcoord_ids[i - 1], texcoord_ids[i],
+                                    texcoord_ids[i]});
                         }
-                        norm_ids.push_back(norm_map.at(vert.norm));
-                    } else {
-                        if (!norm_ids.empty())
-                            throw std::runtime_error("malformed obj");
                     }
-                    if (vert.texcoord >= 0) {
-                        if (texcoord_map.find(vert.texcoord) ==
-                            texcoord_map.end()) {
-                            auto s = (int)texcoord_map.size();
-                            texcoord_map[vert.texcoord] = s;
+                    if (!norm_ids.empty()) {
+                        for (auto i = elem.start + 2;
+                             i < elem.start + elem.size; i++) {
+                            shp->quads_norm.push_back({norm_ids[elem.start],
+                                norm_ids[i - 1], norm_ids[i], norm_ids[i]});
                         }
-                        texcoord_ids.push_back(texcoord_map.at(vert.texcoord));
-                    } else {
-                        if (!texcoord_ids.empty())
-                            throw std::runtime_error("malformed obj");
                     }
                 }
+            }
 
-                // convert elements
-                for (auto elem : oshp->elems) {
-                    if (elem.size == 4) {
-                        if (!pos_ids.empty()) {
-                            shp->quads_pos.push_back({pos_ids[elem.start + 0],
-                                pos_ids[elem.start + 1],
-                                pos_ids[elem.start + 2],
-                                pos_ids[elem.start + 3]});
-                        }
-                        if (!texcoord_ids.empty()) {
-                            shp->quads_texcoord.push_back(
-                                {texcoord_ids[elem.start + 0],
-                                    texcoord_ids[elem.start + 1],
-                                    texcoord_ids[elem.start + 2],
-                                    texcoord_ids[elem.start + 3]});
-                        }
-                        if (!norm_ids.empty()) {
-                            shp->quads_norm.push_back({norm_ids[elem.start + 0],
-                                norm_ids[elem.start + 1],
-                                norm_ids[elem.start + 2],
-                                norm_ids[elem.start + 3]});
-                        }
-                    } else {
-                        if (!pos_ids.empty()) {
-                            for (auto i = elem.start + 2;
-                                 i < elem.start + elem.size; i++) {
-                                shp->quads_pos.push_back({pos_ids[elem.start],
-                                    pos_ids[i - 1], pos_ids[i], pos_ids[i]});
-                            }
-                        }
-                        if (!texcoord_ids.empty()) {
-                            for (auto i = elem.start + 2;
-                                 i < elem.start + elem.size; i++) {
-                                shp->quads_texcoord.push_back(
-                                    {texcoord_ids[elem.start],
-                                        texcoord_ids[i - 1], texcoord_ids[i],
-                                        texcoord_ids[i]});
-                            }
-                        }
-                        if (!norm_ids.empty()) {
-                            for (auto i = elem.start + 2;
-                                 i < elem.start + elem.size; i++) {
-                                shp->quads_norm.push_back({norm_ids[elem.start],
-                                    norm_ids[i - 1], norm_ids[i], norm_ids[i]});
-                            }
-                        }
-                    }
-                }
+            // copy vertex data
+            shp->pos.resize(pos_map.keys.size());
+            shp->texcoord.resize(texcoord_map.keys.size());
+            shp->norm.resize(norm_map.keys.size());
+            for (auto idx = 0; idx < pos_map.keys.size(); idx++) {
+                shp->pos[idx] = obj->pos[pos_map.keys[idx]];
+            }
+            for (auto idx = 0; idx < texcoord_map.keys.size(); idx++) {
+                shp->texcoord[idx] = obj->texcoord[texcoord_map.keys[idx]];
+            }
+            for (auto idx = 0; idx < norm_map.keys.size(); idx++) {
+                shp->norm[idx] = obj->norm[norm_map.keys[idx]];
+            }
 
-                // copy vertex data
-                shp->pos.resize(pos_map.size());
-                shp->texcoord.resize(texcoord_map.size());
-                shp->norm.resize(norm_map.size());
-                for (auto& kv : pos_map) {
-                    shp->pos[kv.second] = obj->pos[kv.first];
-                }
-                for (auto& kv : texcoord_map) {
-                    shp->texcoord[kv.second] = obj->texcoord[kv.first];
-                }
-                for (auto& kv : norm_map) {
-                    shp->norm[kv.second] = obj->norm[kv.first];
-                }
+            // fix smoothing
+            if (!oshp->smoothing && opts.obj_facet_non_smooth) {}
+        }
+        return shp;
+    };
 
-                // fix smoothing
-                if (!oshp->smoothing && opts.obj_facet_non_smooth) {}
+    // groups are converted in parallel since vertex deduplication dominates
+    // the conversion time on large meshes
+    auto ogroups = std::vector<const obj_group*>();
+    for (auto omsh : obj->objects) {
+        for (auto oshp : omsh->groups) ogroups.push_back(oshp);
+    }
+    auto shps = std::vector<shape*>(ogroups.size(), nullptr);
+    if (ogroups.size() <= 1) {
+        for (auto gid = 0; gid < ogroups.size(); gid++)
+            shps[gid] = convert_shape(ogroups[gid]);
+    } else {
+        auto nthreads = min((int)std::thread::hardware_concurrency(),
+            (int)ogroups.size());
+        nthreads = max(nthreads, 1);
+        auto errors = std::vector<std::exception_ptr>(nthreads);
+        auto threads = std::vector<std::thread>();
+        for (auto tid = 0; tid < nthreads; tid++) {
+            threads.push_back(std::thread([&, tid]() {
+                try {
+                    for (auto gid = tid; gid < ogroups.size(); gid += nthreads)
+                        shps[gid] = convert_shape(ogroups[gid]);
+                } catch (...) { errors[tid] = std::current_exception(); }
+            }));
+        }
+        for (auto& t : threads) t.join();
+        for (auto& error : errors) {
+            if (error) {
+                for (auto shp : shps) delete shp;
+                std::rethrow_exception(error);
             }
-            sgr->shapes.push_back(shp);
+        }
+    }
+
+    auto omap = std::unordered_map<std::string, shape_group*>{{"", nullptr}};
+    auto gid = 0;
+    for (auto omsh : obj->objects) {
+        auto sgr = new shape_group();
+        sgr->name = omsh->name;
+        for (auto i = 0; i < (int)omsh->groups.size(); i++) {
+            auto shp = shps[gid++];
+            if (shp) sgr->shapes.push_back(shp);
         }
         scn->shapes.push_back(sgr);
         omap[omsh->name] = sgr;
@@ -4466,7 +4902,7 @@ void save_obj_scene(
     const std::string& filename, const scene* scn, const save_options& opts) {
     auto oscn = std::unique_ptr<obj_scene>(scene_to_obj(scn));
     save_obj(filename, oscn.get(), opts.save_textures, opts.skip_missing,
-        opts.obj_flip_texcoord, opts.obj_flip_tr);
+        opts.obj_flip_texcoord, opts.obj_flip_tr, opts.obj_precision);
 }
 
 #if YGL_GLTF
@@ -4591,33 +5027,19 @@ scene* gltf_to_scene(const glTF* gltf, const load_options& opts) {
                 auto semantic = gattr.first;
                 auto vals = accessor_view(gltf, gltf->get(gattr.second));
                 if (semantic == "POSITION") {
-                    shp->pos.reserve(vals.size());
-                    for (auto i = 0; i < vals.size(); i++)
-                        shp->pos.push_back(vals.getv3f(i));
+                    vals.get_all(shp->pos);
                 } else if (semantic == "NORMAL") {
-                    shp->norm.reserve(vals.size());
-                    for (auto i = 0; i < vals.size(); i++)
-                        shp->norm.push_back(vals.getv3f(i));
+                    vals.get_all(shp->norm);
                 } else if (semantic == "TEXCOORD" || semantic == "TEXCOORD_0") {
-                    shp->texcoord.reserve(vals.size());
-                    for (auto i = 0; i < vals.size(); i++)
-                        shp->texcoord.push_back(vals.getv2f(i));
+                    vals.get_all(shp->texcoord);
                 } else if (semantic == "TEXCOORD_1") {
-                    shp->texcoord1.reserve(vals.size());
-                    for (auto i = 0; i < vals.size(); i++)
-                        shp->texcoord1.push_back(vals.getv2f(i));
+                    vals.get_all(shp->texcoord1);
                 } else if (semantic == "COLOR" || semantic == "COLOR_0") {
-                    shp->color.reserve(vals.size());
-                    for (auto i = 0; i < vals.size(); i++)
-                        shp->color.push_back(vals.getv4f(i, {0, 0, 0, 1}));
+                    vals.get_all(shp->color, {0, 0, 0, 1});
                 } else if (semantic == "TANGENT") {
-                    shp->tangsp.reserve(vals.size());
-                    for (auto i = 0; i < vals.size(); i++)
-                        shp->tangsp.push_back(vals.getv4f(i));
+                    vals.get_all(shp->tangsp);
                 } else if (semantic == "RADIUS") {
-                    shp->radius.reserve(vals.size());
-                    for (auto i = 0; i < vals.size(); i++)
-                        shp->radius.push_back(vals.get(i, 0));
+                    vals.get_all(shp->radius);
                 } else {
                     // ignore
                 }
@@ -4672,58 +5094,58 @@ scene* gltf_to_scene(const glTF* gltf, const load_options& opts) {
                     } break;
                 }
             } else {
-                auto indices = accessor_view(gltf, gltf->get(gprim->indices));
+                auto indices = std::vector<int>();
+                auto indices_view =
+                    accessor_view(gltf, gltf->get(gprim->indices));
+                indices_view.get_all(indices);
                 switch (gprim->mode) {
                     case glTFMeshPrimitiveMode::Triangles: {
                         shp->triangles.reserve(indices.size());
                         for (auto i = 0; i < indices.size() / 3; i++) {
-                            shp->triangles.push_back({indices.geti(i * 3 + 0),
-                                indices.geti(i * 3 + 1),
-                                indices.geti(i * 3 + 2)});
+                            shp->triangles.push_back({indices[i * 3 + 0],
+                                indices[i * 3 + 1], indices[i * 3 + 2]});
                         }
                     } break;
                     case glTFMeshPrimitiveMode::TriangleFan: {
                         shp->triangles.reserve(indices.size() - 2);
                         for (auto i = 2; i < indices.size(); i++) {
-                            shp->triangles.push_back({indices.geti(0),
-                                indices.geti(i - 1), indices.geti(i)});
+                            shp->triangles.push_back(
+                                {indices[0], indices[i - 1], indices[i]});
                         }
                     } break;
                     case glTFMeshPrimitiveMode::TriangleStrip: {
                         shp->triangles.reserve(indices.size() - 2);
                         for (auto i = 2; i < indices.size(); i++) {
-                            shp->triangles.push_back({indices.geti(i - 2),
-                                indices.geti(i - 1), indices.geti(i)});
+                            shp->triangles.push_back(
+                                {indices[i - 2], indices[i - 1], indices[i]});
                         }
                     } break;
                     case glTFMeshPrimitiveMode::Lines: {
                         shp->lines.reserve(indices.size() / 2);
                         for (auto i = 0; i < indices.size() / 2; i++) {
-                            shp->lines.push_back({indices.geti(i * 2 + 0),
-                                indices.geti(i * 2 + 1)});
+                            shp->lines.push_back(
+                                {indices[i * 2 + 0], indices[i * 2 + 1]});
                         }
                     } break;
                     case glTFMeshPrimitiveMode::LineLoop: {
                         shp->lines.reserve(indices.size());
                         for (auto i = 1; i < indices.size(); i++) {
-                            shp->lines.push_back(
-                                {indices.geti(i - 1), indices.geti(i)});
+                            shp->lines.push_back({indices[i - 1], indices[i]});
                         }
                         shp->lines.back() = {
-                            indices.geti(indices.size() - 1), indices.geti(0)};
+                            indices[indices.size() - 1], indices[0]};
                     } break;
                     case glTFMeshPrimitiveMode::LineStrip: {
                         shp->lines.reserve(indices.size() - 1);
                         for (auto i = 1; i < indices.size(); i++) {
-                            shp->lines.push_back(
-                                {indices.geti(i - 1), indices.geti(i)});
+                            shp->lines.push_back({indices[i - 1], indices[i]});
                         }
                     } break;
                     case glTFMeshPrimitiveMode::NotSet:
                     case glTFMeshPrimitiveMode::Points: {
                         shp->points.reserve(indices.size());
                         for (auto i = 0; i < indices.size(); i++) {
-                            shp->points.push_back(indices.geti(i));
+                            shp->points.push_back(indices[i]);
                         }
                     } break;
                 }
@@ -4820,17 +5242,13 @@ scene* gltf_to_scene(const glTF* gltf, const load_options& opts) {
                 auto anm = new animation();
                 auto input_view =
                     accessor_view(gltf, gltf->get(gsampler->input));
-                anm->times.resize(input_view.size());
-                for (auto i = 0; i < input_view.size(); i++)
-                    anm->times[i] = input_view.get(i);
+                input_view.get_all(anm->times);
                 anm->type = keyframe_types.at(gsampler->interpolation);
                 auto output_view =
                     accessor_view(gltf, gltf->get(gsampler->output));
                 switch (gchannel->target->path) {
                     case glTFAnimationChannelTargetPath::Translation: {
-                        anm->translation.reserve(output_view.size());
-                        for (auto i = 0; i < output_view.size(); i++)
-                            anm->translation.push_back(output_view.getv3f(i));
+                        output_view.get_all(anm->translation);
                     } break;
                     case glTFAnimationChannelTargetPath::Rotation: {
                         anm->rotation.reserve(output_view.size());
@@ -4839,9 +5257,7 @@ scene* gltf_to_scene(const glTF* gltf, const load_options& opts) {
                                 (quat4f)output_view.getv4f(i));
                     } break;
                     case glTFAnimationChannelTargetPath::Scale: {
-                        anm->scaling.reserve(output_view.size());
-                        for (auto i = 0; i < output_view.size(); i++)
-                            anm->scaling.push_back(output_view.getv3f(i));
+                        output_view.get_all(anm->scaling);
                     } break;
                     case glTFAnimationChannelTargetPath::Weights: {
                         // get a node that it refers to
@@ -4907,7 +5323,20 @@ scene* load_gltf_scene(const std::string& filename, const load_options& opts) {
     return scn.release();
 }
 
-// Unflattnes gltf
+// Load a binary gltf scene
+scene* load_binary_gltf_scene(
+    const std::string& filename, const load_options& opts) {
+    auto gscn = std::unique_ptr<glTF>(load_binary_gltf(
+        filename, true, opts.load_textures, opts.skip_missing));
+    auto scn = std::unique_ptr<scene>(gltf_to_scene(gscn.get(), opts));
+    if (!scn) {
+        throw std::runtime_error("could not convert gltf scene");
+        return nullptr;
+    }
+    return scn.release();
+}
+
+// Unflattnes gltf. Accessors with the same data are shared.
 glTF* scene_to_gltf(
     const scene* scn, const std::string& buffer_uri, bool separate_buffers) {
     auto gltf = std::unique_ptr<glTF>(new glTF());
@@ -4971,6 +5400,22 @@ glTF* scene_to_gltf(
         return (int)(pos - vec.begin());
     };
 
+    // index of an object, with maps built once since scenes may have many
+    // shapes and instances
+    auto make_index_map = [](const auto& vec) {
+        auto map = std::unordered_map<const void*, int>();
+        for (auto idx = 0; idx < (int)vec.size(); idx++)
+            map.insert({vec[idx], idx});
+        return map;
+    };
+    auto find_index = [](const auto& map, const void* val) -> int {
+        auto it = map.find(val);
+        return (it == map.end()) ? -1 : it->second;
+    };
+    auto material_ids = make_index_map(scn->materials);
+    auto shape_ids = make_index_map(scn->shapes);
+    auto node_ids = make_index_map(scn->nodes);
+
     // add a texture and sampler
     auto add_texture_info = [&gltf, &index, scn](const texture* txt,
                                 const texture_info* info, bool norm = false,
@@ -5096,11 +5541,28 @@ glTF* scene_to_gltf(
         }
     };
 
+    // accessors by hash of their data, to share the ones that are identical
+    auto accessor_map = std::unordered_multimap<uint64_t, int>();
+
     // attribute handling
-    auto add_accessor = [&gltf, &index](glTFBuffer* gbuffer,
+    auto add_accessor = [&gltf, &index, &accessor_map](glTFBuffer* gbuffer,
                             const std::string& name, glTFAccessorType type,
                             glTFAccessorComponentType ctype, int count,
                             int csize, const void* data, bool save_min_max) {
+        auto size = (size_t)count * (size_t)csize;
+        auto hash = hash_bytes((const byte*)data, size);
+        auto range = accessor_map.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            auto acc = gltf->accessors[it->second];
+            auto view = gltf->bufferViews[(int)acc->bufferView];
+            if (gltf->buffers[(int)view->buffer] != gbuffer ||
+                view->byteLength != size || acc->type != type ||
+                acc->componentType != ctype)
+                continue;
+            if (!memcmp(gbuffer->data.data() + view->byteOffset, data, size))
+                return glTFid<glTFAccessor>(it->second);
+        }
+
         gltf->bufferViews.push_back(new glTFBufferView());
         auto bufferView = gltf->bufferViews.back();
         bufferView->buffer = glTFid<glTFBuffer>(index(gltf->buffers, gbuffer));
@@ -5149,6 +5611,7 @@ glTF* scene_to_gltf(
                 default: break;
             }
         }
+        accessor_map.insert({hash, (int)gltf->accessors.size() - 1});
         return glTFid<glTFAccessor>((int)gltf->accessors.size() - 1);
     };
 
@@ -5160,7 +5623,7 @@ glTF* scene_to_gltf(
         for (auto shp : sgr->shapes) {
             auto gprim = new glTFMeshPrimitive();
             gprim->material =
-                glTFid<glTFMaterial>(index(scn->materials, shp->mat));
+                glTFid<glTFMaterial>(find_index(material_ids, shp->mat));
             if (!shp->pos.empty())
                 gprim->attributes["POSITION"] = add_accessor(gbuffer,
                     shp->name + "_pos", glTFAccessorType::Vec3,
@@ -5239,7 +5702,7 @@ glTF* scene_to_gltf(
         for (auto ist : scn->instances) {
             auto gnode = new glTFNode();
             gnode->name = ist->name;
-            gnode->mesh = glTFid<glTFMesh>(index(scn->shapes, ist->shp));
+            gnode->mesh = glTFid<glTFMesh>(find_index(shape_ids, ist->shp));
             gnode->matrix = frame_to_mat(ist->frame);
             gltf->nodes.push_back(gnode);
         }
@@ -5274,7 +5737,7 @@ glTF* scene_to_gltf(
             }
             if (nde->ist) {
                 gnode->mesh =
-                    glTFid<glTFMesh>(index(scn->shapes, nde->ist->shp));
+                    glTFid<glTFMesh>(find_index(shape_ids, nde->ist->shp));
             }
             gnode->matrix = frame_to_mat(nde->frame);
             gnode->translation = nde->translation;
@@ -5287,7 +5750,7 @@ glTF* scene_to_gltf(
         for (auto idx = 0; idx < scn->nodes.size(); idx++) {
             auto nde = scn->nodes.at(idx);
             if (!nde->parent) continue;
-            auto gnde = gltf->nodes.at(index(scn->nodes, nde->parent));
+            auto gnde = gltf->nodes.at(find_index(node_ids, nde->parent));
             gnde->children.push_back(glTFid<glTFNode>(idx));
         }
 
@@ -5380,7 +5843,7 @@ glTF* scene_to_gltf(
             gchan->sampler =
                 glTFid<glTFAnimationSampler>{index(agr->animations, kfr)};
             gchan->target = new glTFAnimationChannelTarget();
-            gchan->target->node = glTFid<glTFNode>{index(scn->nodes, node)};
+            gchan->target->node = glTFid<glTFNode>{find_index(node_ids, node)};
             gchan->target->path = paths.at(kfr);
             ganm->channels.push_back(gchan);
         }
@@ -5401,6 +5864,10 @@ void save_gltf_scene(
     save_gltf(filename, gscn.get(), true, opts.save_textures);
 }
 
+// Save a scene as a binary gltf, implemented with the gltf writer
+void save_binary_gltf_scene(
+    const std::string& filename, const scene* scn, const save_options& opts);
+
 #endif
 
 #if YGL_SVG
@@ -5452,45 +5919,520 @@ scene* load_svg_scene(const std::string& filename, const load_options& opts) {
 
 #endif
 
-// Load a scene
-scene* load_scene(const std::string& filename, const load_options& opts) {
-    auto ext = path_extension(filename);
-    if (ext == ".obj" || ext == ".OBJ") return load_obj_scene(filename, opts);
-#if YGL_GLTF
-    if (ext == ".gltf" || ext == ".GLTF")
-        return load_gltf_scene(filename, opts);
-#endif
-#if YGL_SVG
-    if (ext == ".svg" || ext == ".SVG") return load_svg_scene(filename, opts);
+// Read-only contents of a file, memory-mapped when supported.
+struct file_view {
+    const char* data = nullptr;       // file contents
+    size_t size = 0;                  // file size
+    void* mapped = nullptr;           // mapped memory
+    std::vector<unsigned char> copy;  // file copy if not mapped
+
+    ~file_view() {
+#ifndef _WIN32
+        if (mapped) munmap(mapped, size);
 #endif
-    throw std::runtime_error("unsupported extension " + ext);
-    return nullptr;
-}
+    }
+};
 
-// Save a scene
-void save_scene(
-    const std::string& filename, const scene* scn, const save_options& opts) {
-    auto ext = path_extension(filename);
-    if (ext == ".obj" || ext == ".OBJ")
-        return save_obj_scene(filename, scn, opts);
-#if YGL_GLTF
-    if (ext == ".gltf" || ext == ".GLTF")
-        return save_gltf_scene(filename, scn, opts);
+// Opens a file view, throwing on error.
+void open_file_view(file_view& view, const std::string& filename) {
+#ifndef _WIN32
+    auto fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open filename " + filename);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw std::runtime_error("cannot open filename " + filename);
+    }
+    view.size = (size_t)st.st_size;
+    if (view.size) {
+        view.mapped = mmap(nullptr, view.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view.mapped == MAP_FAILED) view.mapped = nullptr;
+    }
+    close(fd);
+    if (view.mapped) {
+        madvise(view.mapped, view.size, MADV_SEQUENTIAL);
+        view.data = (const char*)view.mapped;
+        return;
+    }
 #endif
-    throw std::runtime_error("unsupported extension " + ext);
+    try {
+        view.copy = load_binary(filename);
+    } catch (std::exception&) {
+        throw std::runtime_error("cannot open filename " + filename);
+    }
+    view.data = (const char*)view.copy.data();
+    view.size = view.copy.size();
 }
 
-}  // namespace ygl
-
-// -----------------------------------------------------------------------------
-// IMPLEMENTATION FOR PATH TRACING SUPPORT FUNCTION
-// -----------------------------------------------------------------------------
-namespace ygl {
+// Binary scene magic and version.
+static const uint32_t binary_scene_magic = 0x4e435359;  // "YSCN"
+static const uint32_t binary_scene_version = 1;
 
-// Phong exponent to roughness. Public API, see above.
-float specular_exponent_to_roughness(float n) { return sqrtf(2 / (n + 2)); }
+// Binary scene writer. Arrays are aligned to 16 bytes in the file so that
+// they can be copied in bulk from a mapped file.
+struct binary_scene_writer {
+    FILE* fs = nullptr;
+    size_t pos = 0;
+    std::unordered_map<const void*, int> ids;
 
-// Specular to fresnel eta. Public API, see above.
+    void write_raw(const void* data, size_t size) {
+        if (size && fwrite(data, 1, size, fs) != size)
+            throw std::runtime_error("cannot write binary scene");
+        pos += size;
+    }
+    void align() {
+        static const byte zeros[16] = {};
+        write_raw(zeros, (16 - pos % 16) % 16);
+    }
+    template <typename T>
+    void write(const T& val) {
+        static_assert(std::is_trivially_copyable<T>::value, "not a value");
+        write_raw(&val, sizeof(T));
+    }
+    void write(const std::string& val) {
+        write((uint64_t)val.size());
+        write_raw(val.data(), val.size());
+    }
+    template <typename T>
+    void write(const std::vector<T>& vals) {
+        static_assert(std::is_trivially_copyable<T>::value, "not a value");
+        write((uint64_t)vals.size());
+        align();
+        write_raw(vals.data(), vals.size() * sizeof(T));
+    }
+    template <typename T>
+    void write(const image<T>& img) {
+        write(img.w);
+        write(img.h);
+        write(img.pixels);
+    }
+    void write_info(const texture_info* info) {
+        write((bool)info);
+        if (info) write(*info);
+    }
+    // references are stored as indices in the scene arrays
+    template <typename T>
+    void add_ids(const std::vector<T*>& vals) {
+        for (auto idx = 0; idx < vals.size(); idx++) ids[vals[idx]] = idx;
+    }
+    void write_ref(const void* val) {
+        write((val) ? ids.at(val) : -1);
+    }
+};
+
+// Binary scene reader, over the contents of a file.
+struct binary_scene_reader {
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    bool load_textures = true;
+
+    void read_raw(void* val, size_t vsize) {
+        if (vsize > size - pos)
+            throw std::runtime_error("corrupted binary scene");
+        memcpy(val, data + pos, vsize);
+        pos += vsize;
+    }
+    void align() { pos = min(size, pos + (16 - pos % 16) % 16); }
+    template <typename T>
+    void read(T& val) {
+        read_raw(&val, sizeof(T));
+    }
+    void read(std::string& val) {
+        auto len = (uint64_t)0;
+        read(len);
+        if (len > size - pos)
+            throw std::runtime_error("corrupted binary scene");
+        val.assign(data + pos, len);
+        pos += len;
+    }
+    template <typename T>
+    void read(std::vector<T>& vals, bool skip = false) {
+        auto len = (uint64_t)0;
+        read(len);
+        align();
+        if (len > (size - pos) / sizeof(T))
+            throw std::runtime_error("corrupted binary scene");
+        if (skip) {
+            pos += len * sizeof(T);
+        } else {
+            vals.resize(len);
+            read_raw(vals.data(), len * sizeof(T));
+        }
+    }
+    template <typename T>
+    void read(image<T>& img) {
+        read(img.w);
+        read(img.h);
+        read(img.pixels, !load_textures);
+        if (!load_textures) img.w = img.h = 0;
+        if (load_textures && img.pixels.size() != (size_t)img.w * img.h)
+            throw std::runtime_error("corrupted binary scene");
+    }
+    void read_info(texture_info*& info) {
+        auto has_info = false;
+        read(has_info);
+        if (has_info) {
+            info = new texture_info();
+            read(*info);
+        }
+    }
+    template <typename T>
+    void read_ref(T*& val, const std::vector<T*>& vals) {
+        auto idx = 0;
+        read(idx);
+        if (idx < -1 || idx >= (int)vals.size())
+            throw std::runtime_error("corrupted binary scene");
+        val = (idx >= 0) ? vals[idx] : nullptr;
+    }
+};
+
+// Save a scene in the binary cache format
+void save_binary_scene(
+    const std::string& filename, const scene* scn, const save_options& opts) {
+    auto bin = binary_scene_writer();
+    bin.fs = fopen(filename.c_str(), "wb");
+    if (!bin.fs) throw std::runtime_error("cannot open filename " + filename);
+    auto fs_guard = std::unique_ptr<FILE, int (*)(FILE*)>(bin.fs, fclose);
+
+    bin.add_ids(scn->shapes);
+    bin.add_ids(scn->instances);
+    bin.add_ids(scn->materials);
+    bin.add_ids(scn->textures);
+    bin.add_ids(scn->cameras);
+    bin.add_ids(scn->environments);
+    bin.add_ids(scn->nodes);
+
+    // header with element counts, so that references can be resolved
+    // while reading
+    bin.write(binary_scene_magic);
+    bin.write(binary_scene_version);
+    bin.write((int)scn->textures.size());
+    bin.write((int)scn->materials.size());
+    bin.write((int)scn->shapes.size());
+    bin.write((int)scn->instances.size());
+    bin.write((int)scn->cameras.size());
+    bin.write((int)scn->environments.size());
+    bin.write((int)scn->nodes.size());
+    bin.write((int)scn->animations.size());
+
+    for (auto txt : scn->textures) {
+        bin.write(txt->name);
+        bin.write(txt->path);
+        bin.write(txt->ldr);
+        bin.write(txt->hdr);
+    }
+    for (auto mat : scn->materials) {
+        bin.write(mat->name);
+        bin.write(mat->double_sided);
+        bin.write(mat->type);
+        bin.write(mat->ke);
+        bin.write(mat->kd);
+        bin.write(mat->ks);
+        bin.write(mat->kr);
+        bin.write(mat->kt);
+        bin.write(mat->rs);
+        bin.write(mat->op);
+        for (auto txt : {mat->ke_txt, mat->kd_txt, mat->ks_txt, mat->kr_txt,
+                 mat->kt_txt, mat->rs_txt, mat->bump_txt, mat->disp_txt,
+                 mat->norm_txt, mat->occ_txt})
+            bin.write_ref(txt);
+        for (auto info : {mat->ke_txt_info, mat->kd_txt_info, mat->ks_txt_info,
+                 mat->kr_txt_info, mat->kt_txt_info, mat->rs_txt_info,
+                 mat->bump_txt_info, mat->disp_txt_info, mat->norm_txt_info,
+                 mat->occ_txt_info})
+            bin.write_info(info);
+    }
+    for (auto sgr : scn->shapes) {
+        bin.write(sgr->name);
+        bin.write(sgr->path);
+        bin.write((int)sgr->shapes.size());
+        for (auto shp : sgr->shapes) {
+            bin.write(shp->name);
+            bin.write_ref(shp->mat);
+            bin.write(shp->points);
+            bin.write(shp->lines);
+            bin.write(shp->triangles);
+            bin.write(shp->quads);
+            bin.write(shp->quads_pos);
+            bin.write(shp->quads_norm);
+            bin.write(shp->quads_texcoord);
+            bin.write(shp->beziers);
+            bin.write(shp->pos);
+            bin.write(shp->norm);
+            bin.write(shp->texcoord);
+            bin.write(shp->texcoord1);
+            bin.write(shp->color);
+            bin.write(shp->radius);
+            bin.write(shp->tangsp);
+            bin.write(shp->subdivision);
+            bin.write(shp->catmullclark);
+        }
+    }
+    for (auto ist : scn->instances) {
+        bin.write(ist->name);
+        bin.write(ist->frame);
+        bin.write_ref(ist->shp);
+    }
+    for (auto cam : scn->cameras) {
+        bin.write(cam->name);
+        bin.write(cam->frame);
+        bin.write(cam->ortho);
+        bin.write(cam->yfov);
+        bin.write(cam->aspect);
+        bin.write(cam->focus);
+        bin.write(cam->aperture);
+        bin.write(cam->near);
+        bin.write(cam->far);
+    }
+    for (auto env : scn->environments) {
+        bin.write(env->name);
+        bin.write(env->frame);
+        bin.write(env->ke);
+        bin.write_ref(env->ke_txt);
+        bin.write_info(env->ke_txt_info);
+    }
+    for (auto nde : scn->nodes) {
+        bin.write(nde->name);
+        bin.write_ref(nde->parent);
+        bin.write(nde->frame);
+        bin.write(nde->translation);
+        bin.write(nde->rotation);
+        bin.write(nde->scaling);
+        bin.write(nde->weights);
+        bin.write_ref(nde->cam);
+        bin.write_ref(nde->ist);
+        bin.write_ref(nde->env);
+    }
+    for (auto agr : scn->animations) {
+        bin.write(agr->name);
+        bin.write(agr->path);
+        bin.write((int)agr->animations.size());
+        for (auto anm : agr->animations) {
+            bin.write(anm->name);
+            bin.write(anm->type);
+            bin.write(anm->times);
+            bin.write(anm->translation);
+            bin.write(anm->rotation);
+            bin.write(anm->scaling);
+            bin.write((int)anm->weights.size());
+            for (auto& weights : anm->weights) bin.write(weights);
+        }
+        bin.add_ids(agr->animations);
+        bin.write((int)agr->targets.size());
+        for (auto& target : agr->targets) {
+            bin.write_ref(target.first);
+            bin.write_ref(target.second);
+        }
+    }
+    if (fclose(fs_guard.release()))
+        throw std::runtime_error("cannot write binary scene");
+}
+
+// Load a scene from the binary cache format
+scene* load_binary_scene(
+    const std::string& filename, const load_options& opts) {
+    auto view = file_view();
+    open_file_view(view, filename);
+    auto bin = binary_scene_reader();
+    bin.data = view.data;
+    bin.size = view.size;
+    bin.load_textures = opts.load_textures;
+
+    auto magic = (uint32_t)0, version = (uint32_t)0;
+    bin.read(magic);
+    if (magic != binary_scene_magic)
+        throw std::runtime_error("corrupted binary scene " + filename);
+    bin.read(version);
+    if (version != binary_scene_version)
+        throw std::runtime_error("unsupported binary scene version");
+
+    // allocate all elements first, so that references can be resolved
+    auto scn = std::unique_ptr<scene>(new scene());
+    auto make_elems = [&bin](auto& elems) {
+        auto num = 0;
+        bin.read(num);
+        // each element takes at least one byte in the file
+        if (num < 0 || (size_t)num > bin.size - bin.pos)
+            throw std::runtime_error("corrupted binary scene");
+        elems.resize(num);
+        for (auto& elem : elems)
+            elem = new typename std::remove_pointer<
+                typename std::decay<decltype(elem)>::type>::type();
+    };
+    make_elems(scn->textures);
+    make_elems(scn->materials);
+    make_elems(scn->shapes);
+    make_elems(scn->instances);
+    make_elems(scn->cameras);
+    make_elems(scn->environments);
+    make_elems(scn->nodes);
+    make_elems(scn->animations);
+
+    for (auto txt : scn->textures) {
+        bin.read(txt->name);
+        bin.read(txt->path);
+        bin.read(txt->ldr);
+        bin.read(txt->hdr);
+    }
+    for (auto mat : scn->materials) {
+        bin.read(mat->name);
+        bin.read(mat->double_sided);
+        bin.read(mat->type);
+        bin.read(mat->ke);
+        bin.read(mat->kd);
+        bin.read(mat->ks);
+        bin.read(mat->kr);
+        bin.read(mat->kt);
+        bin.read(mat->rs);
+        bin.read(mat->op);
+        for (auto txt : {&mat->ke_txt, &mat->kd_txt, &mat->ks_txt,
+                 &mat->kr_txt, &mat->kt_txt, &mat->rs_txt, &mat->bump_txt,
+                 &mat->disp_txt, &mat->norm_txt, &mat->occ_txt})
+            bin.read_ref(*txt, scn->textures);
+        for (auto info : {&mat->ke_txt_info, &mat->kd_txt_info,
+                 &mat->ks_txt_info, &mat->kr_txt_info, &mat->kt_txt_info,
+                 &mat->rs_txt_info, &mat->bump_txt_info, &mat->disp_txt_info,
+                 &mat->norm_txt_info, &mat->occ_txt_info})
+            bin.read_info(*info);
+    }
+    for (auto sgr : scn->shapes) {
+        bin.read(sgr->name);
+        bin.read(sgr->path);
+        make_elems(sgr->shapes);
+        for (auto shp : sgr->shapes) {
+            bin.read(shp->name);
+            bin.read_ref(shp->mat, scn->materials);
+            bin.read(shp->points);
+            bin.read(shp->lines);
+            bin.read(shp->triangles);
+            bin.read(shp->quads);
+            bin.read(shp->quads_pos);
+            bin.read(shp->quads_norm);
+            bin.read(shp->quads_texcoord);
+            bin.read(shp->beziers);
+            bin.read(shp->pos);
+            bin.read(shp->norm);
+            bin.read(shp->texcoord);
+            bin.read(shp->texcoord1);
+            bin.read(shp->color);
+            bin.read(shp->radius);
+            bin.read(shp->tangsp);
+            bin.read(shp->subdivision);
+            bin.read(shp->catmullclark);
+        }
+    }
+    for (auto ist : scn->instances) {
+        bin.read(ist->name);
+        bin.read(ist->frame);
+        bin.read_ref(ist->shp, scn->shapes);
+    }
+    for (auto cam : scn->cameras) {
+        bin.read(cam->name);
+        bin.read(cam->frame);
+        bin.read(cam->ortho);
+        bin.read(cam->yfov);
+        bin.read(cam->aspect);
+        bin.read(cam->focus);
+        bin.read(cam->aperture);
+        bin.read(cam->near);
+        bin.read(cam->far);
+    }
+    for (auto env : scn->environments) {
+        bin.read(env->name);
+        bin.read(env->frame);
+        bin.read(env->ke);
+        bin.read_ref(env->ke_txt, scn->textures);
+        bin.read_info(env->ke_txt_info);
+    }
+    for (auto nde : scn->nodes) {
+        bin.read(nde->name);
+        bin.read_ref(nde->parent, scn->nodes);
+        bin.read(nde->frame);
+        bin.read(nde->translation);
+        bin.read(nde->rotation);
+        bin.read(nde->scaling);
+        bin.read(nde->weights);
+        bin.read_ref(nde->cam, scn->cameras);
+        bin.read_ref(nde->ist, scn->instances);
+        bin.read_ref(nde->env, scn->environments);
+    }
+    for (auto agr : scn->animations) {
+        bin.read(agr->name);
+        bin.read(agr->path);
+        make_elems(agr->animations);
+        for (auto anm : agr->animations) {
+            bin.read(anm->name);
+            bin.read(anm->type);
+            bin.read(anm->times);
+            bin.read(anm->translation);
+            bin.read(anm->rotation);
+            bin.read(anm->scaling);
+            auto nweights = 0;
+            bin.read(nweights);
+            if (nweights < 0 || (size_t)nweights > bin.size - bin.pos)
+                throw std::runtime_error("corrupted binary scene");
+            anm->weights.resize(nweights);
+            for (auto& weights : anm->weights) bin.read(weights);
+        }
+        auto ntargets = 0;
+        bin.read(ntargets);
+        if (ntargets < 0 || (size_t)ntargets > bin.size - bin.pos)
+            throw std::runtime_error("corrupted binary scene");
+        agr->targets.resize(ntargets);
+        for (auto& target : agr->targets) {
+            bin.read_ref(target.first, agr->animations);
+            bin.read_ref(target.second, scn->nodes);
+        }
+    }
+    return scn.release();
+}
+
+// Load a scene
+scene* load_scene(const std::string& filename, const load_options& opts) {
+    auto ext = path_extension(filename);
+    if (ext == ".obj" || ext == ".OBJ") return load_obj_scene(filename, opts);
+    if (ext == ".ybin") return load_binary_scene(filename, opts);
+#if YGL_GLTF
+    if (ext == ".gltf" || ext == ".GLTF")
+        return load_gltf_scene(filename, opts);
+    if (ext == ".glb" || ext == ".GLB")
+        return load_binary_gltf_scene(filename, opts);
+#endif
+#if YGL_SVG
+    if (ext == ".svg" || ext == ".SVG") return load_svg_scene(filename, opts);
+#endif
+    throw std::runtime_error("unsupported extension " + ext);
+    return nullptr;
+}
+
+// Save a scene
+void save_scene(
+    const std::string& filename, const scene* scn, const save_options& opts) {
+    auto ext = path_extension(filename);
+    if (ext == ".obj" || ext == ".OBJ")
+        return save_obj_scene(filename, scn, opts);
+    if (ext == ".ybin") return save_binary_scene(filename, scn, opts);
+#if YGL_GLTF
+    if (ext == ".gltf" || ext == ".GLTF")
+        return save_gltf_scene(filename, scn, opts);
+    if (ext == ".glb" || ext == ".GLB")
+        return save_binary_gltf_scene(filename, scn, opts);
+#endif
+    throw std::runtime_error("unsupported extension " + ext);
+}
+
+}  // namespace ygl
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR PATH TRACING SUPPORT FUNCTION
+// -----------------------------------------------------------------------------
+namespace ygl {
+
+// Phong exponent to roughness. Public API, see above.
+float specular_exponent_to_roughness(float n) { return sqrtf(2 / (n + 2)); }
+
+// Specular to fresnel eta. Public API, see above.
 void specular_fresnel_from_ks(const vec3f& ks, vec3f& es, vec3f& esk) {
     es = {(1 + sqrt(ks.x)) / (1 - sqrt(ks.x)),
         (1 + sqrt(ks.y)) / (1 - sqrt(ks.y)),
@@ -5610,19 +6552,85 @@ vec3f sample_ggx(float rs, const vec2f& rn) {
 // -----------------------------------------------------------------------------
 namespace ygl {
 
+// Per-thread trace statistics, summed at the end of trace_samples().
+thread_local trace_stats trace_thread_stats;
+
+// Adds trace statistics, including the BVH counters of this thread.
+void add_trace_stats(trace_stats& stats, const trace_stats& tstats) {
+    stats.primary_rays += tstats.primary_rays;
+    stats.shadow_rays += tstats.shadow_rays;
+    stats.bounce_rays += tstats.bounce_rays;
+    stats.bvh_nodes += tstats.bvh_nodes;
+    stats.prim_tests += tstats.prim_tests;
+    stats.nan_samples += tstats.nan_samples;
+}
+
+// Starts counting trace statistics on this thread.
+void start_thread_stats() {
+    trace_thread_stats = trace_stats();
+    bvh_stats_nodes = 0;
+    bvh_stats_prims = 0;
+}
+
+// Adds the statistics of this thread to the total, if requested.
+void end_thread_stats(trace_stats* stats, std::mutex& stats_mutex) {
+    if (!stats) return;
+    trace_thread_stats.bvh_nodes = bvh_stats_nodes;
+    trace_thread_stats.prim_tests = bvh_stats_prims;
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    add_trace_stats(*stats, trace_thread_stats);
+}
+
+// Sampler state for a single pixel sample. It is derived from the seed, the
+// pixel coordinates and the sample index, so it is not stored per pixel.
+struct trace_sampler {
+    rng_pcg32 rng = rng_pcg32();  // random number state
+    int i = 0, j = 0;             // pixel coordinates
+    int sample = 0;               // sample index
+    int dimension = 0;            // current dimension
+    uint32_t seed = 0;            // render seed
+};
+
+// Initialize the sampler for a pixel sample.
+trace_sampler make_trace_sampler(
+    int i, int j, int sample, const trace_params& params) {
+    auto smp = trace_sampler();
+    smp.i = i;
+    smp.j = j;
+    smp.sample = sample;
+    smp.seed = params.seed;
+    smp.rng =
+        init_rng(hash_uint64((uint64_t)params.seed << 32 | (uint32_t)sample),
+            (uint64_t)j << 32 | (uint32_t)i);
+    return smp;
+}
+
+// Owen scrambling seed for the current dimension of a pixel. The seed and
+// the dimension are hashed separately from the pixel coordinates, so that
+// they do not collide for large images.
+uint32_t sobol_scramble(const trace_sampler& smp) {
+    auto h = hash_uint64(hash_uint64(smp.seed) ^ (uint64_t)smp.dimension);
+    return hash_uint64_32(h ^ ((uint64_t)smp.j << 32 | (uint32_t)smp.i));
+}
+
 // Generates a 1-dimensional sample.
-float sample_next1f(trace_pixel& pxl, trace_rng_type type, int nsamples) {
+float sample_next1f(trace_sampler& smp, trace_rng_type type, int nsamples) {
     switch (type) {
         case trace_rng_type::uniform: {
-            return clamp(next_rand1f(pxl.rng), 0.0f, 1 - flt_eps);
+            return clamp(next_rand1f(smp.rng), 0.0f, 1 - flt_eps);
         } break;
         case trace_rng_type::stratified: {
-            auto p = hash_uint64_32((uint64_t)pxl.i | (uint64_t)pxl.j << 16 |
-                                    (uint64_t)pxl.dimension << 32);
-            auto s = cmjs_permute(pxl.sample, nsamples, p);
-            pxl.dimension += 1;
+            auto p = hash_uint64_32((uint64_t)smp.i | (uint64_t)smp.j << 16 |
+                                    (uint64_t)smp.dimension << 32);
+            auto s = cmjs_permute(smp.sample, nsamples, p);
+            smp.dimension += 1;
             return clamp(
-                (s + next_rand1f(pxl.rng)) / nsamples, 0.0f, 1 - flt_eps);
+                (s + next_rand1f(smp.rng)) / nsamples, 0.0f, 1 - flt_eps);
+        } break;
+        case trace_rng_type::sobol: {
+            auto p = sobol_scramble(smp);
+            smp.dimension += 1;
+            return clamp(sobol_owen1f(smp.sample - 1, p), 0.0f, 1 - flt_eps);
         } break;
         default: {
             assert(false);
@@ -5632,22 +6640,29 @@ float sample_next1f(trace_pixel& pxl, trace_rng_type type, int nsamples) {
 }
 
 // Generates a 2-dimensional sample.
-vec2f sample_next2f(trace_pixel& pxl, trace_rng_type type, int nsamples) {
+vec2f sample_next2f(trace_sampler& smp, trace_rng_type type, int nsamples) {
     switch (type) {
         case trace_rng_type::uniform: {
-            return {next_rand1f(pxl.rng), next_rand1f(pxl.rng)};
+            return {next_rand1f(smp.rng), next_rand1f(smp.rng)};
         } break;
         case trace_rng_type::stratified: {
-            auto p = hash_uint64_32((uint64_t)pxl.i | (uint64_t)pxl.j << 16 |
-                                    (uint64_t)pxl.dimension << 32);
-            auto s = cmjs_permute(pxl.sample, nsamples, p);
+            auto p = hash_uint64_32((uint64_t)smp.i | (uint64_t)smp.j << 16 |
+                                    (uint64_t)smp.dimension << 32);
+            auto s = cmjs_permute(smp.sample, nsamples, p);
             auto nsamples2 = (int)round(sqrt(nsamples));
-            pxl.dimension += 2;
-            return {clamp((s % nsamples2 + next_rand1f(pxl.rng)) / nsamples2,
+            smp.dimension += 2;
+            return {clamp((s % nsamples2 + next_rand1f(smp.rng)) / nsamples2,
                         0.0f, 1 - flt_eps),
-                clamp((s / nsamples2 + next_rand1f(pxl.rng)) / nsamples2, 0.0f,
+                clamp((s / nsamples2 + next_rand1f(smp.rng)) / nsamples2, 0.0f,
                     1 - flt_eps)};
         } break;
+        case trace_rng_type::sobol: {
+            auto p = sobol_scramble(smp);
+            auto rn = sobol_owen2f(smp.sample - 1, p);
+            smp.dimension += 2;
+            return {clamp(rn.x, 0.0f, 1 - flt_eps),
+                clamp(rn.y, 0.0f, 1 - flt_eps)};
+        } break;
         default: {
             assert(false);
             return {0, 0};
@@ -5767,7 +6782,7 @@ vec3f eval_brdfcos(const trace_point& pt, const vec3f& wo, const vec3f& wi,
     if (!pt.has_brdf()) return zero3f;
     if (!pt.shp->triangles.empty())
         return eval_ggx_brdfcos(pt, wo, wi, delta);
-    else if (!pt.shp->lines.empty())
+    else if (!pt.shp->lines.empty() || !pt.shp->beziers.empty())
         return eval_kajiyakay_brdfcos(pt, wo, wi, delta);
     else if (!pt.shp->points.empty())
         return eval_point_brdfcos(pt, wo, wi, delta);
@@ -5833,7 +6848,7 @@ float weight_brdfcos(const trace_point& pt, const vec3f& wo, const vec3f& wi,
     if (!pt.has_brdf()) return 0;
     if (!pt.shp->triangles.empty())
         return weight_ggx_brdfcos(pt, wo, wi, delta);
-    else if (!pt.shp->lines.empty())
+    else if (!pt.shp->lines.empty() || !pt.shp->beziers.empty())
         return weight_kajiyakay_brdfcos(pt, wo, wi, delta);
     else if (!pt.shp->points.empty())
         return weight_point_brdfcos(pt, wo, wi, delta);
@@ -5920,7 +6935,7 @@ std::tuple<vec3f, bool> sample_brdfcos(
     if (!pt.has_brdf()) return {zero3f, false};
     if (!pt.shp->triangles.empty())
         return sample_ggx_brdfcos(pt, wo, rnl, rn);
-    else if (!pt.shp->lines.empty())
+    else if (!pt.shp->lines.empty() || !pt.shp->beziers.empty())
         return sample_kajiyakay_brdfcos(pt, wo, rnl, rn);
     else if (!pt.shp->points.empty())
         return sample_point_brdfcos(pt, wo, rnl, rn);
@@ -5947,48 +6962,86 @@ trace_point eval_point(const environment* env, const vec3f& wo) {
     return pt;
 }
 
-// Create a point for a shape. Resolves geometry and material with
-// textures.
-trace_point eval_point(
-    const instance* ist, int sid, int eid, const vec2f& euv, const vec3f& wo) {
-    // default material
-    static auto def_material = (material*)nullptr;
-    if (!def_material) {
-        def_material = new material();
-        def_material->kd = {0.2f, 0.2f, 0.2f};
-        def_material->rs = 1;
-    }
-
-    // point
-    auto pt = trace_point();
-    pt.shp = ist->shp->shapes.at(sid);
-    pt.pos = eval_pos(pt.shp, eid, euv);
-    pt.norm = eval_norm(pt.shp, eid, euv);
-    pt.texcoord = eval_texcoord(pt.shp, eid, euv);
-    // shortcuts
-    auto mat = (pt.shp->mat) ? pt.shp->mat : def_material;
+// Trace material flags.
+const uint32_t trace_material_ke_txt = 1 << 0;
+const uint32_t trace_material_kd_txt = 1 << 1;
+const uint32_t trace_material_ks_txt = 1 << 2;
+const uint32_t trace_material_kt_txt = 1 << 3;
+const uint32_t trace_material_norm_txt = 1 << 4;
+const uint32_t trace_material_occ_txt = 1 << 5;
+const uint32_t trace_material_textured = (1 << 6) - 1;
+const uint32_t trace_material_double_sided = 1 << 6;
 
-    // handle normal map
-    if (mat->norm_txt) {
-        auto tangsp = eval_tangsp(pt.shp, eid, euv);
-        auto txt = eval_texture(
-                       mat->norm_txt, mat->norm_txt_info, pt.texcoord, false) *
-                       2.0f -
-                   vec4f{1};
-        auto ntxt = normalize(vec3f{txt.x, -txt.y, txt.z});
-        auto frame = make_frame_fromzx(
-            {0, 0, 0}, pt.norm, {tangsp.x, tangsp.y, tangsp.z});
-        frame.y *= tangsp.w;
-        pt.norm = transform_direction(frame, ntxt);
+// Compiles a material into a shading record. Use a null material for the
+// default one.
+trace_material make_trace_material(const material* mat) {
+    auto tmat = trace_material();
+    if (!mat) {
+        tmat.kd = {0.2f, 0.2f, 0.2f};
+        tmat.rs = 1;
+    } else {
+        tmat.type = mat->type;
+        tmat.ke = mat->ke;
+        tmat.kd = mat->kd;
+        tmat.ks = mat->ks;
+        tmat.kt = mat->kt;
+        tmat.rs = mat->rs;
+        if (mat->double_sided) tmat.flags |= trace_material_double_sided;
+        auto set_texture = [&tmat](const texture*& txt, texture_info& info,
+                               const texture* mtxt, const texture_info* minfo,
+                               uint32_t flag) {
+            if (!mtxt) return;
+            txt = mtxt;
+            info = (minfo) ? *minfo : texture_info();
+            tmat.flags |= flag;
+        };
+        set_texture(tmat.ke_txt, tmat.ke_txt_info, mat->ke_txt,
+            mat->ke_txt_info, trace_material_ke_txt);
+        set_texture(tmat.kd_txt, tmat.kd_txt_info, mat->kd_txt,
+            mat->kd_txt_info, trace_material_kd_txt);
+        set_texture(tmat.ks_txt, tmat.ks_txt_info, mat->ks_txt,
+            mat->ks_txt_info, trace_material_ks_txt);
+        set_texture(tmat.kt_txt, tmat.kt_txt_info, mat->kt_txt,
+            mat->kt_txt_info, trace_material_kt_txt);
+        set_texture(tmat.norm_txt, tmat.norm_txt_info, mat->norm_txt,
+            mat->norm_txt_info, trace_material_norm_txt);
+        set_texture(tmat.occ_txt, tmat.occ_txt_info, mat->occ_txt,
+            mat->occ_txt_info, trace_material_occ_txt);
+    }
+
+    // shading values for untextured points without vertex colors
+    switch (tmat.type) {
+        case material_type::specular_roughness: {
+            tmat.shade_kd = tmat.kd;
+            tmat.shade_ks = tmat.ks;
+            tmat.shade_rs = tmat.rs;
+            tmat.shade_kt = tmat.kt;
+        } break;
+        case material_type::metallic_roughness: {
+            auto km = tmat.ks.x;
+            tmat.shade_kd = tmat.kd * (1 - km);
+            tmat.shade_ks = tmat.kd * km + vec3f{0.04f} * (1 - km);
+            tmat.shade_rs = tmat.rs;
+        } break;
+        case material_type::specular_glossiness: {
+            tmat.shade_kd = tmat.kd;
+            tmat.shade_ks = tmat.ks;
+            tmat.shade_rs = 1 - tmat.rs;
+            tmat.shade_kt = tmat.kt;
+        } break;
     }
+    if (tmat.shade_ks != zero3f && tmat.shade_rs < 0.9999f) {
+        tmat.shade_rs = tmat.shade_rs * tmat.shade_rs;
+    } else {
+        tmat.shade_ks = zero3f;
+        tmat.shade_rs = 0;
+    }
+    return tmat;
+}
 
-    // move to world coordinates
-    pt.pos = transform_point(ist->frame, pt.pos);
-    pt.norm = transform_direction(ist->frame, pt.norm);
-
-    // correct for double sided
-    if (mat->double_sided && dot(pt.norm, wo) < 0) pt.norm = -pt.norm;
-
+// Evaluates the material of a textured or vertex colored point.
+void eval_material(trace_point& pt, const trace_material& mat, int eid,
+    const vec2f& euv) {
     // initialized material values
     auto kx = vec3f{1, 1, 1};
     pt.op = 1;
@@ -5999,55 +7052,55 @@ trace_point eval_point(
     }
 
     // handle occlusion
-    if (mat->occ_txt) {
-        auto txt = eval_texture(mat->occ_txt, mat->occ_txt_info, pt.texcoord);
+    if (mat.flags & trace_material_occ_txt) {
+        auto txt = eval_texture(mat.occ_txt, mat.occ_txt_info, pt.texcoord);
         kx *= {txt.x, txt.y, txt.z};
     }
 
     // sample emission
-    pt.ke = mat->ke * kx;
-    if (mat->ke_txt) {
-        auto txt = eval_texture(mat->ke_txt, mat->ke_txt_info, pt.texcoord);
+    pt.ke = mat.ke * kx;
+    if (mat.flags & trace_material_ke_txt) {
+        auto txt = eval_texture(mat.ke_txt, mat.ke_txt_info, pt.texcoord);
         pt.ke *= {txt.x, txt.y, txt.z};
     }
 
     // sample reflectance
-    switch (mat->type) {
+    switch (mat.type) {
         case material_type::specular_roughness: {
-            pt.kd = mat->kd * kx;
-            if (mat->kd_txt) {
+            pt.kd = mat.kd * kx;
+            if (mat.flags & trace_material_kd_txt) {
                 auto txt =
-                    eval_texture(mat->kd_txt, mat->kd_txt_info, pt.texcoord);
+                    eval_texture(mat.kd_txt, mat.kd_txt_info, pt.texcoord);
                 pt.kd *= {txt.x, txt.y, txt.z};
                 pt.op *= txt.w;
             }
-            pt.ks = mat->ks * kx;
-            pt.rs = mat->rs;
-            if (mat->ks_txt) {
+            pt.ks = mat.ks * kx;
+            pt.rs = mat.rs;
+            if (mat.flags & trace_material_ks_txt) {
                 auto txt =
-                    eval_texture(mat->ks_txt, mat->ks_txt_info, pt.texcoord);
+                    eval_texture(mat.ks_txt, mat.ks_txt_info, pt.texcoord);
                 pt.ks *= {txt.x, txt.y, txt.z};
             }
-            pt.kt = mat->kt * kx;
-            if (mat->kt_txt) {
+            pt.kt = mat.kt * kx;
+            if (mat.flags & trace_material_kt_txt) {
                 auto txt =
-                    eval_texture(mat->kt_txt, mat->kt_txt_info, pt.texcoord);
+                    eval_texture(mat.kt_txt, mat.kt_txt_info, pt.texcoord);
                 pt.kt *= {txt.x, txt.y, txt.z};
             }
         } break;
         case material_type::metallic_roughness: {
-            auto kb = mat->kd * kx;
-            if (mat->kd_txt) {
+            auto kb = mat.kd * kx;
+            if (mat.flags & trace_material_kd_txt) {
                 auto txt =
-                    eval_texture(mat->kd_txt, mat->kd_txt_info, pt.texcoord);
+                    eval_texture(mat.kd_txt, mat.kd_txt_info, pt.texcoord);
                 kb *= {txt.x, txt.y, txt.z};
                 pt.op *= txt.w;
             }
-            auto km = mat->ks.x;
-            pt.rs = mat->rs;
-            if (mat->ks_txt) {
+            auto km = mat.ks.x;
+            pt.rs = mat.rs;
+            if (mat.flags & trace_material_ks_txt) {
                 auto txt =
-                    eval_texture(mat->ks_txt, mat->ks_txt_info, pt.texcoord);
+                    eval_texture(mat.ks_txt, mat.ks_txt_info, pt.texcoord);
                 km *= txt.y;
                 pt.rs *= txt.z;
             }
@@ -6055,26 +7108,26 @@ trace_point eval_point(
             pt.ks = kb * km + vec3f{0.04f} * (1 - km);
         } break;
         case material_type::specular_glossiness: {
-            pt.kd = mat->kd * kx;
-            if (mat->kd_txt) {
+            pt.kd = mat.kd * kx;
+            if (mat.flags & trace_material_kd_txt) {
                 auto txt =
-                    eval_texture(mat->kd_txt, mat->kd_txt_info, pt.texcoord);
+                    eval_texture(mat.kd_txt, mat.kd_txt_info, pt.texcoord);
                 pt.kd *= {txt.x, txt.y, txt.z};
                 pt.op *= txt.w;
             }
-            pt.ks = mat->ks * kx;
-            pt.rs = mat->rs;
-            if (mat->ks_txt) {
+            pt.ks = mat.ks * kx;
+            pt.rs = mat.rs;
+            if (mat.flags & trace_material_ks_txt) {
                 auto txt =
-                    eval_texture(mat->ks_txt, mat->ks_txt_info, pt.texcoord);
+                    eval_texture(mat.ks_txt, mat.ks_txt_info, pt.texcoord);
                 pt.ks *= {txt.x, txt.y, txt.z};
                 pt.rs *= txt.w;
             }
             pt.rs = 1 - pt.rs;  // glossiness -> roughnes
-            pt.kt = mat->kt * kx;
-            if (mat->kt_txt) {
+            pt.kt = mat.kt * kx;
+            if (mat.flags & trace_material_kt_txt) {
                 auto txt =
-                    eval_texture(mat->kt_txt, mat->kt_txt_info, pt.texcoord);
+                    eval_texture(mat.kt_txt, mat.kt_txt_info, pt.texcoord);
                 pt.kt *= {txt.x, txt.y, txt.z};
             }
         } break;
@@ -6091,6 +7144,51 @@ trace_point eval_point(
         pt.rs = 0;
     }
     if (pt.kt == zero3f) pt.kt = vec3f{1 - pt.op};
+}
+
+// Create a point for a shape. Resolves geometry and material with
+// textures.
+trace_point eval_point(const instance* ist, int sid, int eid,
+    const vec2f& euv, const vec3f& wo, const trace_material& mat) {
+    // point
+    auto pt = trace_point();
+    pt.shp = ist->shp->shapes.at(sid);
+    pt.pos = eval_pos(pt.shp, eid, euv);
+    pt.norm = eval_norm(pt.shp, eid, euv);
+    pt.texcoord = eval_texcoord(pt.shp, eid, euv);
+
+    // handle normal map
+    if (mat.flags & trace_material_norm_txt) {
+        auto tangsp = eval_tangsp(pt.shp, eid, euv);
+        auto txt = eval_texture(
+                       mat.norm_txt, mat.norm_txt_info, pt.texcoord, false) *
+                       2.0f -
+                   vec4f{1};
+        auto ntxt = normalize(vec3f{txt.x, -txt.y, txt.z});
+        auto frame = make_frame_fromzx(
+            {0, 0, 0}, pt.norm, {tangsp.x, tangsp.y, tangsp.z});
+        frame.y *= tangsp.w;
+        pt.norm = transform_direction(frame, ntxt);
+    }
+
+    // move to world coordinates
+    pt.pos = transform_point(ist->frame, pt.pos);
+    pt.norm = transform_direction(ist->frame, pt.norm);
+
+    // correct for double sided
+    if ((mat.flags & trace_material_double_sided) && dot(pt.norm, wo) < 0)
+        pt.norm = -pt.norm;
+
+    // material values, precomputed if constant over the shape
+    if ((mat.flags & trace_material_textured) || !pt.shp->color.empty()) {
+        eval_material(pt, mat, eid, euv);
+    } else {
+        pt.ke = mat.ke;
+        pt.kd = mat.shade_kd;
+        pt.ks = mat.shade_ks;
+        pt.rs = mat.shade_rs;
+        pt.kt = mat.shade_kt;
+    }
 
     // done
     return pt;
@@ -6137,7 +7235,8 @@ trace_point sample_light(const trace_lights& lights, const trace_light& lgt,
         } else if (!shp->lines.empty()) {
             eid = sample_points(cdf, rel);
         }
-        return eval_point(lgt.ist, 0, eid, euv, zero3f);
+        return eval_point(
+            lgt.ist, 0, eid, euv, zero3f, lights.materials.at(lgt.mat));
     }
     if (lgt.env) {
         auto z = -1 + 2 * ruv.y;
@@ -6158,14 +7257,16 @@ trace_point sample_lights(const trace_lights& lights, const trace_point& pt,
 }
 
 // Intersects a ray with the scn and return the point (or env
-// point).
-trace_point intersect_scene(
-    const scene* scn, const bvh_tree* bvh, const ray3f& ray) {
-    auto iid = 0, sid = 0, eid = 0;
+// point), together with the instance and shape ids and the ray distance.
+trace_point intersect_scene(const scene* scn, const bvh_tree* bvh,
+    const trace_lights& lights, const ray3f& ray, int& iid, int& sid,
+    float& ray_t) {
+    auto eid = 0;
     auto euv = zero2f;
-    auto ray_t = 0.0f;
     if (intersect_bvh(bvh, ray, false, ray_t, iid, sid, eid, euv)) {
-        return eval_point(scn->instances[iid], sid, eid, euv, -ray.d);
+        auto mid = lights.shape_materials[lights.instance_offsets[iid] + sid];
+        return eval_point(scn->instances[iid], sid, eid, euv, -ray.d,
+            lights.materials[mid]);
     } else if (!scn->environments.empty()) {
         return eval_point(scn->environments[0], -ray.d);
     } else {
@@ -6173,18 +7274,30 @@ trace_point intersect_scene(
     }
 }
 
+// Intersects a ray with the scn and return the point (or env
+// point).
+trace_point intersect_scene(const scene* scn, const bvh_tree* bvh,
+    const trace_lights& lights, const ray3f& ray) {
+    auto iid = 0, sid = 0;
+    auto ray_t = 0.0f;
+    return intersect_scene(scn, bvh, lights, ray, iid, sid, ray_t);
+}
+
 // Test occlusion
 vec3f eval_transmission(const scene* scn, const bvh_tree* bvh,
-    const trace_point& pt, const trace_point& lpt, const trace_params& params) {
+    const trace_lights& lights, const trace_point& pt, const trace_point& lpt,
+    const trace_params& params) {
     if (params.notransmission) {
         auto ray = make_segment(pt.pos, lpt.pos);
+        trace_thread_stats.shadow_rays += 1;
         return (intersect_bvh(bvh, ray, true)) ? zero3f : vec3f{1, 1, 1};
     } else {
         auto cpt = pt;
         auto weight = vec3f{1, 1, 1};
         for (auto bounce = 0; bounce < params.max_depth; bounce++) {
             auto ray = make_segment(cpt.pos, lpt.pos);
-            cpt = intersect_scene(scn, bvh, ray);
+            trace_thread_stats.shadow_rays += 1;
+            cpt = intersect_scene(scn, bvh, lights, ray);
             if (!cpt.shp) break;
             weight *= cpt.kt;
             if (weight == zero3f) break;
@@ -6202,7 +7315,7 @@ float weight_mis(float w0, float w1) {
 // Recursive path tracing.
 vec3f trace_path(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt_, const vec3f& wo_,
-    trace_pixel& pxl, const trace_params& params) {
+    trace_sampler& smp, const trace_params& params) {
     auto pt = pt_;
     auto wo = wo_;
 
@@ -6218,9 +7331,9 @@ vec3f trace_path(const scene* scn, const bvh_tree* bvh,
         if (emission) l += weight * eval_emission(pt, wo);
 
         // direct – light
-        auto rll = sample_next1f(pxl, params.rng, params.nsamples);
-        auto rle = sample_next1f(pxl, params.rng, params.nsamples);
-        auto rluv = sample_next2f(pxl, params.rng, params.nsamples);
+        auto rll = sample_next1f(smp, params.rng, params.nsamples);
+        auto rle = sample_next1f(smp, params.rng, params.nsamples);
+        auto rluv = sample_next2f(smp, params.rng, params.nsamples);
         auto& lgt = lights.lights[(int)(rll * lights.lights.size())];
         auto lpt = sample_light(lights, lgt, pt, rle, rluv);
         auto lw = weight_light(lights, lpt, pt) * (float)lights.size();
@@ -6229,17 +7342,19 @@ vec3f trace_path(const scene* scn, const bvh_tree* bvh,
         auto lbc = eval_brdfcos(pt, wo, lwi);
         auto lld = lke * lbc * lw;
         if (lld != zero3f) {
-            l += weight * lld * eval_transmission(scn, bvh, pt, lpt, params) *
+            l += weight * lld *
+                 eval_transmission(scn, bvh, lights, pt, lpt, params) *
                  weight_mis(lw, weight_brdfcos(pt, wo, lwi));
         }
 
         // direct – brdf
-        auto rbl = sample_next1f(pxl, params.rng, params.nsamples);
-        auto rbuv = sample_next2f(pxl, params.rng, params.nsamples);
+        auto rbl = sample_next1f(smp, params.rng, params.nsamples);
+        auto rbuv = sample_next2f(smp, params.rng, params.nsamples);
         auto bwi = zero3f;
         auto bdelta = false;
         std::tie(bwi, bdelta) = sample_brdfcos(pt, wo, rbl, rbuv);
-        auto bpt = intersect_scene(scn, bvh, make_ray(pt.pos, bwi));
+        trace_thread_stats.bounce_rays += 1;
+        auto bpt = intersect_scene(scn, bvh, lights, make_ray(pt.pos, bwi));
         auto bw = weight_brdfcos(pt, wo, bwi, bdelta);
         auto bke = eval_emission(bpt, -bwi);
         auto bbc = eval_brdfcos(pt, wo, bwi, bdelta);
@@ -6259,7 +7374,7 @@ vec3f trace_path(const scene* scn, const bvh_tree* bvh,
         // roussian roulette
         if (bounce > 2) {
             auto rrprob = 1.0f - min(max_element_value(pt.rho()), 0.95f);
-            if (sample_next1f(pxl, params.rng, params.nsamples) < rrprob) break;
+            if (sample_next1f(smp, params.rng, params.nsamples) < rrprob) break;
             weight *= 1 / (1 - rrprob);
         }
 
@@ -6275,7 +7390,7 @@ vec3f trace_path(const scene* scn, const bvh_tree* bvh,
 // Recursive path tracing.
 vec3f trace_path_nomis(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt_, const vec3f& wo_,
-    trace_pixel& pxl, const trace_params& params) {
+    trace_sampler& smp, const trace_params& params) {
     // emission
     auto pt = pt_;
     auto wo = wo_;
@@ -6291,16 +7406,17 @@ vec3f trace_path_nomis(const scene* scn, const bvh_tree* bvh,
         if (emission) l += weight * eval_emission(pt, wo);
 
         // direct
-        auto rll = sample_next1f(pxl, params.rng, params.nsamples);
-        auto rle = sample_next1f(pxl, params.rng, params.nsamples);
-        auto rluv = sample_next2f(pxl, params.rng, params.nsamples);
+        auto rll = sample_next1f(smp, params.rng, params.nsamples);
+        auto rle = sample_next1f(smp, params.rng, params.nsamples);
+        auto rluv = sample_next2f(smp, params.rng, params.nsamples);
         auto& lgt = lights.lights[(int)(rll * lights.lights.size())];
         auto lpt = sample_light(lights, lgt, pt, rle, rluv);
         auto lwi = normalize(lpt.pos - pt.pos);
         auto ld = eval_emission(lpt, -lwi) * eval_brdfcos(pt, wo, lwi) *
                   weight_light(lights, lpt, pt) * (float)lights.size();
         if (ld != zero3f) {
-            l += weight * ld * eval_transmission(scn, bvh, pt, lpt, params);
+            l += weight * ld *
+                 eval_transmission(scn, bvh, lights, pt, lpt, params);
         }
 
         // skip recursion if path ends
@@ -6309,13 +7425,13 @@ vec3f trace_path_nomis(const scene* scn, const bvh_tree* bvh,
         // roussian roulette
         if (bounce > 2) {
             auto rrprob = 1.0f - min(max_element_value(pt.rho()), 0.95f);
-            if (sample_next1f(pxl, params.rng, params.nsamples) < rrprob) break;
+            if (sample_next1f(smp, params.rng, params.nsamples) < rrprob) break;
             weight *= 1 / (1 - rrprob);
         }
 
         // continue path
-        auto rbl = sample_next1f(pxl, params.rng, params.nsamples);
-        auto rbuv = sample_next2f(pxl, params.rng, params.nsamples);
+        auto rbl = sample_next1f(smp, params.rng, params.nsamples);
+        auto rbuv = sample_next2f(smp, params.rng, params.nsamples);
         auto bwi = zero3f;
         auto bdelta = false;
         std::tie(bwi, bdelta) = sample_brdfcos(pt, wo, rbl, rbuv);
@@ -6323,7 +7439,8 @@ vec3f trace_path_nomis(const scene* scn, const bvh_tree* bvh,
                   weight_brdfcos(pt, wo, bwi, bdelta);
         if (weight == zero3f) break;
 
-        auto bpt = intersect_scene(scn, bvh, make_ray(pt.pos, bwi));
+        trace_thread_stats.bounce_rays += 1;
+        auto bpt = intersect_scene(scn, bvh, lights, make_ray(pt.pos, bwi));
         emission = false;
         if (!bpt.has_brdf()) break;
 
@@ -6338,7 +7455,7 @@ vec3f trace_path_nomis(const scene* scn, const bvh_tree* bvh,
 // Recursive path tracing.
 vec3f trace_path_hack(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt_, const vec3f& wo_,
-    trace_pixel& pxl, const trace_params& params) {
+    trace_sampler& smp, const trace_params& params) {
     auto pt = pt_;
     auto wo = wo_;
 
@@ -6350,16 +7467,17 @@ vec3f trace_path_hack(const scene* scn, const bvh_tree* bvh,
     auto weight = vec3f{1, 1, 1};
     for (auto bounce = 0; bounce < params.max_depth; bounce++) {
         // direct
-        auto rll = sample_next1f(pxl, params.rng, params.nsamples);
-        auto rle = sample_next1f(pxl, params.rng, params.nsamples);
-        auto rluv = sample_next2f(pxl, params.rng, params.nsamples);
+        auto rll = sample_next1f(smp, params.rng, params.nsamples);
+        auto rle = sample_next1f(smp, params.rng, params.nsamples);
+        auto rluv = sample_next2f(smp, params.rng, params.nsamples);
         auto& lgt = lights.lights[(int)(rll * lights.lights.size())];
         auto lpt = sample_light(lights, lgt, pt, rle, rluv);
         auto lwi = normalize(lpt.pos - pt.pos);
         auto ld = eval_emission(lpt, -lwi) * eval_brdfcos(pt, wo, -lwi) *
                   weight_light(lights, lpt, pt) * (float)lights.size();
         if (ld != zero3f) {
-            l += weight * ld * eval_transmission(scn, bvh, pt, lpt, params);
+            l += weight * ld *
+                 eval_transmission(scn, bvh, lights, pt, lpt, params);
         }
 
         // skip recursion if path ends
@@ -6368,7 +7486,7 @@ vec3f trace_path_hack(const scene* scn, const bvh_tree* bvh,
         // roussian roulette
         if (bounce > 2) {
             auto rrprob = 1.0f - min(max_element_value(pt.rho()), 0.95f);
-            if (sample_next1f(pxl, params.rng, params.nsamples) < rrprob) break;
+            if (sample_next1f(smp, params.rng, params.nsamples) < rrprob) break;
             weight *= 1 / (1 - rrprob);
         }
 
@@ -6376,13 +7494,14 @@ vec3f trace_path_hack(const scene* scn, const bvh_tree* bvh,
         auto bwi = zero3f;
         auto bdelta = false;
         std::tie(bwi, bdelta) = sample_brdfcos(pt, wo,
-            sample_next1f(pxl, params.rng, params.nsamples),
-            sample_next2f(pxl, params.rng, params.nsamples));
+            sample_next1f(smp, params.rng, params.nsamples),
+            sample_next2f(smp, params.rng, params.nsamples));
         weight *= eval_brdfcos(pt, wo, bwi, bdelta) *
                   weight_brdfcos(pt, wo, bwi, bdelta);
         if (weight == zero3f) break;
 
-        auto bpt = intersect_scene(scn, bvh, make_ray(pt.pos, bwi));
+        trace_thread_stats.bounce_rays += 1;
+        auto bpt = intersect_scene(scn, bvh, lights, make_ray(pt.pos, bwi));
         if (!bpt.has_brdf()) break;
 
         // continue path
@@ -6396,7 +7515,7 @@ vec3f trace_path_hack(const scene* scn, const bvh_tree* bvh,
 // Direct illumination.
 vec3f trace_direct(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt, const vec3f& wo,
-    int bounce, trace_pixel& pxl, const trace_params& params) {
+    int bounce, trace_sampler& smp, const trace_params& params) {
     // emission
     auto l = eval_emission(pt, wo);
     if (!pt.has_brdf()) return l;
@@ -6406,14 +7525,14 @@ vec3f trace_direct(const scene* scn, const bvh_tree* bvh,
 
     // direct
     for (auto& lgt : lights.lights) {
-        auto rle = sample_next1f(pxl, params.rng, params.nsamples);
-        auto rluv = sample_next2f(pxl, params.rng, params.nsamples);
+        auto rle = sample_next1f(smp, params.rng, params.nsamples);
+        auto rluv = sample_next2f(smp, params.rng, params.nsamples);
         auto lpt = sample_light(lights, lgt, pt, rle, rluv);
         auto lwi = normalize(lpt.pos - pt.pos);
         auto ld = eval_emission(lpt, -lwi) * eval_brdfcos(pt, wo, lwi) *
                   weight_light(lights, lpt, pt);
         if (ld == zero3f) continue;
-        l += ld * eval_transmission(scn, bvh, pt, lpt, params);
+        l += ld * eval_transmission(scn, bvh, lights, pt, lpt, params);
     }
 
     // exit if needed
@@ -6422,16 +7541,18 @@ vec3f trace_direct(const scene* scn, const bvh_tree* bvh,
     // reflection
     if (pt.ks != zero3f && !pt.rs) {
         auto wi = reflect(wo, pt.norm);
-        auto rpt = intersect_scene(scn, bvh, make_ray(pt.pos, wi));
+        trace_thread_stats.bounce_rays += 1;
+        auto rpt = intersect_scene(scn, bvh, lights, make_ray(pt.pos, wi));
         l += pt.ks *
-             trace_direct(scn, bvh, lights, rpt, -wi, bounce + 1, pxl, params);
+             trace_direct(scn, bvh, lights, rpt, -wi, bounce + 1, smp, params);
     }
 
     // opacity
     if (pt.kt != zero3f) {
-        auto opt = intersect_scene(scn, bvh, make_ray(pt.pos, -wo));
+        trace_thread_stats.bounce_rays += 1;
+        auto opt = intersect_scene(scn, bvh, lights, make_ray(pt.pos, -wo));
         l += pt.kt *
-             trace_direct(scn, bvh, lights, opt, wo, bounce + 1, pxl, params);
+             trace_direct(scn, bvh, lights, opt, wo, bounce + 1, smp, params);
     }
 
     // done
@@ -6441,14 +7562,14 @@ vec3f trace_direct(const scene* scn, const bvh_tree* bvh,
 // Direct illumination.
 vec3f trace_direct(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt, const vec3f& wo,
-    trace_pixel& pxl, const trace_params& params) {
-    return trace_direct(scn, bvh, lights, pt, wo, 0, pxl, params);
+    trace_sampler& smp, const trace_params& params) {
+    return trace_direct(scn, bvh, lights, pt, wo, 0, smp, params);
 }
 
 // Eyelight for quick previewing.
 vec3f trace_eyelight(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt, const vec3f& wo,
-    int bounce, trace_pixel& pxl, const trace_params& params) {
+    int bounce, trace_sampler& smp, const trace_params& params) {
     // emission
     auto l = eval_emission(pt, wo);
     if (!pt.has_brdf()) return l;
@@ -6459,9 +7580,10 @@ vec3f trace_eyelight(const scene* scn, const bvh_tree* bvh,
     // opacity
     if (bounce >= params.max_depth) return l;
     if (pt.kt != zero3f) {
-        auto opt = intersect_scene(scn, bvh, make_ray(pt.pos, -wo));
+        trace_thread_stats.bounce_rays += 1;
+        auto opt = intersect_scene(scn, bvh, lights, make_ray(pt.pos, -wo));
         l += pt.kt *
-             trace_eyelight(scn, bvh, lights, opt, wo, bounce + 1, pxl, params);
+             trace_eyelight(scn, bvh, lights, opt, wo, bounce + 1, smp, params);
     }
 
     // done
@@ -6471,35 +7593,35 @@ vec3f trace_eyelight(const scene* scn, const bvh_tree* bvh,
 // Eyelight for quick previewing.
 vec3f trace_eyelight(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt, const vec3f& wo,
-    trace_pixel& pxl, const trace_params& params) {
-    return trace_eyelight(scn, bvh, lights, pt, wo, 0, pxl, params);
+    trace_sampler& smp, const trace_params& params) {
+    return trace_eyelight(scn, bvh, lights, pt, wo, 0, smp, params);
 }
 
 // Debug previewing.
 vec3f trace_debug_normal(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt, const vec3f& wo,
-    trace_pixel& pxl, const trace_params& params) {
+    trace_sampler& smp, const trace_params& params) {
     return pt.norm * 0.5f + vec3f{0.5f, 0.5f, 0.5f};
 }
 
 // Debug previewing.
 vec3f trace_debug_albedo(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt, const vec3f& wo,
-    trace_pixel& pxl, const trace_params& params) {
+    trace_sampler& smp, const trace_params& params) {
     return pt.rho();
 }
 
 // Debug previewing.
 vec3f trace_debug_texcoord(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt, const vec3f& wo,
-    trace_pixel& pxl, const trace_params& params) {
+    trace_sampler& smp, const trace_params& params) {
     return {pt.texcoord.x, pt.texcoord.y, 0};
 }
 
 // Trace shader function
 using trace_shader = vec3f (*)(const scene* scn, const bvh_tree* bvh,
     const trace_lights& lights, const trace_point& pt, const vec3f& wo,
-    trace_pixel& pxl, const trace_params& params);
+    trace_sampler& smp, const trace_params& params);
 
 // Trace filter function
 using trace_filter = float (*)(float);
@@ -6533,151 +7655,302 @@ static auto trace_filter_sizes = std::unordered_map<trace_filter_type, int>{
     {trace_filter_type::mitchell, 2},
 };
 
+// Accumulates the first-hit output variables of a sample.
+void accumulate_aovs(trace_aovs* aovs, const trace_sampler& smp,
+    const trace_point& pt, int iid, int sid, float ray_t) {
+    auto n = (float)smp.sample;
+    auto hit = (pt.shp) ? 1.0f : 0.0f;
+    auto rho = (pt.shp) ? pt.rho() : zero3f;
+    auto norm = (pt.shp) ? pt.norm : zero3f;
+    auto depth = (pt.shp) ? ray_t : 0.0f;
+    auto& albedo = aovs->albedo.at(smp.i, smp.j);
+    albedo += (vec4f{rho.x, rho.y, rho.z, hit} - albedo) / n;
+    auto& normal = aovs->normal.at(smp.i, smp.j);
+    normal += (vec4f{norm.x, norm.y, norm.z, hit} - normal) / n;
+    auto& dist = aovs->depth.at(smp.i, smp.j);
+    dist += (vec4f{depth, depth, depth, hit} - dist) / n;
+    if (smp.sample == 1 && pt.shp) {
+        auto mid = -1;
+        auto mit = aovs->material_ids.find(pt.shp->mat);
+        if (mit != aovs->material_ids.end()) mid = mit->second;
+        aovs->id.at(smp.i, smp.j) = {(float)iid, (float)sid, (float)mid, 1};
+    }
+}
+
 // Trace a single sample
 void trace_sample(const scene* scn, const camera* cam, const bvh_tree* bvh,
-    const trace_lights& lights, trace_pixel& pxl, trace_shader shader,
-    const trace_params& params) {
+    const trace_lights& lights, trace_pixel& pxl, int i, int j,
+    trace_shader shader, const trace_params& params,
+    trace_aovs* aovs = nullptr) {
     pxl.sample += 1;
-    pxl.dimension = 0;
-    auto crn = sample_next2f(pxl, params.rng, params.nsamples);
-    auto lrn = sample_next2f(pxl, params.rng, params.nsamples);
-    auto uv = vec2f{(pxl.i + crn.x) / (cam->aspect * params.resolution),
-        1 - (pxl.j + crn.y) / params.resolution};
+    auto smp = make_trace_sampler(i, j, pxl.sample, params);
+    auto crn = sample_next2f(smp, params.rng, params.nsamples);
+    auto lrn = sample_next2f(smp, params.rng, params.nsamples);
+    auto uv = vec2f{(i + crn.x) / (cam->aspect * params.resolution),
+        1 - (j + crn.y) / params.resolution};
     auto ray = eval_camera_ray(cam, uv, lrn);
-    auto pt = intersect_scene(scn, bvh, ray);
+    trace_thread_stats.primary_rays += 1;
+    auto iid = 0, sid = 0;
+    auto ray_t = 0.0f;
+    auto pt = intersect_scene(scn, bvh, lights, ray, iid, sid, ray_t);
+    if (aovs) accumulate_aovs(aovs, smp, pt, iid, sid, ray_t);
     if (!pt.shp && params.envmap_invisible) return;
-    auto l = shader(scn, bvh, lights, pt, -ray.d, pxl, params);
+    auto l = shader(scn, bvh, lights, pt, -ray.d, smp, params);
     if (!isfinite(l.x) || !isfinite(l.y) || !isfinite(l.z)) {
         log_error("NaN detected");
+        trace_thread_stats.nan_samples += 1;
         return;
     }
     if (params.pixel_clamp > 0) l = clamplen(l, params.pixel_clamp);
     pxl.col += l;
     pxl.alpha += 1;
+    if (aovs) aovs->col2.at(i, j) += l * l;
+}
+
+// Updates the radiance variance of a pixel.
+void update_aovs_variance(
+    trace_aovs* aovs, const trace_pixel& pxl, int i, int j) {
+    auto n = (float)pxl.sample;
+    auto mean = pxl.col / n;
+    auto var = aovs->col2.at(i, j) / n - mean * mean;
+    aovs->variance.at(i, j) = {
+        max(var.x, 0.0f), max(var.y, 0.0f), max(var.z, 0.0f), n};
+}
+
+// Crop window of an image as min and max pixel coordinates, covering the
+// whole image if the window is empty.
+vec4i eval_trace_crop(const image4f& img, const trace_params& params) {
+    auto& crop = params.crop;
+    if (crop.z <= crop.x || crop.w <= crop.y)
+        return {0, 0, img.width(), img.height()};
+    return {clamp(crop.x, 0, img.width()), clamp(crop.y, 0, img.height()),
+        clamp(crop.z, 0, img.width()), clamp(crop.w, 0, img.height())};
 }
 
 // Trace the next nsamples.
 void trace_samples(const scene* scn, const camera* cam, const bvh_tree* bvh,
     const trace_lights& lights, image4f& img, image<trace_pixel>& pixels,
-    int nsamples, const trace_params& params) {
+    int nsamples, const trace_params& params, trace_aovs* aovs,
+    trace_stats* stats) {
     auto shader = trace_shaders.at(params.shader);
+    auto crop = eval_trace_crop(img, params);
+    std::mutex stats_mutex;
     if (params.parallel) {
         auto nthreads = std::thread::hardware_concurrency();
         auto threads = std::vector<std::thread>();
         for (auto tid = 0; tid < std::thread::hardware_concurrency(); tid++) {
-            threads.push_back(std::thread([=, &img, &pixels, &params]() {
-                for (auto j = tid; j < img.height(); j += nthreads) {
-                    for (auto i = 0; i < img.width(); i++) {
+            threads.push_back(std::thread([=, &img, &pixels, &params,
+                                              &stats_mutex]() {
+                start_thread_stats();
+                for (auto j = params.shard + tid * params.nshards;
+                     j < crop.w; j += nthreads * params.nshards) {
+                    if (j < crop.y) continue;
+                    for (auto i = crop.x; i < crop.z; i++) {
                         auto& pxl = pixels.at(i, j);
                         for (auto s = 0; s < nsamples; s++)
-                            trace_sample(
-                                scn, cam, bvh, lights, pxl, shader, params);
+                            trace_sample(scn, cam, bvh, lights, pxl, i, j,
+                                shader, params, aovs);
                         img.at(i, j) =
                             vec4f{pxl.col.x, pxl.col.y, pxl.col.z, pxl.alpha};
                         img.at(i, j) /= pxl.sample;
+                        if (aovs) update_aovs_variance(aovs, pxl, i, j);
                     }
                 }
+                end_thread_stats(stats, stats_mutex);
             }));
         }
         for (auto& t : threads) t.join();
         threads.clear();
     } else {
         auto shader = trace_shaders.at(params.shader);
-        for (auto j = 0; j < img.height(); j++) {
-            for (auto i = 0; i < img.width(); i++) {
+        start_thread_stats();
+        for (auto j = params.shard; j < crop.w; j += params.nshards) {
+            if (j < crop.y) continue;
+            for (auto i = crop.x; i < crop.z; i++) {
                 auto& pxl = pixels.at(i, j);
-                for (auto s = 0; s < params.nsamples; s++)
-                    trace_sample(scn, cam, bvh, lights, pxl, shader, params);
+                for (auto s = 0; s < nsamples; s++)
+                    trace_sample(scn, cam, bvh, lights, pxl, i, j, shader,
+                        params, aovs);
                 img.at(i, j) =
                     vec4f{pxl.col.x, pxl.col.y, pxl.col.z, pxl.alpha};
                 img.at(i, j) /= pxl.sample;
+                if (aovs) update_aovs_variance(aovs, pxl, i, j);
             }
         }
+        end_thread_stats(stats, stats_mutex);
+    }
+}
+
+// Trace a batch of samples for multiple cameras. The rows of all images are
+// interleaved across threads, so that all cores stay busy regardless of the
+// image sizes.
+void trace_samples(const scene* scn, const std::vector<const camera*>& cams,
+    const bvh_tree* bvh, const trace_lights& lights,
+    const std::vector<image4f*>& imgs,
+    const std::vector<image<trace_pixel>*>& pixels, int nsamples,
+    const trace_params& params, trace_stats* stats) {
+    auto shader = trace_shaders.at(params.shader);
+    std::mutex stats_mutex;
+    auto rows = std::vector<vec2i>();
+    for (auto cid = 0; cid < cams.size(); cid++) {
+        auto crop = eval_trace_crop(*imgs[cid], params);
+        for (auto j = params.shard; j < crop.w; j += params.nshards)
+            if (j >= crop.y) rows.push_back({cid, j});
+    }
+    auto trace_row = [&](const vec2i& row) {
+        auto cam = cams[row.x];
+        auto& img = *imgs[row.x];
+        auto crop = eval_trace_crop(img, params);
+        auto j = row.y;
+        for (auto i = crop.x; i < crop.z; i++) {
+            auto& pxl = pixels[row.x]->at(i, j);
+            for (auto s = 0; s < nsamples; s++)
+                trace_sample(
+                    scn, cam, bvh, lights, pxl, i, j, shader, params);
+            img.at(i, j) = vec4f{pxl.col.x, pxl.col.y, pxl.col.z, pxl.alpha};
+            img.at(i, j) /= pxl.sample;
+        }
+    };
+    if (params.parallel) {
+        auto nthreads = std::thread::hardware_concurrency();
+        auto threads = std::vector<std::thread>();
+        for (auto tid = 0; tid < nthreads; tid++) {
+            threads.push_back(
+                std::thread([=, &rows, &trace_row, &stats_mutex]() {
+                    start_thread_stats();
+                    for (auto r = tid; r < rows.size(); r += nthreads)
+                        trace_row(rows[r]);
+                    end_thread_stats(stats, stats_mutex);
+                }));
+        }
+        for (auto& t : threads) t.join();
+        threads.clear();
+    } else {
+        start_thread_stats();
+        for (auto& row : rows) trace_row(row);
+        end_thread_stats(stats, stats_mutex);
     }
 }
 
+// Filtered sample of a pixel, kept until it is gathered by its neighbors.
+struct trace_filtered_sample {
+    vec2f crn = zero2f;  // position in the pixel
+    vec3f l = zero3f;    // radiance
+    bool valid = false;  // whether the sample contributes
+};
+
 // Trace a filtered sample of samples
-void trace_sample_filtered(const scene* scn, const camera* cam,
-    const bvh_tree* bvh, const trace_lights& lights, image4f& img,
-    trace_pixel& pxl, trace_shader shader, trace_filter filter, int filter_size,
-    std::mutex& image_mutex, const trace_params& params) {
+trace_filtered_sample trace_sample_filtered(const scene* scn,
+    const camera* cam, const bvh_tree* bvh, const trace_lights& lights,
+    trace_pixel& pxl, int i, int j, trace_shader shader,
+    const trace_params& params) {
     pxl.sample += 1;
-    pxl.dimension = 0;
-    auto crn = sample_next2f(pxl, params.rng, params.nsamples);
-    auto lrn = sample_next2f(pxl, params.rng, params.nsamples);
-    auto uv = vec2f{(pxl.i + crn.x) / (cam->aspect * params.resolution),
-        1 - (pxl.j + crn.y) / params.resolution};
+    auto smp = make_trace_sampler(i, j, pxl.sample, params);
+    auto crn = sample_next2f(smp, params.rng, params.nsamples);
+    auto lrn = sample_next2f(smp, params.rng, params.nsamples);
+    auto uv = vec2f{(i + crn.x) / (cam->aspect * params.resolution),
+        1 - (j + crn.y) / params.resolution};
     auto ray = eval_camera_ray(cam, uv, lrn);
-    auto pt = intersect_scene(scn, bvh, ray);
-    if (!pt.shp && params.envmap_invisible) return;
-    auto l = shader(scn, bvh, lights, pt, -ray.d, pxl, params);
+    trace_thread_stats.primary_rays += 1;
+    auto pt = intersect_scene(scn, bvh, lights, ray);
+    if (!pt.shp && params.envmap_invisible) return {};
+    auto l = shader(scn, bvh, lights, pt, -ray.d, smp, params);
     if (!isfinite(l.x) || !isfinite(l.y) || !isfinite(l.z)) {
         log_error("NaN detected");
-        return;
+        trace_thread_stats.nan_samples += 1;
+        return {};
     }
     if (params.pixel_clamp > 0) l = clamplen(l, params.pixel_clamp);
-    if (params.filter == trace_filter_type::box) {
-        pxl.col += l;
-        pxl.alpha += 1;
-        pxl.weight += 1;
-    } else {
-        std::lock_guard<std::mutex> lock(image_mutex);
-        for (auto fj = max(0, pxl.j - filter_size);
-             fj <= min(img.height() - 1, pxl.j + filter_size); fj++) {
-            for (auto fi = max(0, pxl.i - filter_size);
-                 fi <= min(img.width() - 1, pxl.i + filter_size); fi++) {
-                auto w = filter((fi - pxl.i) - uv.x + 0.5f) *
-                         filter((fj - pxl.j) - uv.y + 0.5f);
-                pxl.col += l * w;
-                pxl.alpha += w;
-                pxl.weight += w;
-            }
+    return {crn, l, true};
+}
+
+// Gathers into a pixel the filtered samples of its neighbors.
+void gather_filtered_samples(trace_pixel& pxl,
+    const image<trace_filtered_sample>& samples, int i, int j,
+    trace_filter filter, int filter_size) {
+    auto width = samples.width(), height = samples.height();
+    for (auto fj = max(0, j - filter_size);
+         fj <= min(height - 1, j + filter_size); fj++) {
+        for (auto fi = max(0, i - filter_size);
+             fi <= min(width - 1, i + filter_size); fi++) {
+            auto& fsmp = samples.at(fi, fj);
+            if (!fsmp.valid) continue;
+            auto w = (filter) ? filter(fi - i + fsmp.crn.x - 0.5f) *
+                                    filter(fj - j + fsmp.crn.y - 0.5f) :
+                                1.0f;
+            pxl.col += fsmp.l * w;
+            pxl.alpha += w;
+            pxl.weight += w;
         }
     }
 }
 
-// Trace the next nsamples.
-void trace_samples_filtered(const scene* scn, const camera* cam,
-    const bvh_tree* bvh, const trace_lights& lights, image4f& img,
-    image<trace_pixel>& pixels, int nsamples, const trace_params& params) {
-    auto shader = trace_shaders.at(params.shader);
-    auto filter = trace_filters.at(params.filter);
-    auto filter_size = trace_filter_sizes.at(params.filter);
-    std::mutex image_mutex;
-    if (params.parallel) {
-        auto nthreads = std::thread::hardware_concurrency();
+// Runs a function over the rows in [start,end) with the given step,
+// interleaving rows across threads if parallel. The trace statistics of each
+// thread are added to stats, if not null.
+template <typename Func>
+void trace_rows(int start, int end, int step, bool parallel, Func&& func,
+    trace_stats* stats = nullptr) {
+    std::mutex stats_mutex;
+    if (parallel) {
+        auto nthreads = (int)std::thread::hardware_concurrency();
         auto threads = std::vector<std::thread>();
-        for (auto tid = 0; tid < std::thread::hardware_concurrency(); tid++) {
-            threads.push_back(
-                std::thread([=, &pixels, &params, &image_mutex, &img]() {
-                    for (auto j = tid; j < img.height(); j += nthreads) {
-                        for (auto i = 0; i < img.width(); i++) {
-                            auto& pxl = pixels.at(i, j);
-                            for (auto s = 0; s < nsamples; s++) {
-                                trace_sample_filtered(scn, cam, bvh, lights,
-                                    img, pxl, shader, filter, filter_size,
-                                    image_mutex, params);
-                            }
-                        }
-                    }
-                }));
+        for (auto tid = 0; tid < nthreads; tid++) {
+            threads.push_back(std::thread([=, &func, &stats_mutex]() {
+                start_thread_stats();
+                for (auto j = start + tid * step; j < end; j += nthreads * step)
+                    func(j);
+                end_thread_stats(stats, stats_mutex);
+            }));
         }
         for (auto& t : threads) t.join();
         threads.clear();
     } else {
-        for (auto j = 0; j < img.height(); j++) {
-            for (auto i = 0; i < img.width(); i++) {
-                auto& pxl = pixels.at(i, j);
-                for (auto s = 0; s < params.nsamples; s++) {
-                    trace_sample_filtered(scn, cam, bvh, lights, img, pxl,
-                        shader, filter, filter_size, image_mutex, params);
-                }
-            }
-        }
+        start_thread_stats();
+        for (auto j = start; j < end; j += step) func(j);
+        end_thread_stats(stats, stats_mutex);
     }
-    for (auto j = 0; j < img.height(); j++) {
-        for (auto i = 0; i < img.width(); i++) {
+}
+
+// Trace the next nsamples. Each pass traces one sample per pixel and then
+// gathers the samples of the neighbors in a fixed order, so the result does
+// not depend on the number of threads.
+void trace_samples_filtered(const scene* scn, const camera* cam,
+    const bvh_tree* bvh, const trace_lights& lights, image4f& img,
+    image<trace_pixel>& pixels, int nsamples, const trace_params& params,
+    trace_stats* stats) {
+    auto shader = trace_shaders.at(params.shader);
+    auto filter = trace_filters.at(params.filter);
+    auto filter_size = trace_filter_sizes.at(params.filter);
+    auto crop = eval_trace_crop(img, params);
+    auto samples =
+        image<trace_filtered_sample>(img.width(), img.height());
+    // samples are traced around the crop too, so that crop pixels gather
+    // the same neighbors as in the full image
+    auto traced = vec4i{max(0, crop.x - filter_size),
+        max(0, crop.y - filter_size), min(img.width(), crop.z + filter_size),
+        min(img.height(), crop.w + filter_size)};
+    for (auto s = 0; s < nsamples; s++) {
+        trace_rows(params.shard, traced.w, params.nshards, params.parallel,
+            [&](int j) {
+                if (j < traced.y) return;
+                for (auto i = traced.x; i < traced.z; i++) {
+                    samples.at(i, j) = trace_sample_filtered(scn, cam, bvh,
+                        lights, pixels.at(i, j), i, j, shader, params);
+                }
+            },
+            stats);
+        trace_rows(crop.y, crop.w, 1, params.parallel, [&](int j) {
+            for (auto i = crop.x; i < crop.z; i++) {
+                gather_filtered_samples(
+                    pixels.at(i, j), samples, i, j, filter, filter_size);
+            }
+        });
+    }
+    for (auto j = crop.y; j < crop.w; j++) {
+        for (auto i = crop.x; i < crop.z; i++) {
             auto& pxl = pixels.at(i, j);
+            if (!pxl.weight) continue;
             img.at(i, j) = {pxl.col.x, pxl.col.y, pxl.col.z, pxl.alpha};
             img.at(i, j) /= pxl.weight;
         }
@@ -6688,27 +7961,74 @@ void trace_samples_filtered(const scene* scn, const camera* cam,
 void trace_async_start(const scene* scn, const camera* cam, const bvh_tree* bvh,
     const trace_lights& lights, image4f& img, image<trace_pixel>& pixels,
     std::vector<std::thread>& threads, bool& stop_flag,
-    const trace_params& params) {
+    const trace_params& params, trace_stats* stats) {
     pixels = make_trace_pixels(img, params);
-    auto nthreads = std::thread::hardware_concurrency();
-    for (auto tid = 0; tid < std::thread::hardware_concurrency(); tid++) {
-        threads.push_back(std::thread([=, &img, &pixels, &stop_flag]() {
-            auto shader = trace_shaders.at(params.shader);
-            for (auto s = 0; s < params.nsamples; s++) {
-                for (auto j = tid; j < img.height(); j += nthreads) {
-                    for (auto i = 0; i < img.width(); i++) {
-                        if (stop_flag) return;
-                        auto& pxl = pixels.at(i, j);
-                        trace_sample(
-                            scn, cam, bvh, lights, pxl, shader, params);
-                        img.at(i, j) = {
-                            pxl.col.x, pxl.col.y, pxl.col.z, pxl.alpha};
-                        img.at(i, j) /= pxl.sample;
+    // a single driver thread runs the preview levels and the full passes,
+    // each on all cores, so that levels never race on the same pixels
+    threads.push_back(std::thread([=, &img, &pixels, &stop_flag]() {
+        auto shader = trace_shaders.at(params.shader);
+        auto nthreads = std::thread::hardware_concurrency();
+        auto workers = std::vector<std::thread>();
+        std::mutex stats_mutex;
+        auto start_worker = [&](auto&& func) {
+            workers.push_back(std::thread([=, &stats_mutex]() {
+                start_thread_stats();
+                func();
+                end_thread_stats(stats, stats_mutex);
+            }));
+        };
+
+        // preview at 1/8, 1/4 and 1/2 resolution, tracing the top-left pixel
+        // of each block and copying it to the whole block
+        for (auto block : {8, 4, 2}) {
+            for (auto tid = 0; tid < nthreads; tid++) {
+                start_worker([=, &img, &pixels, &stop_flag]() {
+                    for (auto j = tid * block; j < img.height();
+                         j += nthreads * block) {
+                        for (auto i = 0; i < img.width(); i += block) {
+                            if (stop_flag) return;
+                            auto& pxl = pixels.at(i, j);
+                            trace_sample(scn, cam, bvh, lights, pxl, i, j,
+                                shader, params);
+                            auto col = vec4f{
+                                pxl.col.x, pxl.col.y, pxl.col.z, pxl.alpha};
+                            col /= pxl.sample;
+                            for (auto bj = j;
+                                 bj < min(j + block, img.height()); bj++)
+                                for (auto bi = i;
+                                     bi < min(i + block, img.width()); bi++)
+                                    img.at(bi, bj) = col;
+                        }
                     }
-                }
+                });
             }
-        }));
-    }
+            for (auto& t : workers) t.join();
+            workers.clear();
+            if (stop_flag) return;
+        }
+
+        // full resolution passes, skipping samples done in the preview
+        for (auto tid = 0; tid < nthreads; tid++) {
+            start_worker([=, &img, &pixels, &stop_flag]() {
+                for (auto s = 0; s < params.nsamples; s++) {
+                    for (auto j = tid; j < img.height(); j += nthreads) {
+                        for (auto i = 0; i < img.width(); i++) {
+                            if (stop_flag) return;
+                            auto& pxl = pixels.at(i, j);
+                            if (pxl.sample > s) continue;
+                            trace_sample(scn, cam, bvh, lights, pxl, i, j,
+                                shader, params);
+                            img.at(i, j) = {
+                                pxl.col.x, pxl.col.y, pxl.col.z, pxl.alpha};
+                            img.at(i, j) /= pxl.sample;
+                        }
+                    }
+                }
+            });
+        }
+        for (auto& t : workers) t.join();
+        workers.clear();
+    }));
 }
 
 // Stop the asynchronous renderer.
@@ -6719,15 +8039,158 @@ void trace_async_stop(std::vector<std::thread>& threads, bool& stop_flag) {
     threads.clear();
 }
 
+// Rasterizes a triangle in texture space, calling func(i, j, tuv) for each
+// texel center covered, with tuv the barycentric coordinates of the center.
+template <typename Func>
+void rasterize_texcoord_triangle(const vec2f& t0, const vec2f& t1,
+    const vec2f& t2, int width, int height, Func&& func) {
+    auto p0 = vec2f{t0.x * width, t0.y * height},
+         p1 = vec2f{t1.x * width, t1.y * height},
+         p2 = vec2f{t2.x * width, t2.y * height};
+    auto e1 = p1 - p0, e2 = p2 - p0;
+    auto det = e1.x * e2.y - e1.y * e2.x;
+    if (!det) return;
+    auto i0 = max(0, (int)std::floor(min(p0.x, min(p1.x, p2.x)))),
+         i1 = min(width - 1, (int)std::ceil(max(p0.x, max(p1.x, p2.x)))),
+         j0 = max(0, (int)std::floor(min(p0.y, min(p1.y, p2.y)))),
+         j1 = min(height - 1, (int)std::ceil(max(p0.y, max(p1.y, p2.y))));
+    for (auto j = j0; j <= j1; j++) {
+        for (auto i = i0; i <= i1; i++) {
+            auto d = vec2f{i + 0.5f, j + 0.5f} - p0;
+            auto u = (d.x * e2.y - d.y * e2.x) / det;
+            auto v = (e1.x * d.y - e1.y * d.x) / det;
+            if (u < 0 || v < 0 || u + v > 1) continue;
+            func(i, j, vec2f{u, v});
+        }
+    }
+}
+
+// Bakes ambient occlusion or irradiance in texture space.
+void trace_bake(const scene* scn, const bvh_tree* bvh,
+    const trace_lights& lights, const instance* ist, int sid, image4f& img,
+    const trace_params& params, const trace_bake_params& bake_params) {
+    auto shp = ist->shp->shapes.at(sid);
+    auto width = img.width(), height = img.height();
+    for (auto& p : img) p = zero4f;
+    if (shp->texcoord.empty()) return;
+
+    // find the element covering each texel center; quad coordinates are
+    // exact for quads that are parallelograms in texture space
+    auto texel_eids = image<int>(width, height, -1);
+    auto texel_euvs = image<vec2f>(width, height, zero2f);
+    auto& tc = shp->texcoord;
+    for (auto eid = 0; eid < shp->triangles.size(); eid++) {
+        auto& t = shp->triangles[eid];
+        rasterize_texcoord_triangle(tc[t.x], tc[t.y], tc[t.z], width, height,
+            [&](int i, int j, const vec2f& tuv) {
+                texel_eids.at(i, j) = eid;
+                texel_euvs.at(i, j) = tuv;
+            });
+    }
+    for (auto eid = 0; eid < shp->quads.size(); eid++) {
+        auto& q = shp->quads[eid];
+        rasterize_texcoord_triangle(tc[q.x], tc[q.y], tc[q.z], width, height,
+            [&](int i, int j, const vec2f& tuv) {
+                texel_eids.at(i, j) = eid;
+                texel_euvs.at(i, j) = {tuv.x + tuv.y, tuv.y};
+            });
+        if (q.z == q.w) continue;
+        rasterize_texcoord_triangle(tc[q.x], tc[q.z], tc[q.w], width, height,
+            [&](int i, int j, const vec2f& tuv) {
+                texel_eids.at(i, j) = eid;
+                texel_euvs.at(i, j) = {tuv.x, tuv.x + tuv.y};
+            });
+    }
+
+    // trace the texels
+    auto shader = trace_shaders.at(params.shader);
+    trace_rows(0, height, 1, params.parallel, [&](int j) {
+        for (auto i = 0; i < width; i++) {
+            auto eid = texel_eids.at(i, j);
+            if (eid < 0) continue;
+            auto euv = texel_euvs.at(i, j);
+            auto pos = eval_pos(ist, sid, eid, euv);
+            auto frame = make_frame_fromz(pos, eval_norm(ist, sid, eid, euv));
+            auto l = zero3f;
+            for (auto s = 1; s <= params.nsamples; s++) {
+                auto smp = make_trace_sampler(i, j, s, params);
+                auto rn = sample_next2f(smp, params.rng, params.nsamples);
+                auto wi =
+                    transform_direction(frame, sample_hemisphere_cosine(rn));
+                auto ray = make_ray(pos, wi, params.ray_eps);
+                if (bake_params.type == trace_bake_type::ao) {
+                    if (bake_params.ao_distance > 0)
+                        ray.tmax = bake_params.ao_distance;
+                    if (!intersect_bvh(bvh, ray, true)) l += vec3f{1, 1, 1};
+                } else {
+                    auto pt = intersect_scene(scn, bvh, lights, ray);
+                    auto li = shader(scn, bvh, lights, pt, -wi, smp, params);
+                    if (!isfinite(li.x) || !isfinite(li.y) || !isfinite(li.z))
+                        continue;
+                    if (params.pixel_clamp > 0)
+                        li = clamplen(li, params.pixel_clamp);
+                    // cosine sampling cancels all but pi in the estimator
+                    l += li * pif;
+                }
+            }
+            l /= (float)params.nsamples;
+            img.at(i, j) = {l.x, l.y, l.z, 1};
+        }
+    });
+
+    // dilate across seams, averaging the filled neighbors of each texel
+    for (auto pass = 0; pass < bake_params.dilate; pass++) {
+        auto dilated = img;
+        for (auto j = 0; j < height; j++) {
+            for (auto i = 0; i < width; i++) {
+                if (img.at(i, j).w) continue;
+                auto sum = zero4f;
+                for (auto dj = -1; dj <= 1; dj++) {
+                    for (auto di = -1; di <= 1; di++) {
+                        auto ii = i + di, jj = j + dj;
+                        if (ii < 0 || jj < 0 || ii >= width || jj >= height)
+                            continue;
+                        if (img.at(ii, jj).w) sum += img.at(ii, jj);
+                    }
+                }
+                if (sum.w) dilated.at(i, j) = sum / sum.w;
+            }
+        }
+        img = dilated;
+    }
+}
+
 // Initialize trace lights
 trace_lights make_trace_lights(const scene* scn) {
     auto lights = trace_lights();
+
+    // compile materials
+    auto mmap = std::unordered_map<const material*, int>();
+    for (auto mat : scn->materials) {
+        mmap[mat] = (int)lights.materials.size();
+        lights.materials.push_back(make_trace_material(mat));
+    }
+    mmap[nullptr] = (int)lights.materials.size();
+    lights.materials.push_back(make_trace_material(nullptr));
     for (auto ist : scn->instances) {
+        lights.instance_offsets.push_back((int)lights.shape_materials.size());
+        for (auto shp : ist->shp->shapes) {
+            if (!contains(mmap, shp->mat)) {
+                mmap[shp->mat] = (int)lights.materials.size();
+                lights.materials.push_back(make_trace_material(shp->mat));
+            }
+            lights.shape_materials.push_back(mmap.at(shp->mat));
+        }
+    }
+
+    for (auto iid = 0; iid < scn->instances.size(); iid++) {
+        auto ist = scn->instances[iid];
         auto shp = ist->shp->shapes.at(0);
         if (!shp->mat) continue;
         if (shp->mat->ke == zero3f) continue;
         auto lgt = trace_light();
         lgt.ist = ist;
+        lgt.mat = lights.shape_materials[lights.instance_offsets[iid]];
         lights.lights.push_back(lgt);
         if (!contains(lights.shape_cdfs, shp)) {
             if (!shp->points.empty()) {
@@ -6752,22 +8215,268 @@ trace_lights make_trace_lights(const scene* scn) {
     return lights;
 }
 
+// Initialize trace AOVs
+trace_aovs make_trace_aovs(const scene* scn, const image4f& img) {
+    auto aovs = trace_aovs();
+    aovs.albedo = image4f(img.width(), img.height());
+    aovs.normal = image4f(img.width(), img.height());
+    aovs.depth = image4f(img.width(), img.height());
+    aovs.id = image4f(img.width(), img.height(), {-1, -1, -1, 0});
+    aovs.variance = image4f(img.width(), img.height());
+    aovs.col2 = image<vec3f>(img.width(), img.height());
+    for (auto mid = 0; mid < scn->materials.size(); mid++)
+        aovs.material_ids[scn->materials[mid]] = mid;
+    return aovs;
+}
+
+// Denoising guides of a pixel, packed contiguously for the filter inner loop.
+struct trace_denoise_pixel {
+    vec3f col = zero3f;     // color
+    vec3f albedo = zero3f;  // albedo
+    vec3f norm = zero3f;    // normal
+    float depth = 0;        // depth
+    float var = 0;          // variance of the pixel estimate
+};
+
+// Denoises an image with a cross-bilateral filter guided by the AOVs.
+// All range terms are summed in a single exponent, so that each neighbor
+// costs one exp, and spatial terms are tabulated.
+image4f denoise_trace_image(const image4f& img, const trace_aovs& aovs,
+    const trace_denoise_params& params) {
+    auto width = img.width(), height = img.height();
+    auto guides = std::vector<trace_denoise_pixel>(img.pixels.size());
+    for (auto idx = 0; idx < img.pixels.size(); idx++) {
+        auto& g = guides[idx];
+        auto& c = img.pixels[idx];
+        auto& a = aovs.albedo.pixels[idx];
+        auto& n = aovs.normal.pixels[idx];
+        auto& v = aovs.variance.pixels[idx];
+        g.col = {c.x, c.y, c.z};
+        g.albedo = {a.x, a.y, a.z};
+        g.norm = {n.x, n.y, n.z};
+        g.depth = aovs.depth.pixels[idx].x;
+        g.var = (v.w) ? (v.x + v.y + v.z) / (3 * v.w) : 0;
+    }
+
+    // spatial weights
+    auto r = max(params.radius, 0), size = 2 * r + 1;
+    auto spatial = std::vector<float>(size * size);
+    for (auto fj = -r; fj <= r; fj++) {
+        for (auto fi = -r; fi <= r; fi++) {
+            spatial[(fj + r) * size + fi + r] =
+                (fi * fi + fj * fj) /
+                (2 * params.spatial_sigma * params.spatial_sigma);
+        }
+    }
+    auto cw = 2 * params.color_sigma * params.color_sigma;
+    auto aw = 1 / (2 * params.albedo_sigma * params.albedo_sigma);
+    auto nw = 1 / (2 * params.normal_sigma * params.normal_sigma);
+    auto dw = 1 / (2 * params.depth_sigma * params.depth_sigma);
+
+    // neighbors are taken only inside the window
+    auto win = params.window;
+    if (win.z <= win.x || win.w <= win.y) {
+        win = {0, 0, width, height};
+    } else {
+        win = {clamp(win.x, 0, width), clamp(win.y, 0, height),
+            clamp(win.z, 0, width), clamp(win.w, 0, height)};
+    }
+
+    auto denoised = img;
+    auto denoise_row = [&](int j) {
+        if (j < win.y || j >= win.w) return;
+        for (auto i = win.x; i < win.z; i++) {
+            auto& p = guides[j * width + i];
+            auto pd = 1 / max(p.depth, 1e-3f);
+            auto av = zero3f;
+            auto ws = 0.0f;
+            for (auto fj = max(-r, win.y - j); fj <= min(r, win.w - 1 - j);
+                 fj++) {
+                auto row = guides.data() + (j + fj) * width + i;
+                auto srow = spatial.data() + (fj + r) * size + r;
+                for (auto fi = max(-r, win.x - i); fi <= min(r, win.z - 1 - i);
+                     fi++) {
+                    auto& q = row[fi];
+                    auto dc = q.col - p.col, da = q.albedo - p.albedo,
+                         dn = q.norm - p.norm;
+                    auto dd = (q.depth - p.depth) * pd;
+                    auto e = srow[fi] +
+                             dot(dc, dc) / (cw * (p.var + q.var) + 1e-8f) +
+                             dot(da, da) * aw + dot(dn, dn) * nw +
+                             dd * dd * dw;
+                    auto w = std::exp(-e);
+                    av += q.col * w;
+                    ws += w;
+                }
+            }
+            auto c = av / ws;
+            denoised.at(i, j) = {c.x, c.y, c.z, img.at(i, j).w};
+        }
+    };
+
+    if (params.parallel) {
+        auto nthreads = std::thread::hardware_concurrency();
+        auto threads = std::vector<std::thread>();
+        for (auto tid = 0; tid < nthreads; tid++) {
+            threads.push_back(std::thread([=, &denoise_row]() {
+                for (auto j = tid; j < height; j += nthreads) denoise_row(j);
+            }));
+        }
+        for (auto& t : threads) t.join();
+    } else {
+        for (auto j = 0; j < height; j++) denoise_row(j);
+    }
+    return denoised;
+}
+
 // Initialize a rendering state
 image<trace_pixel> make_trace_pixels(
     const image4f& img, const trace_params& params) {
-    auto pixels = image<trace_pixel>(img.width(), img.height());
-    for (auto j = 0; j < img.height(); j++) {
-        for (auto i = 0; i < img.width(); i++) {
-            auto pxl = trace_pixel();
-            pxl.i = i;
-            pxl.j = j;
-            pxl.rng = init_rng(params.seed, (j * img.width() + i) * 2 + 1);
-            pixels.at(i, j) = pxl;
-        }
+    return image<trace_pixel>(img.width(), img.height());
+}
+
+// Checkpoint magic number and version.
+static const uint32_t trace_checkpoint_magic = 0x43525459;  // "YTRC"
+static const uint32_t trace_checkpoint_version = 3;
+
+// writing shortcut
+template <typename T>
+void trace_checkpoint_write(std::vector<byte>& buf, const T& v) {
+    auto pos = buf.size();
+    buf.resize(pos + sizeof(T));
+    memcpy(buf.data() + pos, &v, sizeof(T));
+}
+
+// reading shortcut
+template <typename T>
+void trace_checkpoint_read(const std::vector<byte>& buf, size_t& pos, T& v) {
+    if (pos + sizeof(T) > buf.size())
+        throw std::runtime_error("truncated trace checkpoint");
+    memcpy(&v, buf.data() + pos, sizeof(T));
+    pos += sizeof(T);
+}
+
+// Size of a pixel in a checkpoint.
+static const size_t trace_checkpoint_pixel_size =
+    sizeof(vec3f) + sizeof(float) + sizeof(float) + sizeof(int);
+
+// Hash of the camera values that determine the traced rays.
+uint64_t hash_trace_camera(const camera* cam) {
+    if (!cam) return 0;
+    auto vals = std::vector<float>{cam->yfov, cam->aspect, cam->focus,
+        cam->aperture, (cam->ortho) ? 1.0f : 0.0f};
+    for (auto& axis : {cam->frame.x, cam->frame.y, cam->frame.z, cam->frame.o})
+        vals.insert(vals.end(), {axis.x, axis.y, axis.z});
+    auto h = (uint64_t)1;
+    for (auto val : vals) {
+        auto bits = (uint32_t)0;
+        memcpy(&bits, &val, sizeof(bits));
+        h = hash_uint64(h ^ bits);
+    }
+    return h;
+}
+
+// Names of the differing trace params.
+std::vector<std::string> diff_trace_params(
+    const trace_params& a, const trace_params& b) {
+    auto avals = std::vector<std::vector<byte>>();
+    auto a_ = a, b_ = b;
+    visit(a_, [&](auto& val, const visit_var& var) {
+        auto bytes = std::vector<byte>(sizeof(val));
+        memcpy(bytes.data(), &val, sizeof(val));
+        avals.push_back(bytes);
+    });
+    auto names = std::vector<std::string>();
+    auto idx = 0;
+    visit(b_, [&](auto& val, const visit_var& var) {
+        auto& bytes = avals[idx++];
+        if (var.name == "parallel") return;
+        if (memcmp(bytes.data(), &val, sizeof(val))) names.push_back(var.name);
+    });
+    return names;
+}
+
+// Saves the trace pixels state to a binary checkpoint file.
+void save_trace_pixels(const std::string& filename,
+    const image<trace_pixel>& pixels, const trace_params& params,
+    const camera* cam) {
+    auto buf = std::vector<byte>();
+    buf.reserve(256 + pixels.pixels.size() * trace_checkpoint_pixel_size);
+    trace_checkpoint_write(buf, trace_checkpoint_magic);
+    trace_checkpoint_write(buf, trace_checkpoint_version);
+    trace_checkpoint_write(buf, pixels.width());
+    trace_checkpoint_write(buf, pixels.height());
+    auto params_ = params;
+    visit(params_, [&](auto& val, const visit_var& var) {
+        if (var.name != "parallel") trace_checkpoint_write(buf, val);
+    });
+    trace_checkpoint_write(buf, hash_trace_camera(cam));
+    for (auto& pxl : pixels.pixels) {
+        trace_checkpoint_write(buf, pxl.col);
+        trace_checkpoint_write(buf, pxl.alpha);
+        trace_checkpoint_write(buf, pxl.weight);
+        trace_checkpoint_write(buf, pxl.sample);
+    }
+    auto tmpname = filename + ".tmp";
+    save_binary(tmpname, buf);
+    if (std::rename(tmpname.c_str(), filename.c_str()))
+        throw std::runtime_error("cannot write file " + filename);
+}
+
+// Loads the trace pixels state from a binary checkpoint file.
+image<trace_pixel> load_trace_pixels(
+    const std::string& filename, trace_params& params, const camera* cam) {
+    auto buf = load_binary(filename);
+    auto pos = (size_t)0;
+    auto magic = (uint32_t)0, version = (uint32_t)0;
+    trace_checkpoint_read(buf, pos, magic);
+    if (magic != trace_checkpoint_magic)
+        throw std::runtime_error("corrupted trace checkpoint " + filename);
+    trace_checkpoint_read(buf, pos, version);
+    if (version != trace_checkpoint_version)
+        throw std::runtime_error("unsupported trace checkpoint version");
+    auto width = 0, height = 0;
+    trace_checkpoint_read(buf, pos, width);
+    trace_checkpoint_read(buf, pos, height);
+    if (width < 0 || height < 0)
+        throw std::runtime_error("corrupted trace checkpoint " + filename);
+    visit(params, [&](auto& val, const visit_var& var) {
+        if (var.name != "parallel") trace_checkpoint_read(buf, pos, val);
+    });
+    auto cam_hash = (uint64_t)0;
+    trace_checkpoint_read(buf, pos, cam_hash);
+    if (cam && cam_hash != hash_trace_camera(cam))
+        throw std::runtime_error("checkpoint rendered with another camera");
+    if ((buf.size() - pos) / trace_checkpoint_pixel_size <
+        (size_t)width * (size_t)height)
+        throw std::runtime_error("truncated trace checkpoint");
+    auto pixels = image<trace_pixel>(width, height);
+    for (auto& pxl : pixels.pixels) {
+        trace_checkpoint_read(buf, pos, pxl.col);
+        trace_checkpoint_read(buf, pos, pxl.alpha);
+        trace_checkpoint_read(buf, pos, pxl.weight);
+        trace_checkpoint_read(buf, pos, pxl.sample);
     }
     return pixels;
 }
 
+// Merges the trace pixels state of a shard. Filtered shards also gather
+// weights into rows they did not trace, so all pixels are summed.
+void merge_trace_pixels(
+    image<trace_pixel>& pixels, const image<trace_pixel>& shard) {
+    if (pixels.width() != shard.width() || pixels.height() != shard.height())
+        throw std::runtime_error("cannot merge shards of different sizes");
+    for (auto idx = 0; idx < pixels.pixels.size(); idx++) {
+        auto& pxl = pixels.pixels[idx];
+        auto& spxl = shard.pixels[idx];
+        if (!spxl.sample && !spxl.weight) continue;
+        pxl.col += spxl.col;
+        pxl.alpha += spxl.alpha;
+        pxl.weight += spxl.weight;
+        pxl.sample += spxl.sample;
+    }
+}
+
 }  // namespace ygl
 
 // -----------------------------------------------------------------------------
@@ -6976,188 +8685,424 @@ std::vector<obj_material*> load_mtl(const std::string& filename, bool flip_tr,
     return materials;
 }
 
-// Loads textures for an scene.
+// Loads textures for an scene. Textures are decoded in parallel.
 void load_textures(
     obj_scene* asset, const std::string& dirname, bool skip_missing) {
-    for (auto txt : asset->textures) {
-        auto filename = dirname + txt->path;
+    auto jobs = std::vector<image_decode_job>(asset->textures.size());
+    for (auto tid = 0; tid < asset->textures.size(); tid++) {
+        auto& filename = jobs[tid].filename;
+        filename = dirname + asset->textures[tid]->path;
         for (auto& c : filename)
             if (c == '\\') c = '/';
+    }
 #if YGL_IMAGEIO
-        if (is_hdr_filename(filename)) {
-            txt->dataf =
-                load_imagef(filename, txt->width, txt->height, txt->ncomp);
-        } else {
-            txt->datab =
-                load_image(filename, txt->width, txt->height, txt->ncomp);
-        }
+    decode_images(jobs);
 #endif
+    for (auto tid = 0; tid < asset->textures.size(); tid++) {
+        auto txt = asset->textures[tid];
+        auto& job = jobs[tid];
+        txt->width = job.width;
+        txt->height = job.height;
+        txt->ncomp = job.ncomp;
+        txt->datab = std::move(job.datab);
+        txt->dataf = std::move(job.dataf);
         if (txt->datab.empty() && txt->dataf.empty()) {
             if (skip_missing) continue;
-            throw std::runtime_error("cannot laod image " + filename);
+            throw std::runtime_error("cannot laod image " + job.filename);
         }
     }
 }
 
-// Loads an OBJ
-obj_scene* load_obj(const std::string& filename, bool load_txt,
-    bool skip_missing, bool flip_texcoord, bool flip_tr) {
-    // clear obj
-    auto asset = std::unique_ptr<obj_scene>(new obj_scene());
+// Token in an OBJ line, pointing into the file contents.
+struct obj_token {
+    const char* str = nullptr;  // token start
+    int len = 0;                // token length
 
-    // open file
-    auto fs = std::fstream(filename, std::ios_base::in);
-    if (!fs) throw std::runtime_error("cannot open filename " + filename);
-    // fs.exceptions(ios_base::failbit);
+    bool operator==(const char* val) const {
+        return !strncmp(str, val, len) && !val[len];
+    }
+    std::string string() const { return std::string(str, len); }
+};
 
-    // initializing obj
-    asset->objects.push_back(new obj_object());
-    asset->objects.back()->groups.push_back(new obj_group());
+// Checks for whitespace within a line.
+inline bool obj_isspace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Parses the next whitespace-separated token of a line.
+inline obj_token parse_obj_token(const char*& str, const char* end) {
+    while (str < end && obj_isspace(*str)) str++;
+    auto tok = obj_token{str, 0};
+    while (str < end && !obj_isspace(*str)) str++;
+    tok.len = (int)(str - tok.str);
+    return tok;
+}
+
+// Parses a float token, returning false if it is not a number. Numbers with
+// few digits are converted exactly, others with strtof, so values are the
+// same as with stream parsing.
+inline bool parse_obj_value(const obj_token& tok, float& val) {
+    static const float pow10[] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    auto str = tok.str, end = tok.str + tok.len;
+    auto neg = false;
+    if (str < end && (*str == '-' || *str == '+')) neg = *str++ == '-';
+    auto mantissa = (uint64_t)0;
+    auto ndigits = 0, exponent = 0;
+    while (str < end && *str >= '0' && *str <= '9') {
+        mantissa = mantissa * 10 + (*str++ - '0');
+        ndigits++;
+    }
+    if (str < end && *str == '.') {
+        str++;
+        while (str < end && *str >= '0' && *str <= '9') {
+            mantissa = mantissa * 10 + (*str++ - '0');
+            ndigits++;
+            exponent--;
+        }
+    }
+    auto fast = ndigits > 0 && ndigits <= 18;
+    if (fast && str < end && (*str == 'e' || *str == 'E')) {
+        str++;
+        auto eneg = false;
+        if (str < end && (*str == '-' || *str == '+')) eneg = *str++ == '-';
+        auto eval = 0;
+        if (str == end) fast = false;
+        while (str < end && *str >= '0' && *str <= '9' && eval < 10000)
+            eval = eval * 10 + (*str++ - '0');
+        exponent += (eneg) ? -eval : eval;
+    }
+    if (fast && str == end && mantissa <= (1 << 24) && exponent >= -10 &&
+        exponent <= 10) {
+        auto fval = (float)mantissa;
+        fval = (exponent < 0) ? fval / pow10[-exponent] :
+                                fval * pow10[exponent];
+        val = (neg) ? -fval : fval;
+        return true;
+    }
+    // fall back to the C library for the remaining cases
+    char buf[128];
+    auto len = min(tok.len, (int)sizeof(buf) - 1);
+    memcpy(buf, tok.str, len);
+    buf[len] = 0;
+    auto bend = (char*)nullptr;
+    val = strtof(buf, &bend);
+    if (bend == buf) {
+        val = 0;
+        return false;
+    }
+    // as with streams, nan and inf are not numbers and overflows saturate
+    if (!std::isfinite(val)) {
+        auto digit = (buf[0] == '-' || buf[0] == '+') ? buf[1] : buf[0];
+        auto number = (digit >= '0' && digit <= '9') || digit == '.';
+        val = (!number) ? 0 : (val < 0) ? -flt_max : flt_max;
+        return false;
+    }
+    return true;
+}
 
-    // current parsing value
-    auto matname = std::string();
-    auto mtllibs = std::vector<std::string>();
-    auto object = asset->objects.back();
-    auto group = object->groups.back();
-    auto elems = std::vector<obj_vertex>();
+// Parses up to N floats. As with streams, missing values are left unchanged
+// and parsing stops at the first value that is not a number.
+template <int N>
+inline void parse_obj_value(
+    const char*& str, const char* end, vec<float, N>& val) {
+    for (auto i = 0; i < N; i++) {
+        auto tok = parse_obj_token(str, end);
+        if (!tok.len || !parse_obj_value(tok, val[i])) return;
+    }
+}
+
+// Parses an integer as atoi().
+inline int parse_obj_int(const char* str, const char* end) {
+    auto neg = false;
+    if (str < end && (*str == '-' || *str == '+')) neg = *str++ == '-';
+    auto val = 0;
+    while (str < end && *str >= '0' && *str <= '9')
+        val = val * 10 + (*str++ - '0');
+    return (neg) ? -val : val;
+}
+
+// Parsing operation in an OBJ chunk, either a line that changes the parsing
+// state or a range of elements.
+struct obj_chunk_op {
+    const char* line = nullptr;      // state line, or null for elements
+    const char* line_end = nullptr;  // state line end
+    int elem_start = 0, elem_end = 0;  // elements range
+};
 
+// Parsed contents of a line-aligned chunk of an OBJ file. Since the state
+// at the chunk start is not known, state lines are kept to be replayed in
+// order when merging and relative indices are fixed after counting the
+// vertices of the previous chunks.
+struct obj_chunk {
+    std::vector<vec3f> pos;        // vertex positions
+    std::vector<vec3f> norm;       // vertex normals
+    std::vector<vec2f> texcoord;   // vertex texcoords
+    std::vector<vec4f> color;      // vertex colors
+    std::vector<float> radius;     // vertex radius
+    std::vector<obj_vertex> verts;  // element vertices
+    std::vector<obj_element> elems;  // elements
+    std::vector<int> relative;  // relative indices, as vertex * 5 + component
+    std::vector<obj_chunk_op> ops;  // operations in order
+};
+
+// Parses the lines in [start,end) into a chunk.
+void parse_obj_chunk(
+    const char* start, const char* end, obj_chunk& chunk, bool flip_texcoord) {
     // keep track of array lengths
     auto vert_size = obj_vertex{0, 0, 0, 0, 0};
 
-    // elem type map
-    static auto elem_type_map =
-        std::unordered_map<std::string, obj_element_type>{
-            {"f", obj_element_type::face}, {"l", obj_element_type::line},
-            {"p", obj_element_type::point}, {"b", obj_element_type::bezier}};
-
-    // read the file line by line
-    std::string line;
-    auto linenum = 0;
-    while (getline(fs, line)) {
+    // read the chunk line by line, tokenizing in place
+    auto line_start = start;
+    while (line_start < end) {
         // prepare to parse
-        linenum += 1;
-        auto ss = std::stringstream(line);
-        auto cmd = std::string();
-        ss >> cmd;
+        auto line_end =
+            (const char*)memchr(line_start, '\n', end - line_start);
+        if (!line_end) line_end = end;
+        auto str = line_start;
+        line_start = line_end + 1;
+        auto cmd = parse_obj_token(str, line_end);
 
         // skip empty and comments
-        if (cmd.empty() || cmd[0] == '#') continue;
+        if (!cmd.len || cmd.str[0] == '#') continue;
 
         // possible token values
         if (cmd == "v") {
             vert_size.pos += 1;
-            asset->pos.push_back(zero3f);
-            ss >> asset->pos.back();
+            chunk.pos.push_back(zero3f);
+            parse_obj_value(str, line_end, chunk.pos.back());
         } else if (cmd == "vn") {
             vert_size.norm += 1;
-            asset->norm.push_back(zero3f);
-            ss >> asset->norm.back();
+            chunk.norm.push_back(zero3f);
+            parse_obj_value(str, line_end, chunk.norm.back());
         } else if (cmd == "vt") {
             vert_size.texcoord += 1;
-            asset->texcoord.push_back(zero2f);
-            ss >> asset->texcoord.back();
+            chunk.texcoord.push_back(zero2f);
+            parse_obj_value(str, line_end, chunk.texcoord.back());
             if (flip_texcoord)
-                asset->texcoord.back().y = 1 - asset->texcoord.back().y;
+                chunk.texcoord.back().y = 1 - chunk.texcoord.back().y;
         } else if (cmd == "vc") {
             vert_size.color += 1;
-            asset->color.push_back(vec4f{0, 0, 0, 1});
-            ss >> asset->color.back();
+            chunk.color.push_back(vec4f{0, 0, 0, 1});
+            parse_obj_value(str, line_end, chunk.color.back());
         } else if (cmd == "vr") {
             vert_size.radius += 1;
-            asset->radius.push_back(0);
-            ss >> asset->radius.back();
+            chunk.radius.push_back(0);
+            auto radius = vec1f{0};
+            parse_obj_value(str, line_end, radius);
+            chunk.radius.back() = radius.x;
         } else if (cmd == "f" || cmd == "l" || cmd == "p" || cmd == "b") {
-            group->elems.push_back(
-                {(uint32_t)group->verts.size(), elem_type_map.at(cmd), 0});
+            auto type = obj_element_type::face;
+            switch (cmd.str[0]) {
+                case 'l': type = obj_element_type::line; break;
+                case 'p': type = obj_element_type::point; break;
+                case 'b': type = obj_element_type::bezier; break;
+            }
+            if (chunk.ops.empty() || chunk.ops.back().line) {
+                chunk.ops.push_back({});
+                chunk.ops.back().elem_start = (int)chunk.elems.size();
+            }
+            chunk.elems.push_back({(uint32_t)chunk.verts.size(), type, 0});
             while (true) {
-                auto tok = std::string();
-                ss >> tok;
-                if (tok.empty()) break;
-                auto toks = split(tok, "/");
-                if (toks.empty()) break;
+                auto tok = parse_obj_token(str, line_end);
+                if (!tok.len) break;
                 auto vert = obj_vertex{-1, -1, -1, -1, -1};
                 auto v = &vert.pos;
                 auto vs = &vert_size.pos;
-                for (auto i = 0; i < min(5, (int)toks.size()); i++) {
-                    if (toks[i].empty()) continue;
-                    v[i] = (int)atoi(toks[i].c_str());
-                    v[i] = (v[i] < 0) ? vs[i] + v[i] : v[i] - 1;
+                auto tstr = tok.str, tend = tok.str + tok.len;
+                for (auto i = 0; i < 5 && tstr < tend; i++) {
+                    auto sep = (const char*)memchr(tstr, '/', tend - tstr);
+                    if (!sep) sep = tend;
+                    if (sep > tstr) {
+                        v[i] = parse_obj_int(tstr, sep);
+                        if (v[i] < 0) {
+                            v[i] = vs[i] + v[i];
+                            chunk.relative.push_back(
+                                (int)chunk.verts.size() * 5 + i);
+                        } else {
+                            v[i] = v[i] - 1;
+                        }
+                    }
+                    tstr = sep + 1;
                 }
-                group->verts.push_back(vert);
-                group->elems.back().size += 1;
-            }
-        } else if (cmd == "o") {
-            asset->objects.push_back(new obj_object());
-            object = asset->objects.back();
-            ss >> object->name;
-            object->groups.push_back(new obj_group());
-            group = object->groups.back();
-            group->matname = matname;
-        } else if (cmd == "usemtl") {
-            ss >> matname;
-            object->groups.push_back(new obj_group());
-            group = object->groups.back();
-            group->matname = matname;
-        } else if (cmd == "g") {
-            object->groups.push_back(new obj_group());
-            group = object->groups.back();
-            ss >> group->groupname;
-            group->matname = matname;
-        } else if (cmd == "s") {
-            auto name = std::string();
-            ss >> name;
-            auto smoothing = (name == "on");
-            if (group->smoothing != smoothing) {
-                auto gname = group->groupname;
+                chunk.verts.push_back(vert);
+                chunk.elems.back().size += 1;
+            }
+            chunk.ops.back().elem_end = (int)chunk.elems.size();
+        } else if (cmd == "o" || cmd == "usemtl" || cmd == "g" || cmd == "s" ||
+                   cmd == "gp" || cmd == "op" || cmd == "mtllib" ||
+                   cmd == "c" || cmd == "e" || cmd == "n") {
+            chunk.ops.push_back({cmd.str, line_end});
+        } else {
+            // unused
+        }
+    }
+}
+
+// Loads an OBJ
+obj_scene* load_obj(const std::string& filename, bool load_txt,
+    bool skip_missing, bool flip_texcoord, bool flip_tr) {
+    // clear obj
+    auto asset = std::unique_ptr<obj_scene>(new obj_scene());
+
+    // open file
+    auto view = file_view();
+    open_file_view(view, filename);
+
+    // split the file in line-aligned chunks, parsed in parallel for large
+    // files
+    auto nchunks = 1;
+    if (view.size > (1 << 20))
+        nchunks = max(1, (int)std::thread::hardware_concurrency());
+    auto chunk_starts = std::vector<const char*>{view.data};
+    for (auto cid = 1; cid < nchunks; cid++) {
+        auto cstart = view.data + view.size * cid / nchunks;
+        if (cstart < chunk_starts.back()) cstart = chunk_starts.back();
+        auto nl =
+            (const char*)memchr(cstart, '\n', view.data + view.size - cstart);
+        chunk_starts.push_back((nl) ? nl + 1 : view.data + view.size);
+    }
+    chunk_starts.push_back(view.data + view.size);
+    auto chunks = std::vector<obj_chunk>(nchunks);
+    if (nchunks == 1) {
+        parse_obj_chunk(chunk_starts[0], chunk_starts[1], chunks[0],
+            flip_texcoord);
+    } else {
+        auto threads = std::vector<std::thread>();
+        for (auto cid = 0; cid < nchunks; cid++) {
+            threads.push_back(std::thread([&, cid]() {
+                parse_obj_chunk(chunk_starts[cid], chunk_starts[cid + 1],
+                    chunks[cid], flip_texcoord);
+            }));
+        }
+        for (auto& t : threads) t.join();
+    }
+
+    // merge vertex data and fix relative indices
+    auto vert_size = obj_vertex{0, 0, 0, 0, 0};
+    for (auto& chunk : chunks) {
+        for (auto idx : chunk.relative) {
+            (&chunk.verts[idx / 5].pos)[idx % 5] += (&vert_size.pos)[idx % 5];
+        }
+        vert_size.pos += (int)chunk.pos.size();
+        vert_size.texcoord += (int)chunk.texcoord.size();
+        vert_size.norm += (int)chunk.norm.size();
+        vert_size.color += (int)chunk.color.size();
+        vert_size.radius += (int)chunk.radius.size();
+    }
+    auto merge_vertex = [&chunks](auto& vals, auto member) {
+        auto size = (size_t)0;
+        for (auto& chunk : chunks) size += (chunk.*member).size();
+        vals.reserve(size);
+        for (auto& chunk : chunks) {
+            vals.insert(
+                vals.end(), (chunk.*member).begin(), (chunk.*member).end());
+            (chunk.*member) = {};
+        }
+    };
+    merge_vertex(asset->pos, &obj_chunk::pos);
+    merge_vertex(asset->norm, &obj_chunk::norm);
+    merge_vertex(asset->texcoord, &obj_chunk::texcoord);
+    merge_vertex(asset->color, &obj_chunk::color);
+    merge_vertex(asset->radius, &obj_chunk::radius);
+
+    // initializing obj
+    asset->objects.push_back(new obj_object());
+    asset->objects.back()->groups.push_back(new obj_group());
+
+    // current parsing value
+    auto matname = std::string();
+    auto mtllibs = std::vector<std::string>();
+    auto object = asset->objects.back();
+    auto group = object->groups.back();
+
+    // replay the chunk operations in order
+    for (auto& chunk : chunks) {
+        for (auto& op : chunk.ops) {
+            // add elements to the current group
+            if (!op.line) {
+                auto vstart = chunk.elems[op.elem_start].start;
+                auto vend = (op.elem_end < (int)chunk.elems.size()) ?
+                                chunk.elems[op.elem_end].start :
+                                (uint32_t)chunk.verts.size();
+                auto offset = (uint32_t)group->verts.size() - vstart;
+                for (auto eid = op.elem_start; eid < op.elem_end; eid++) {
+                    group->elems.push_back(chunk.elems[eid]);
+                    group->elems.back().start += offset;
+                }
+                group->verts.insert(group->verts.end(),
+                    chunk.verts.begin() + vstart, chunk.verts.begin() + vend);
+                continue;
+            }
+
+            // update the state
+            auto str = op.line, line_end = op.line_end;
+            auto cmd = parse_obj_token(str, line_end);
+            if (cmd == "o") {
+                asset->objects.push_back(new obj_object());
+                object = asset->objects.back();
+                object->name = parse_obj_token(str, line_end).string();
+                object->groups.push_back(new obj_group());
+                group = object->groups.back();
+                group->matname = matname;
+            } else if (cmd == "usemtl") {
+                matname = parse_obj_token(str, line_end).string();
                 object->groups.push_back(new obj_group());
                 group = object->groups.back();
                 group->matname = matname;
-                group->groupname = gname;
-                group->smoothing = smoothing;
+            } else if (cmd == "g") {
+                object->groups.push_back(new obj_group());
+                group = object->groups.back();
+                group->groupname = parse_obj_token(str, line_end).string();
+                group->matname = matname;
+            } else if (cmd == "s") {
+                auto smoothing = parse_obj_token(str, line_end) == "on";
+                if (group->smoothing != smoothing) {
+                    auto gname = group->groupname;
+                    object->groups.push_back(new obj_group());
+                    group = object->groups.back();
+                    group->matname = matname;
+                    group->groupname = gname;
+                    group->smoothing = smoothing;
+                }
+            } else if (cmd == "gp" || cmd == "op") {
+                auto name = parse_obj_token(str, line_end).string();
+                auto& props = (cmd == "gp") ? group->props[name] :
+                                              object->props[name];
+                while (true) {
+                    auto tok = parse_obj_token(str, line_end);
+                    if (!tok.len) break;
+                    props.push_back(tok.string());
+                }
+            } else if (cmd == "mtllib") {
+                mtllibs.push_back(parse_obj_token(str, line_end).string());
+            } else {
+                // rare extensions are parsed with streams
+                auto ss = std::stringstream(std::string(str, line_end));
+                if (cmd == "c") {
+                    auto cam = new obj_camera();
+                    ss >> cam->name >> cam->ortho >> cam->yfov >>
+                        cam->aspect >> cam->aperture >> cam->focus >>
+                        cam->frame;
+                    asset->cameras.push_back(cam);
+                } else if (cmd == "e") {
+                    auto env = new obj_environment();
+                    ss >> env->name >> env->matname >> env->frame;
+                    asset->environments.push_back(env);
+                } else if (cmd == "n") {
+                    auto nde = new obj_node();
+                    ss >> nde->name >> nde->parent >> nde->camname >>
+                        nde->objname >> nde->envname >> nde->frame >>
+                        nde->translation >> nde->rotation >> nde->scaling;
+                    if (nde->parent == "\"\"") nde->parent = "";
+                    if (nde->camname == "\"\"") nde->camname = "";
+                    if (nde->objname == "\"\"") nde->objname = "";
+                    if (nde->envname == "\"\"") nde->envname = "";
+                    asset->nodes.push_back(nde);
+                }
             }
-        } else if (cmd == "gp") {
-            auto name = std::string();
-            ss >> name;
-            while (true) {
-                auto tok = std::string();
-                ss >> tok;
-                if (tok.empty()) break;
-                group->props[name].push_back(tok);
-            }
-        } else if (cmd == "op") {
-            auto name = std::string();
-            ss >> name;
-            while (true) {
-                auto tok = std::string();
-                ss >> tok;
-                if (tok.empty()) break;
-                object->props[name].push_back(tok);
-            }
-        } else if (cmd == "mtllib") {
-            mtllibs.push_back("");
-            ss >> mtllibs.back();
-        } else if (cmd == "c") {
-            auto cam = new obj_camera();
-            ss >> cam->name >> cam->ortho >> cam->yfov >> cam->aspect >>
-                cam->aperture >> cam->focus >> cam->frame;
-            asset->cameras.push_back(cam);
-        } else if (cmd == "e") {
-            auto env = new obj_environment();
-            ss >> env->name >> env->matname >> env->frame;
-            asset->environments.push_back(env);
-        } else if (cmd == "n") {
-            auto nde = new obj_node();
-            ss >> nde->name >> nde->parent >> nde->camname >> nde->objname >>
-                nde->envname >> nde->frame >> nde->translation >>
-                nde->rotation >> nde->scaling;
-            if (nde->parent == "\"\"") nde->parent = "";
-            if (nde->camname == "\"\"") nde->camname = "";
-            if (nde->objname == "\"\"") nde->objname = "";
-            if (nde->envname == "\"\"") nde->envname = "";
-            asset->nodes.push_back(nde);
-        } else {
-            // unused
         }
+        chunk = obj_chunk();
     }
 
     // cleanup unused
@@ -7207,75 +9152,240 @@ obj_scene* load_obj(const std::string& filename, bool load_txt,
     return asset.release();
 }
 
-// write to stream
-inline std::ostream& operator<<(std::ostream& os, const obj_texture_info& v) {
-    for (auto&& kv : v.props) {
-        os << kv.first << ' ';
-        for (auto&& vv : kv.second) os << vv << ' ';
+// Formats an integer in decimal. Returns the number of characters written.
+inline int format_int(char* buf, int val) {
+    auto uval = (val < 0) ? -(unsigned)val : (unsigned)val;
+    char digits[16];
+    auto ndigits = 0;
+    do {
+        digits[ndigits++] = '0' + uval % 10;
+        uval /= 10;
+    } while (uval);
+    auto len = 0;
+    if (val < 0) buf[len++] = '-';
+    while (ndigits) buf[len++] = digits[--ndigits];
+    return len;
+}
+
+// Formats a float as printf("%.*g"), that is also the default output of
+// std::ostream for precision 6. Returns the number of characters written to
+// buf, that should hold at least 32 characters. The digits are computed in
+// double precision and values too close to a rounding tie go to snprintf,
+// so that the output is always the correctly rounded one.
+inline int format_float(char* buf, float val, int precision) {
+    static const auto pow10 = []() {
+        auto vals = std::array<double, 128>();
+        for (auto i = 0; i < 128; i++)
+            vals[i] = std::strtod(("1e" + std::to_string(i - 64)).c_str(),
+                nullptr);
+        return vals;
+    }();
+    if (!std::isfinite(val) || precision < 1 || precision > 9)
+        return snprintf(buf, 32, "%.*g", clamp(precision, 1, 9), val);
+    auto len = 0;
+    if (std::signbit(val)) buf[len++] = '-';
+    if (val == 0) {
+        buf[len++] = '0';
+        return len;
+    }
+
+    // scale to precision digits, fixing the estimated exponent if off by one
+    auto x = std::fabs((double)val);
+    auto exp = (int)std::floor(std::log10(x));
+    auto scaled = x * pow10[64 + precision - 1 - exp];
+    if (scaled >= pow10[64 + precision]) {
+        exp += 1;
+        scaled = x * pow10[64 + precision - 1 - exp];
+    } else if (scaled < pow10[64 + precision - 1]) {
+        exp -= 1;
+        scaled = x * pow10[64 + precision - 1 - exp];
+    }
+    auto mant = std::floor(scaled);
+    auto frac = scaled - mant;
+    if (std::fabs(frac - 0.5) < 1e-5)
+        return snprintf(buf, 32, "%.*g", precision, val);
+    auto digits = (long long)mant + ((frac > 0.5) ? 1 : 0);
+    if (digits >= (long long)pow10[64 + precision]) {
+        digits /= 10;
+        exp += 1;
+    }
+
+    // decimal digits without trailing zeros
+    char dbuf[16];
+    auto ndigits = precision;
+    for (auto i = precision - 1; i >= 0; i--) {
+        dbuf[i] = '0' + digits % 10;
+        digits /= 10;
+    }
+    while (ndigits > 1 && dbuf[ndigits - 1] == '0') ndigits--;
+
+    if (exp < -4 || exp >= precision) {
+        buf[len++] = dbuf[0];
+        if (ndigits > 1) {
+            buf[len++] = '.';
+            for (auto i = 1; i < ndigits; i++) buf[len++] = dbuf[i];
+        }
+        buf[len++] = 'e';
+        buf[len++] = (exp < 0) ? '-' : '+';
+        auto aexp = (exp < 0) ? -exp : exp;
+        if (aexp < 10) buf[len++] = '0';
+        len += format_int(buf + len, aexp);
+    } else if (exp >= 0) {
+        for (auto i = 0; i <= exp; i++)
+            buf[len++] = (i < ndigits) ? dbuf[i] : '0';
+        if (ndigits > exp + 1) {
+            buf[len++] = '.';
+            for (auto i = exp + 1; i < ndigits; i++) buf[len++] = dbuf[i];
+        }
+    } else {
+        buf[len++] = '0';
+        buf[len++] = '.';
+        for (auto i = 0; i < -exp - 1; i++) buf[len++] = '0';
+        for (auto i = 0; i < ndigits; i++) buf[len++] = dbuf[i];
+    }
+    return len;
+}
+
+// Text buffer for OBJ, MTL and streamed glTF output. Numbers are formatted
+// by hand since stream insertion dominates the save time of large meshes.
+struct text_writer {
+    std::string text;
+    int precision = 6;
+
+    void write(char c) { text.push_back(c); }
+    void write(const char* str) { text.append(str); }
+    void write(const std::string& str) { text.append(str); }
+    void write(bool val) { text.push_back((val) ? '1' : '0'); }
+    void write(int val) {
+        char buf[16];
+        text.append(buf, format_int(buf, val));
+    }
+    void write(float val) {
+        char buf[32];
+        text.append(buf, format_float(buf, val, precision));
+    }
+    template <int N>
+    void write(const vec<float, N>& val) {
+        for (auto i = 0; i < N; i++) {
+            if (i) write(' ');
+            write(data(val)[i]);
+        }
+    }
+    void write(const quat4f& val) {
+        for (auto i = 0; i < 4; i++) {
+            if (i) write(' ');
+            write(data(val)[i]);
+        }
+    }
+    void write(const frame3f& val) {
+        for (auto i = 0; i < 4; i++) {
+            if (i) write(' ');
+            write(val[i]);
+        }
+    }
+
+    // write an OBJ vertex using only the indices that are active
+    void write(const obj_vertex& vert) {
+        auto vert_ptr = &vert.pos;
+        auto nto_write = 0;
+        for (auto i = 0; i < 5; i++) {
+            if (vert_ptr[i] >= 0) nto_write = i + 1;
+        }
+        for (auto i = 0; i < nto_write; i++) {
+            if (i) write('/');
+            if (vert_ptr[i] >= 0) write(vert_ptr[i] + 1);
+        }
     }
-    if (v.clamp) os << "-clamp on ";
-    os << v.path;
-    return os;
-}
 
-// write an OBJ vertex using only the indices that are active
-inline std::ostream& operator<<(std::ostream& os, const obj_vertex& vert) {
-    auto vert_ptr = &vert.pos;
-    auto nto_write = 0;
-    for (auto i = 0; i < 5; i++) {
-        if (vert_ptr[i] >= 0) nto_write = i + 1;
+    void write(const obj_texture_info& info) {
+        for (auto&& kv : info.props) {
+            write(kv.first, ' ');
+            for (auto&& v : kv.second) write(v, ' ');
+        }
+        if (info.clamp) write("-clamp on ");
+        write(info.path);
+    }
+
+    // write a quoted json string
+    void write_json(const std::string& str) {
+        write('"');
+        for (auto c : str) {
+            if (c == '"' || c == '\\') {
+                write('\\');
+                write(c);
+            } else if ((unsigned char)c < 0x20) {
+                char buf[8];
+                text.append(buf, snprintf(buf, 8, "\\u%04x", (int)c));
+            } else {
+                write(c);
+            }
+        }
+        write('"');
     }
-    for (auto i = 0; i < nto_write; i++) {
-        if (i) os << '/';
-        if (vert_ptr[i] >= 0) os << vert_ptr[i] + 1;
+
+    template <typename T1, typename T2, typename... Ts>
+    void write(const T1& val1, const T2& val2, const Ts&... vals) {
+        write(val1);
+        write(val2, vals...);
     }
-    return os;
-}
+
+    // appends the text to a file and clears it
+    void flush(FILE* fs, const std::string& filename) {
+        if (!text.empty() && fwrite(text.data(), 1, text.size(), fs) !=
+                                 text.size())
+            throw std::runtime_error("cannot write file " + filename);
+        text.clear();
+    }
+};
 
 // Save an MTL file
 void save_mtl(const std::string& filename,
-    const std::vector<obj_material*>& materials, bool flip_tr) {
+    const std::vector<obj_material*>& materials, bool flip_tr, int precision) {
     // open file
-    auto fs = std::fstream(filename, std::ios_base::out);
+    auto fs = fopen(filename.c_str(), "wb");
     if (!fs) throw std::runtime_error("cannot open filename " + filename);
-    fs.exceptions(std::ios_base::failbit);
+    auto fs_guard = std::unique_ptr<FILE, int (*)(FILE*)>(fs, fclose);
+    auto w = text_writer();
+    w.precision = precision;
 
     // for each material, dump all the values
     for (auto mat : materials) {
-        fs << "newmtl " << mat->name << '\n';
-        fs << "  illum " << mat->illum << '\n';
-        if (mat->ke != zero3f) fs << "  Ke " << mat->ke << '\n';
-        if (mat->ka != zero3f) fs << "  Ka " << mat->ka << '\n';
-        if (mat->kd != zero3f) fs << "  Kd " << mat->kd << '\n';
-        if (mat->ks != zero3f) fs << "  Ks " << mat->ks << '\n';
-        if (mat->kr != zero3f) fs << "  Kr " << mat->kr << '\n';
-        if (mat->kt != zero3f) fs << "  Kt " << mat->kt << '\n';
-        if (mat->kt != zero3f) fs << "  Tf " << mat->kt << '\n';
-        if (mat->ns != 0.0f) fs << "  Ns " << mat->ns << '\n';
-        if (mat->op != 1.0f) fs << "  d " << mat->op << '\n';
-        if (mat->ior != 0.0f) fs << "  Ni " << mat->ior << '\n';
-        if (mat->ke_txt.path != "") fs << "  map_Ke " << mat->ke_txt << '\n';
-        if (mat->ka_txt.path != "") fs << "  map_Ka " << mat->ka_txt << '\n';
-        if (mat->kd_txt.path != "") fs << "  map_Kd " << mat->kd_txt << '\n';
-        if (mat->ks_txt.path != "") fs << "  map_Ks " << mat->ks_txt << '\n';
-        if (mat->kr_txt.path != "") fs << "  map_Kr " << mat->kr_txt << '\n';
-        if (mat->kt_txt.path != "") fs << "  map_Kt " << mat->kt_txt << '\n';
-        if (mat->ns_txt.path != "") fs << "  map_Ns " << mat->ns_txt << '\n';
-        if (mat->op_txt.path != "") fs << "  map_d  " << mat->op_txt << '\n';
-        if (mat->ior_txt.path != "") fs << "  map_Ni " << mat->ior_txt << '\n';
+        w.write("newmtl ", mat->name, '\n');
+        w.write("  illum ", mat->illum, '\n');
+        if (mat->ke != zero3f) w.write("  Ke ", mat->ke, '\n');
+        if (mat->ka != zero3f) w.write("  Ka ", mat->ka, '\n');
+        if (mat->kd != zero3f) w.write("  Kd ", mat->kd, '\n');
+        if (mat->ks != zero3f) w.write("  Ks ", mat->ks, '\n');
+        if (mat->kr != zero3f) w.write("  Kr ", mat->kr, '\n');
+        if (mat->kt != zero3f) w.write("  Kt ", mat->kt, '\n');
+        if (mat->kt != zero3f) w.write("  Tf ", mat->kt, '\n');
+        if (mat->ns != 0.0f) w.write("  Ns ", mat->ns, '\n');
+        if (mat->op != 1.0f) w.write("  d ", mat->op, '\n');
+        if (mat->ior != 0.0f) w.write("  Ni ", mat->ior, '\n');
+        if (mat->ke_txt.path != "") w.write("  map_Ke ", mat->ke_txt, '\n');
+        if (mat->ka_txt.path != "") w.write("  map_Ka ", mat->ka_txt, '\n');
+        if (mat->kd_txt.path != "") w.write("  map_Kd ", mat->kd_txt, '\n');
+        if (mat->ks_txt.path != "") w.write("  map_Ks ", mat->ks_txt, '\n');
+        if (mat->kr_txt.path != "") w.write("  map_Kr ", mat->kr_txt, '\n');
+        if (mat->kt_txt.path != "") w.write("  map_Kt ", mat->kt_txt, '\n');
+        if (mat->ns_txt.path != "") w.write("  map_Ns ", mat->ns_txt, '\n');
+        if (mat->op_txt.path != "") w.write("  map_d  ", mat->op_txt, '\n');
+        if (mat->ior_txt.path != "")
+            w.write("  map_Ni ", mat->ior_txt, '\n');
         if (mat->bump_txt.path != "")
-            fs << "  map_bump " << mat->bump_txt << '\n';
+            w.write("  map_bump ", mat->bump_txt, '\n');
         if (mat->disp_txt.path != "")
-            fs << "  map_disp " << mat->disp_txt << '\n';
+            w.write("  map_disp ", mat->disp_txt, '\n');
         if (mat->norm_txt.path != "")
-            fs << "  map_norm " << mat->norm_txt << '\n';
+            w.write("  map_norm ", mat->norm_txt, '\n');
         for (auto&& kv : mat->props) {
-            fs << "  " << kv.first;
-            for (auto&& v : kv.second) fs << " " << v;
-            fs << '\n';
+            w.write("  ", kv.first);
+            for (auto&& v : kv.second) w.write(' ', v);
+            w.write('\n');
         }
-        fs << '\n';
+        w.write('\n');
     }
+    w.flush(fs, filename);
 }
 
 // Loads textures for an scene.
@@ -7306,90 +9416,147 @@ void save_textures(
 
 // Save an OBJ
 void save_obj(const std::string& filename, const obj_scene* asset,
-    bool save_txt, bool skip_missing, bool flip_texcoord, bool flip_tr) {
+    bool save_txt, bool skip_missing, bool flip_texcoord, bool flip_tr,
+    int precision) {
     // open file
-    auto fs = std::fstream(filename, std::ios_base::out);
+    auto fs = fopen(filename.c_str(), "wb");
     if (!fs) throw std::runtime_error("cannot open filename " + filename);
-    fs.exceptions(std::ios_base::failbit);
+    auto fs_guard = std::unique_ptr<FILE, int (*)(FILE*)>(fs, fclose);
+
+    // the file is split in blocks of text that are formatted independently
+    // and written in order
+    auto blocks = std::vector<std::function<void(text_writer&)>>();
+    auto block_size = 1 << 16;
+    auto add_blocks = [&blocks, block_size](int num, const auto& func) {
+        for (auto start = 0; start < num; start += block_size) {
+            auto end = min(start + block_size, num);
+            blocks.push_back([start, end, func](text_writer& w) {
+                for (auto idx = start; idx < end; idx++) func(w, idx);
+            });
+        }
+    };
 
     // linkup to mtl
     auto dirname = path_dirname(filename);
     auto basename = filename.substr(dirname.length());
     basename = basename.substr(0, basename.length() - 4);
-    if (!asset->materials.empty()) {
-        fs << "mtllib " << basename << ".mtl" << '\n';
-    }
+    blocks.push_back([asset, &basename](text_writer& w) {
+        if (!asset->materials.empty()) {
+            w.write("mtllib ", basename, ".mtl", '\n');
+        }
 
-    // save cameras
-    for (auto cam : asset->cameras) {
-        fs << "c " << ' ' << cam->name << ' ' << cam->ortho << ' ' << cam->yfov
-           << ' ' << cam->aspect << ' ' << cam->aperture << ' ' << cam->focus
-           << ' ' << cam->frame << '\n';
-    }
+        // save cameras
+        for (auto cam : asset->cameras) {
+            w.write("c ", ' ', cam->name, ' ', cam->ortho, ' ', cam->yfov, ' ',
+                cam->aspect, ' ', cam->aperture, ' ', cam->focus, ' ',
+                cam->frame, '\n');
+        }
 
-    // save envs
-    for (auto env : asset->environments) {
-        fs << "e " << env->name << ' ' << env->matname << ' ' << env->frame
-           << '\n';
-    }
+        // save envs
+        for (auto env : asset->environments) {
+            w.write("e ", env->name, ' ', env->matname, ' ', env->frame, '\n');
+        }
 
-    // save nodes
-    for (auto nde : asset->nodes) {
-        fs << "n " << nde->name << ' '
-           << ((nde->parent.empty()) ? "\"\""s : nde->parent) << ' '
-           << ((nde->camname.empty()) ? "\"\""s : nde->camname) << ' '
-           << ((nde->objname.empty()) ? "\"\""s : nde->objname) << ' '
-           << ((nde->envname.empty()) ? "\"\""s : nde->envname) << ' '
-           << nde->frame << ' ' << nde->translation << ' ' << nde->rotation
-           << ' ' << nde->scaling << '\n';
-    }
+        // save nodes
+        for (auto nde : asset->nodes) {
+            w.write("n ", nde->name, ' ',
+                (nde->parent.empty()) ? "\"\""s : nde->parent, ' ',
+                (nde->camname.empty()) ? "\"\""s : nde->camname, ' ',
+                (nde->objname.empty()) ? "\"\""s : nde->objname, ' ',
+                (nde->envname.empty()) ? "\"\""s : nde->envname, ' ',
+                nde->frame, ' ', nde->translation, ' ', nde->rotation, ' ',
+                nde->scaling, '\n');
+        }
+    });
 
     // save all vertex data
-    for (auto& v : asset->pos) fs << "v " << v << '\n';
-    if (flip_texcoord) {
-        for (auto& v : asset->texcoord)
-            fs << "vt " << vec2f{v.x, 1 - v.y} << '\n';
-    } else {
-        for (auto& v : asset->texcoord) fs << "vt " << v << '\n';
-    }
-    for (auto& v : asset->norm) fs << "vn " << v << '\n';
-    for (auto& v : asset->color) fs << "vc " << v << '\n';
-    for (auto& v : asset->radius) fs << "vr " << v << '\n';
+    add_blocks((int)asset->pos.size(), [asset](text_writer& w, int idx) {
+        w.write("v ", asset->pos[idx], '\n');
+    });
+    add_blocks((int)asset->texcoord.size(),
+        [asset, flip_texcoord](text_writer& w, int idx) {
+            auto& v = asset->texcoord[idx];
+            w.write("vt ", (flip_texcoord) ? vec2f{v.x, 1 - v.y} : v, '\n');
+        });
+    add_blocks((int)asset->norm.size(), [asset](text_writer& w, int idx) {
+        w.write("vn ", asset->norm[idx], '\n');
+    });
+    add_blocks((int)asset->color.size(), [asset](text_writer& w, int idx) {
+        w.write("vc ", asset->color[idx], '\n');
+    });
+    add_blocks((int)asset->radius.size(), [asset](text_writer& w, int idx) {
+        w.write("vr ", asset->radius[idx], '\n');
+    });
 
     // save element data
     static auto elem_labels = std::unordered_map<obj_element_type, std::string>{
         {obj_element_type::point, "p"}, {obj_element_type::line, "l"},
         {obj_element_type::face, "f"}, {obj_element_type::bezier, "b"}};
     for (auto object : asset->objects) {
-        fs << "o " << object->name << '\n';
-        for (auto& kv : object->props) {
-            fs << "op " << kv.first;
-            for (auto& v : kv.second) fs << ' ' << v;
-            fs << '\n';
-        }
+        blocks.push_back([object](text_writer& w) {
+            w.write("o ", object->name, '\n');
+            for (auto& kv : object->props) {
+                w.write("op ", kv.first);
+                for (auto& v : kv.second) w.write(' ', v);
+                w.write('\n');
+            }
+        });
         for (auto group : object->groups) {
-            if (!group->matname.empty())
-                fs << "usemtl " << group->matname << '\n';
-            if (!group->groupname.empty())
-                fs << "g " << group->groupname << '\n';
-            if (!group->smoothing) fs << "s off" << '\n';
-            for (auto& kv : group->props) {
-                fs << "gp " << kv.first;
-                for (auto& v : kv.second) fs << ' ' << v;
-                fs << '\n';
-            }
-            for (auto elem : group->elems) {
-                fs << elem_labels.at(elem.type) << ' ';
+            blocks.push_back([group](text_writer& w) {
+                if (!group->matname.empty())
+                    w.write("usemtl ", group->matname, '\n');
+                if (!group->groupname.empty())
+                    w.write("g ", group->groupname, '\n');
+                if (!group->smoothing) w.write("s off", '\n');
+                for (auto& kv : group->props) {
+                    w.write("gp ", kv.first);
+                    for (auto& v : kv.second) w.write(' ', v);
+                    w.write('\n');
+                }
+            });
+            add_blocks((int)group->elems.size(), [group](text_writer& w,
+                                                     int idx) {
+                auto& elem = group->elems[idx];
+                w.write(elem_labels.at(elem.type), ' ');
                 for (auto i = elem.start; i < elem.start + elem.size; i++)
-                    fs << group->verts[i] << ' ';
-                fs << '\n';
+                    w.write(group->verts[i], ' ');
+                w.write('\n');
+            });
+        }
+    }
+
+    // format the blocks in batches, in parallel, so that only a batch of text
+    // is kept in memory
+    auto nthreads = max(1, (int)std::thread::hardware_concurrency());
+    auto writers = std::vector<text_writer>(nthreads * 4);
+    for (auto& w : writers) w.precision = precision;
+    for (auto bstart = 0; bstart < (int)blocks.size();
+         bstart += (int)writers.size()) {
+        auto nbatch = min((int)writers.size(), (int)blocks.size() - bstart);
+        if (nthreads == 1 || nbatch == 1) {
+            for (auto idx = 0; idx < nbatch; idx++) {
+                blocks[bstart + idx](writers[idx]);
+                writers[idx].flush(fs, filename);
             }
+            continue;
         }
+        std::atomic<int> next(0);
+        auto threads = std::vector<std::thread>();
+        for (auto tid = 0; tid < min(nthreads, nbatch); tid++) {
+            threads.push_back(std::thread([&]() {
+                for (auto idx = next++; idx < nbatch; idx = next++)
+                    blocks[bstart + idx](writers[idx]);
+            }));
+        }
+        for (auto& t : threads) t.join();
+        for (auto idx = 0; idx < nbatch; idx++)
+            writers[idx].flush(fs, filename);
     }
 
     // save materials
     if (!asset->materials.empty())
-        save_mtl(dirname + basename + ".mtl", asset->materials, flip_tr);
+        save_mtl(dirname + basename + ".mtl", asset->materials, flip_tr,
+            precision);
 
     // save textures
     if (save_txt) save_textures(asset, dirname, skip_missing);
@@ -7626,6 +9793,457 @@ void serialize_attr(std::vector<T>& val, json& js, const char* name,
     }
 }
 
+// Pull parser that reads json text directly into the glTF and proc scene
+// objects, without building a json DOM. Values are read by the read_json()
+// overloads, while object keys are dispatched to read_json_attrs().
+struct json_reader {
+    const char* start = nullptr;  // text start, for error offsets
+    const char* str = nullptr;    // current position
+    const char* end = nullptr;    // text end
+};
+
+// Key of the object attribute being read. Attributes are matched by name.
+// After the last key, a checking pass counts the required attributes.
+struct json_key {
+    std::string name;       // attribute name
+    bool found = false;     // whether the attribute was read
+    bool checking = false;  // whether counting the required attributes
+    int required = 0;       // required attributes read
+    int expected = 0;       // required attributes of the object
+};
+
+// Throws a parse error, reporting the offset in the text.
+void throw_json_error(const json_reader& jr, const char* msg) {
+    throw std::runtime_error(std::string(msg) + " at offset " +
+                             std::to_string(jr.str - jr.start));
+}
+
+// Skips whitespace and returns the next character, or 0 at the end.
+inline char peek_json(json_reader& jr) {
+    while (jr.str < jr.end && (*jr.str == ' ' || *jr.str == '\n' ||
+                                  *jr.str == '\r' || *jr.str == '\t'))
+        jr.str++;
+    return (jr.str < jr.end) ? *jr.str : 0;
+}
+
+// Consumes the expected character.
+inline void expect_json(json_reader& jr, char c, const char* msg) {
+    if (peek_json(jr) != c) throw_json_error(jr, msg);
+    jr.str++;
+}
+
+// Consumes a literal such as true, false or null.
+inline bool read_json_literal(json_reader& jr, const char* lit) {
+    auto len = (int)strlen(lit);
+    if (jr.end - jr.str < len || strncmp(jr.str, lit, len)) return false;
+    jr.str += len;
+    return true;
+}
+
+// Checks whether the next value is null, consuming it.
+inline bool read_json_null(json_reader& jr) {
+    return peek_json(jr) == 'n' && read_json_literal(jr, "null");
+}
+
+// Number token, scanned with the json grammar. Integers have no fraction
+// or exponent, as in the DOM.
+struct json_number {
+    const char* str = nullptr;  // token start
+    int len = 0;                // token length
+    bool integer = true;        // whether it is an integer
+    bool neg = false;           // sign
+    uint64_t mantissa = 0;      // digits, if they fit
+    int ndigits = 0;            // number of digits
+    int exponent = 0;           // decimal exponent
+};
+
+// Scans a number token.
+inline json_number scan_json_number(json_reader& jr) {
+    auto isdigit = [](const char* s, const char* end) {
+        return s < end && *s >= '0' && *s <= '9';
+    };
+    peek_json(jr);
+    auto num = json_number();
+    auto s = jr.str, end = jr.end;
+    num.str = s;
+    if (s < end && *s == '-') {
+        num.neg = true;
+        s++;
+    }
+    if (!isdigit(s, end)) throw_json_error(jr, "number expected");
+    auto add_digit = [&num](char c) {
+        if (num.ndigits < 19) num.mantissa = num.mantissa * 10 + (c - '0');
+        num.ndigits++;
+    };
+    if (*s == '0') {
+        s++;
+    } else {
+        while (isdigit(s, end)) add_digit(*s++);
+    }
+    if (s < end && *s == '.') {
+        num.integer = false;
+        s++;
+        if (!isdigit(s, end)) throw_json_error(jr, "number expected");
+        while (isdigit(s, end)) {
+            add_digit(*s++);
+            num.exponent--;
+        }
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        num.integer = false;
+        s++;
+        auto eneg = false;
+        if (s < end && (*s == '-' || *s == '+')) eneg = *s++ == '-';
+        if (!isdigit(s, end)) throw_json_error(jr, "number expected");
+        auto eval = 0;
+        while (isdigit(s, end)) {
+            if (eval < 10000) eval = eval * 10 + (*s - '0');
+            s++;
+        }
+        num.exponent += (eneg) ? -eval : eval;
+    }
+    num.len = (int)(s - num.str);
+    jr.str = s;
+    return num;
+}
+
+// Converts a number to double as strtod(). Up to 15 digits with a small
+// exponent are converted exactly, others fall back to the C library.
+inline double json_number_value(const json_number& num) {
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+        1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+        1e20, 1e21, 1e22};
+    if (num.ndigits <= 15 && num.exponent >= -22 && num.exponent <= 22) {
+        auto val = (double)num.mantissa;
+        val = (num.exponent < 0) ? val / pow10[-num.exponent] :
+                                   val * pow10[num.exponent];
+        return (num.neg) ? -val : val;
+    }
+    return std::strtod(std::string(num.str, num.len).c_str(), nullptr);
+}
+
+// Reads an integer.
+void read_json(int& val, json_reader& jr) {
+    auto num = scan_json_number(jr);
+    if (!num.integer) throw_json_error(jr, "integer expected");
+    if (num.ndigits > 18) throw_json_error(jr, "integer out of range");
+    val = (int)((num.neg) ? -(int64_t)num.mantissa : (int64_t)num.mantissa);
+}
+
+// Reads a float. Integers are converted as in the DOM, so -0 is positive.
+void read_json(float& val, json_reader& jr) {
+    auto num = scan_json_number(jr);
+    if (num.integer && num.ndigits <= 18) {
+        val = (float)((num.neg) ? -(int64_t)num.mantissa :
+                                  (int64_t)num.mantissa);
+    } else {
+        val = (float)json_number_value(num);
+    }
+}
+
+// Reads a bool.
+void read_json(bool& val, json_reader& jr) {
+    auto c = peek_json(jr);
+    if (c == 't' && read_json_literal(jr, "true")) {
+        val = true;
+    } else if (c == 'f' && read_json_literal(jr, "false")) {
+        val = false;
+    } else {
+        throw_json_error(jr, "bool expected");
+    }
+}
+
+// Reads four hex digits of a unicode escape.
+inline uint32_t read_json_hex4(json_reader& jr) {
+    if (jr.end - jr.str < 4) throw_json_error(jr, "bad unicode escape");
+    auto code = (uint32_t)0;
+    for (auto i = 0; i < 4; i++) {
+        auto c = *jr.str++;
+        code <<= 4;
+        if (c >= '0' && c <= '9')
+            code |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            code |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            code |= c - 'A' + 10;
+        else
+            throw_json_error(jr, "bad unicode escape");
+    }
+    return code;
+}
+
+// Reads a string. Strings without escapes, such as long data uris, are
+// copied in one go.
+void read_json(std::string& val, json_reader& jr) {
+    expect_json(jr, '"', "string expected");
+    auto s = jr.str;
+    while (s < jr.end && *s != '"' && *s != '\\' && (unsigned char)*s >= 0x20)
+        s++;
+    val.assign(jr.str, s);
+    jr.str = s;
+    while (true) {
+        if (jr.str >= jr.end) throw_json_error(jr, "unterminated string");
+        auto c = *jr.str++;
+        if (c == '"') return;
+        if ((unsigned char)c < 0x20) {
+            jr.str--;
+            throw_json_error(jr, "control character in string");
+        }
+        if (c != '\\') {
+            val.push_back(c);
+            continue;
+        }
+        if (jr.str >= jr.end) throw_json_error(jr, "unterminated string");
+        switch (*jr.str++) {
+            case '"': val.push_back('"'); break;
+            case '\\': val.push_back('\\'); break;
+            case '/': val.push_back('/'); break;
+            case 'b': val.push_back('\b'); break;
+            case 'f': val.push_back('\f'); break;
+            case 'n': val.push_back('\n'); break;
+            case 'r': val.push_back('\r'); break;
+            case 't': val.push_back('\t'); break;
+            case 'u': {
+                auto code = read_json_hex4(jr);
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    if (!read_json_literal(jr, "\\u"))
+                        throw_json_error(jr, "bad surrogate pair");
+                    auto low = read_json_hex4(jr);
+                    if (low < 0xDC00 || low > 0xDFFF)
+                        throw_json_error(jr, "bad surrogate pair");
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                    throw_json_error(jr, "bad surrogate pair");
+                }
+                if (code < 0x80) {
+                    val.push_back((char)code);
+                } else if (code < 0x800) {
+                    val.push_back((char)(0xC0 | (code >> 6)));
+                    val.push_back((char)(0x80 | (code & 0x3F)));
+                } else if (code < 0x10000) {
+                    val.push_back((char)(0xE0 | (code >> 12)));
+                    val.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+                    val.push_back((char)(0x80 | (code & 0x3F)));
+                } else {
+                    val.push_back((char)(0xF0 | (code >> 18)));
+                    val.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+                    val.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+                    val.push_back((char)(0x80 | (code & 0x3F)));
+                }
+            } break;
+            default: {
+                jr.str--;
+                throw_json_error(jr, "bad escape");
+            }
+        }
+    }
+}
+
+// Iterates over the keys of an object, calling func(key) with the reader
+// positioned at the key value.
+template <typename Func>
+void read_json_keys(json_reader& jr, std::string& key, Func&& func) {
+    expect_json(jr, '{', "object expected");
+    if (peek_json(jr) == '}') {
+        jr.str++;
+        return;
+    }
+    while (true) {
+        read_json(key, jr);
+        expect_json(jr, ':', "':' expected");
+        func(key);
+        auto c = peek_json(jr);
+        jr.str++;
+        if (c == '}') return;
+        if (c != ',') {
+            jr.str--;
+            throw_json_error(jr, "',' or '}' expected");
+        }
+    }
+}
+
+// Iterates over the items of an array, calling func() with the reader
+// positioned at each item.
+template <typename Func>
+void read_json_items(json_reader& jr, Func&& func) {
+    expect_json(jr, '[', "array expected");
+    if (peek_json(jr) == ']') {
+        jr.str++;
+        return;
+    }
+    while (true) {
+        func();
+        auto c = peek_json(jr);
+        jr.str++;
+        if (c == ']') return;
+        if (c != ',') {
+            jr.str--;
+            throw_json_error(jr, "',' or ']' expected");
+        }
+    }
+}
+
+// Skips a value, checking its syntax.
+void skip_json_value(json_reader& jr) {
+    switch (peek_json(jr)) {
+        case '{': {
+            auto key = std::string();
+            read_json_keys(jr, key,
+                [&jr](const std::string&) { skip_json_value(jr); });
+        } break;
+        case '[': read_json_items(jr, [&jr]() { skip_json_value(jr); }); break;
+        case '"': {
+            jr.str++;
+            while (jr.str < jr.end && *jr.str != '"') {
+                if (*jr.str == '\\') jr.str++;
+                jr.str++;
+            }
+            if (jr.str >= jr.end) throw_json_error(jr, "unterminated string");
+            jr.str++;
+        } break;
+        case 't':
+            if (!read_json_literal(jr, "true"))
+                throw_json_error(jr, "bad value");
+            break;
+        case 'f':
+            if (!read_json_literal(jr, "false"))
+                throw_json_error(jr, "bad value");
+            break;
+        case 'n':
+            if (!read_json_literal(jr, "null"))
+                throw_json_error(jr, "bad value");
+            break;
+        default: scan_json_number(jr); break;
+    }
+}
+
+// Reads a json value through the DOM, used for extras and extensions.
+void read_json(json& val, json_reader& jr) {
+    peek_json(jr);
+    auto start = jr.str;
+    skip_json_value(jr);
+    val = json::parse(start, jr.str);
+}
+
+// Reads an optional object.
+template <typename T>
+void read_json(T*& val, json_reader& jr) {
+    if (read_json_null(jr)) {
+        val = nullptr;
+        return;
+    }
+    if (!val) val = new T();
+    read_json(*val, jr);
+}
+
+// Reads an array.
+template <typename T>
+void read_json(std::vector<T>& vals, json_reader& jr) {
+    vals.clear();
+    read_json_items(jr, [&vals, &jr]() {
+        // this is contrived to support for std::vector<bool>
+        auto v = T();
+        read_json(v, jr);
+        vals.push_back(v);
+    });
+}
+
+// Reads a fixed size array.
+template <typename T, size_t N>
+void read_json(std::array<T, N>& vals, json_reader& jr) {
+    auto count = (size_t)0;
+    read_json_items(jr, [&vals, &jr, &count]() {
+        if (count >= N) throw_json_error(jr, "wrong array size");
+        read_json(vals[count++], jr);
+    });
+    if (count != N) throw_json_error(jr, "wrong array size");
+}
+
+// Reads a dictionary.
+template <typename T>
+void read_json(std::map<std::string, T>& vals, json_reader& jr) {
+    auto key = std::string();
+    read_json_keys(jr, key,
+        [&vals, &jr](const std::string& key) { read_json(vals[key], jr); });
+}
+
+// Reads an enum from its table.
+template <typename T, typename T1>
+void read_json(
+    T& val, json_reader& jr, const std::vector<std::pair<T1, T>>& table) {
+    auto v = T1();
+    read_json(v, jr);
+    for (auto& kv : table) {
+        if (kv.first == v) {
+            val = kv.second;
+            return;
+        }
+    }
+    throw_json_error(jr, "bad enum value");
+}
+
+// Reads a vector.
+template <typename T, int N>
+void read_json(vec<T, N>& vals, json_reader& jr) {
+    read_json((std::array<T, N>&)vals, jr);
+}
+
+// Reads a quaternion.
+template <typename T, int N>
+void read_json(quat<T, N>& vals, json_reader& jr) {
+    read_json((std::array<T, N>&)vals, jr);
+}
+
+// Reads a matrix.
+template <typename T, int N>
+void read_json(mat<T, N>& vals, json_reader& jr) {
+    read_json((std::array<T, N * N>&)vals, jr);
+}
+
+// Reads a frame.
+template <typename T, int N>
+void read_json(frame<T, N>& vals, json_reader& jr) {
+    read_json((std::array<T, N*(N + 1)>&)vals, jr);
+}
+
+// Reads an object, dispatching each key to read_json_attrs() and skipping
+// unknown keys as in the DOM path.
+template <typename T>
+void read_json(T& val, json_reader& jr) {
+    auto key = json_key();
+    read_json_keys(jr, key.name, [&val, &jr, &key](const std::string&) {
+        key.found = false;
+        read_json_attrs(val, jr, key);
+        if (!key.found) skip_json_value(jr);
+    });
+    key.found = true;
+    key.checking = true;
+    read_json_attrs(val, jr, key);
+    if (key.required < key.expected) throw_json_error(jr, "missing value");
+}
+
+// Reads an object attribute if the key matches its name.
+template <typename T>
+void read_json_attr(T& val, json_reader& jr, json_key& key, const char* name,
+    bool required = true) {
+    if (key.checking) {
+        if (required) key.expected++;
+        return;
+    }
+    if (key.found || key.name != name) return;
+    read_json(val, jr);
+    key.found = true;
+    if (required) key.required++;
+}
+
+// Reads a json text, checking that nothing follows the value.
+template <typename T>
+void read_json_text(T& val, const char* str, const char* end) {
+    auto jr = json_reader{str, str, end};
+    read_json(val, jr);
+    if (peek_json(jr)) throw_json_error(jr, "unexpected text after value");
+}
+
 // #codegen begin gltf-func
 // ----------------------------------------------------
 
@@ -7678,16 +10296,22 @@ void serialize(glTFChildOfRootProperty& val, json& js, bool reading) {
     serialize((glTFProperty&)val, js, reading);
     serialize_attr(val.name, js, "name", reading, false, def.name);
 }
-// Parse a glTFAccessorSparseIndicesComponentType enum
-void serialize(
-    glTFAccessorSparseIndicesComponentType& val, json& js, bool reading) {
-    static std::vector<std::pair<int, glTFAccessorSparseIndicesComponentType>>
-        table = {
+// Values of a glTFAccessorSparseIndicesComponentType enum
+const std::vector<std::pair<int, glTFAccessorSparseIndicesComponentType>>&
+enum_values(glTFAccessorSparseIndicesComponentType) {
+    static auto table =
+        std::vector<std::pair<int, glTFAccessorSparseIndicesComponentType>>{
             {5121, glTFAccessorSparseIndicesComponentType::UnsignedByte},
             {5123, glTFAccessorSparseIndicesComponentType::UnsignedShort},
             {5125, glTFAccessorSparseIndicesComponentType::UnsignedInt},
         };
-    serialize(val, js, reading, table);
+    return table;
+}
+
+// Parse a glTFAccessorSparseIndicesComponentType enum
+void serialize(
+    glTFAccessorSparseIndicesComponentType& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
 }
 
 // Parses a glTFAccessorSparseIndices object
@@ -7723,9 +10347,10 @@ void serialize(glTFAccessorSparse& val, json& js, bool reading) {
     serialize_attr(val.indices, js, "indices", reading, true, def.indices);
     serialize_attr(val.values, js, "values", reading, true, def.values);
 }
-// Parse a glTFAccessorComponentType enum
-void serialize(glTFAccessorComponentType& val, json& js, bool reading) {
-    static std::vector<std::pair<int, glTFAccessorComponentType>> table = {
+// Values of a glTFAccessorComponentType enum
+const std::vector<std::pair<int, glTFAccessorComponentType>>&
+enum_values(glTFAccessorComponentType) {
+    static auto table = std::vector<std::pair<int, glTFAccessorComponentType>>{
         {5120, glTFAccessorComponentType::Byte},
         {5121, glTFAccessorComponentType::UnsignedByte},
         {5122, glTFAccessorComponentType::Short},
@@ -7733,12 +10358,18 @@ void serialize(glTFAccessorComponentType& val, json& js, bool reading) {
         {5125, glTFAccessorComponentType::UnsignedInt},
         {5126, glTFAccessorComponentType::Float},
     };
-    serialize(val, js, reading, table);
+    return table;
 }
 
-// Parse a glTFAccessorType enum
-void serialize(glTFAccessorType& val, json& js, bool reading) {
-    static std::vector<std::pair<std::string, glTFAccessorType>> table = {
+// Parse a glTFAccessorComponentType enum
+void serialize(glTFAccessorComponentType& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
+}
+
+// Values of a glTFAccessorType enum
+const std::vector<std::pair<std::string, glTFAccessorType>>&
+enum_values(glTFAccessorType) {
+    static auto table = std::vector<std::pair<std::string, glTFAccessorType>>{
         {"SCALAR", glTFAccessorType::Scalar},
         {"VEC2", glTFAccessorType::Vec2},
         {"VEC3", glTFAccessorType::Vec3},
@@ -7747,7 +10378,12 @@ void serialize(glTFAccessorType& val, json& js, bool reading) {
         {"MAT3", glTFAccessorType::Mat3},
         {"MAT4", glTFAccessorType::Mat4},
     };
-    serialize(val, js, reading, table);
+    return table;
+}
+
+// Parse a glTFAccessorType enum
+void serialize(glTFAccessorType& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
 }
 
 // Parses a glTFAccessor object
@@ -7769,16 +10405,22 @@ void serialize(glTFAccessor& val, json& js, bool reading) {
     serialize_attr(val.min, js, "min", reading, false, def.min);
     serialize_attr(val.sparse, js, "sparse", reading, false, def.sparse);
 }
-// Parse a glTFAnimationChannelTargetPath enum
-void serialize(glTFAnimationChannelTargetPath& val, json& js, bool reading) {
-    static std::vector<std::pair<std::string, glTFAnimationChannelTargetPath>>
-        table = {
+// Values of a glTFAnimationChannelTargetPath enum
+const std::vector<std::pair<std::string, glTFAnimationChannelTargetPath>>&
+enum_values(glTFAnimationChannelTargetPath) {
+    static auto table =
+        std::vector<std::pair<std::string, glTFAnimationChannelTargetPath>>{
             {"translation", glTFAnimationChannelTargetPath::Translation},
             {"rotation", glTFAnimationChannelTargetPath::Rotation},
             {"scale", glTFAnimationChannelTargetPath::Scale},
             {"weights", glTFAnimationChannelTargetPath::Weights},
         };
-    serialize(val, js, reading, table);
+    return table;
+}
+
+// Parse a glTFAnimationChannelTargetPath enum
+void serialize(glTFAnimationChannelTargetPath& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
 }
 
 // Parses a glTFAnimationChannelTarget object
@@ -7798,18 +10440,23 @@ void serialize(glTFAnimationChannel& val, json& js, bool reading) {
     serialize_attr(val.sampler, js, "sampler", reading, true, def.sampler);
     serialize_attr(val.target, js, "target", reading, true, def.target);
 }
-// Parse a glTFAnimationSamplerInterpolation enum
-void serialize(glTFAnimationSamplerInterpolation& val, json& js, bool reading) {
-    static std::vector<
-        std::pair<std::string, glTFAnimationSamplerInterpolation>>
-        table = {
+// Values of a glTFAnimationSamplerInterpolation enum
+const std::vector<std::pair<std::string, glTFAnimationSamplerInterpolation>>&
+enum_values(glTFAnimationSamplerInterpolation) {
+    static auto table =
+        std::vector<std::pair<std::string, glTFAnimationSamplerInterpolation>>{
             {"LINEAR", glTFAnimationSamplerInterpolation::Linear},
             {"STEP", glTFAnimationSamplerInterpolation::Step},
             {"CATMULLROMSPLINE",
                 glTFAnimationSamplerInterpolation::CatmullRomSpline},
             {"CUBICSPLINE", glTFAnimationSamplerInterpolation::CubicSpline},
         };
-    serialize(val, js, reading, table);
+    return table;
+}
+
+// Parse a glTFAnimationSamplerInterpolation enum
+void serialize(glTFAnimationSamplerInterpolation& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
 }
 
 // Parses a glTFAnimationSampler object
@@ -7855,13 +10502,19 @@ void serialize(glTFBuffer& val, json& js, bool reading) {
     serialize_attr(
         val.byteLength, js, "byteLength", reading, true, def.byteLength);
 }
-// Parse a glTFBufferViewTarget enum
-void serialize(glTFBufferViewTarget& val, json& js, bool reading) {
-    static std::vector<std::pair<int, glTFBufferViewTarget>> table = {
+// Values of a glTFBufferViewTarget enum
+const std::vector<std::pair<int, glTFBufferViewTarget>>&
+enum_values(glTFBufferViewTarget) {
+    static auto table = std::vector<std::pair<int, glTFBufferViewTarget>>{
         {34962, glTFBufferViewTarget::ArrayBuffer},
         {34963, glTFBufferViewTarget::ElementArrayBuffer},
     };
-    serialize(val, js, reading, table);
+    return table;
+}
+
+// Parse a glTFBufferViewTarget enum
+void serialize(glTFBufferViewTarget& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
 }
 
 // Parses a glTFBufferView object
@@ -7901,13 +10554,19 @@ void serialize(glTFCameraPerspective& val, json& js, bool reading) {
     serialize_attr(val.zfar, js, "zfar", reading, false, def.zfar);
     serialize_attr(val.znear, js, "znear", reading, true, def.znear);
 }
-// Parse a glTFCameraType enum
-void serialize(glTFCameraType& val, json& js, bool reading) {
-    static std::vector<std::pair<std::string, glTFCameraType>> table = {
+// Values of a glTFCameraType enum
+const std::vector<std::pair<std::string, glTFCameraType>>&
+enum_values(glTFCameraType) {
+    static auto table = std::vector<std::pair<std::string, glTFCameraType>>{
         {"perspective", glTFCameraType::Perspective},
         {"orthographic", glTFCameraType::Orthographic},
     };
-    serialize(val, js, reading, table);
+    return table;
+}
+
+// Parse a glTFCameraType enum
+void serialize(glTFCameraType& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
 }
 
 // Parses a glTFCamera object
@@ -7921,13 +10580,19 @@ void serialize(glTFCamera& val, json& js, bool reading) {
         val.perspective, js, "perspective", reading, false, def.perspective);
     serialize_attr(val.type, js, "type", reading, true, def.type);
 }
-// Parse a glTFImageMimeType enum
-void serialize(glTFImageMimeType& val, json& js, bool reading) {
-    static std::vector<std::pair<std::string, glTFImageMimeType>> table = {
+// Values of a glTFImageMimeType enum
+const std::vector<std::pair<std::string, glTFImageMimeType>>&
+enum_values(glTFImageMimeType) {
+    static auto table = std::vector<std::pair<std::string, glTFImageMimeType>>{
         {"image/jpeg", glTFImageMimeType::ImageJpeg},
         {"image/png", glTFImageMimeType::ImagePng},
     };
-    serialize(val, js, reading, table);
+    return table;
+}
+
+// Parse a glTFImageMimeType enum
+void serialize(glTFImageMimeType& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
 }
 
 // Parses a glTFImage object
@@ -8009,14 +10674,21 @@ void serialize(glTFMaterialPbrSpecularGlossiness& val, json& js, bool reading) {
         "specularGlossinessTexture", reading, false,
         def.specularGlossinessTexture);
 }
+// Values of a glTFMaterialAlphaMode enum
+const std::vector<std::pair<std::string, glTFMaterialAlphaMode>>&
+enum_values(glTFMaterialAlphaMode) {
+    static auto table =
+        std::vector<std::pair<std::string, glTFMaterialAlphaMode>>{
+            {"OPAQUE", glTFMaterialAlphaMode::Opaque},
+            {"MASK", glTFMaterialAlphaMode::Mask},
+            {"BLEND", glTFMaterialAlphaMode::Blend},
+        };
+    return table;
+}
+
 // Parse a glTFMaterialAlphaMode enum
 void serialize(glTFMaterialAlphaMode& val, json& js, bool reading) {
-    static std::vector<std::pair<std::string, glTFMaterialAlphaMode>> table = {
-        {"OPAQUE", glTFMaterialAlphaMode::Opaque},
-        {"MASK", glTFMaterialAlphaMode::Mask},
-        {"BLEND", glTFMaterialAlphaMode::Blend},
-    };
-    serialize(val, js, reading, table);
+    serialize(val, js, reading, enum_values(val));
 }
 
 // Parses a glTFMaterial object
@@ -8056,9 +10728,10 @@ void serialize(glTFMaterial& val, json& js, bool reading) {
         }
     }
 }
-// Parse a glTFMeshPrimitiveMode enum
-void serialize(glTFMeshPrimitiveMode& val, json& js, bool reading) {
-    static std::vector<std::pair<int, glTFMeshPrimitiveMode>> table = {
+// Values of a glTFMeshPrimitiveMode enum
+const std::vector<std::pair<int, glTFMeshPrimitiveMode>>&
+enum_values(glTFMeshPrimitiveMode) {
+    static auto table = std::vector<std::pair<int, glTFMeshPrimitiveMode>>{
         {0, glTFMeshPrimitiveMode::Points},
         {1, glTFMeshPrimitiveMode::Lines},
         {2, glTFMeshPrimitiveMode::LineLoop},
@@ -8067,7 +10740,12 @@ void serialize(glTFMeshPrimitiveMode& val, json& js, bool reading) {
         {5, glTFMeshPrimitiveMode::TriangleStrip},
         {6, glTFMeshPrimitiveMode::TriangleFan},
     };
-    serialize(val, js, reading, table);
+    return table;
+}
+
+// Parse a glTFMeshPrimitiveMode enum
+void serialize(glTFMeshPrimitiveMode& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
 }
 
 // Parses a glTFMeshPrimitive object
@@ -8109,18 +10787,25 @@ void serialize(glTFNode& val, json& js, bool reading) {
         val.translation, js, "translation", reading, false, def.translation);
     serialize_attr(val.weights, js, "weights", reading, false, def.weights);
 }
-// Parse a glTFSamplerMagFilter enum
-void serialize(glTFSamplerMagFilter& val, json& js, bool reading) {
-    static std::vector<std::pair<int, glTFSamplerMagFilter>> table = {
+// Values of a glTFSamplerMagFilter enum
+const std::vector<std::pair<int, glTFSamplerMagFilter>>&
+enum_values(glTFSamplerMagFilter) {
+    static auto table = std::vector<std::pair<int, glTFSamplerMagFilter>>{
         {9728, glTFSamplerMagFilter::Nearest},
         {9729, glTFSamplerMagFilter::Linear},
     };
-    serialize(val, js, reading, table);
+    return table;
 }
 
-// Parse a glTFSamplerMinFilter enum
-void serialize(glTFSamplerMinFilter& val, json& js, bool reading) {
-    static std::vector<std::pair<int, glTFSamplerMinFilter>> table = {
+// Parse a glTFSamplerMagFilter enum
+void serialize(glTFSamplerMagFilter& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
+}
+
+// Values of a glTFSamplerMinFilter enum
+const std::vector<std::pair<int, glTFSamplerMinFilter>>&
+enum_values(glTFSamplerMinFilter) {
+    static auto table = std::vector<std::pair<int, glTFSamplerMinFilter>>{
         {9728, glTFSamplerMinFilter::Nearest},
         {9729, glTFSamplerMinFilter::Linear},
         {9984, glTFSamplerMinFilter::NearestMipmapNearest},
@@ -8128,27 +10813,44 @@ void serialize(glTFSamplerMinFilter& val, json& js, bool reading) {
         {9986, glTFSamplerMinFilter::NearestMipmapLinear},
         {9987, glTFSamplerMinFilter::LinearMipmapLinear},
     };
-    serialize(val, js, reading, table);
+    return table;
 }
 
-// Parse a glTFSamplerWrapS enum
-void serialize(glTFSamplerWrapS& val, json& js, bool reading) {
-    static std::vector<std::pair<int, glTFSamplerWrapS>> table = {
+// Parse a glTFSamplerMinFilter enum
+void serialize(glTFSamplerMinFilter& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
+}
+
+// Values of a glTFSamplerWrapS enum
+const std::vector<std::pair<int, glTFSamplerWrapS>>&
+enum_values(glTFSamplerWrapS) {
+    static auto table = std::vector<std::pair<int, glTFSamplerWrapS>>{
         {33071, glTFSamplerWrapS::ClampToEdge},
         {33648, glTFSamplerWrapS::MirroredRepeat},
         {10497, glTFSamplerWrapS::Repeat},
     };
-    serialize(val, js, reading, table);
+    return table;
 }
 
-// Parse a glTFSamplerWrapT enum
-void serialize(glTFSamplerWrapT& val, json& js, bool reading) {
-    static std::vector<std::pair<int, glTFSamplerWrapT>> table = {
+// Parse a glTFSamplerWrapS enum
+void serialize(glTFSamplerWrapS& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
+}
+
+// Values of a glTFSamplerWrapT enum
+const std::vector<std::pair<int, glTFSamplerWrapT>>&
+enum_values(glTFSamplerWrapT) {
+    static auto table = std::vector<std::pair<int, glTFSamplerWrapT>>{
         {33071, glTFSamplerWrapT::ClampToEdge},
         {33648, glTFSamplerWrapT::MirroredRepeat},
         {10497, glTFSamplerWrapT::Repeat},
     };
-    serialize(val, js, reading, table);
+    return table;
+}
+
+// Parse a glTFSamplerWrapT enum
+void serialize(glTFSamplerWrapT& val, json& js, bool reading) {
+    serialize(val, js, reading, enum_values(val));
 }
 
 // Parses a glTFSampler object
@@ -8213,7 +10915,395 @@ void serialize(glTF& val, json& js, bool reading) {
     serialize_attr(val.textures, js, "textures", reading, false, def.textures);
 }
 
-// #codegen end gltf-func
+// #codegen end gltf-func
+
+// #codegen begin gltf-read
+// ----------------------------------------------------
+
+// Reads an id.
+template <typename T>
+void read_json(glTFid<T>& val, json_reader& jr) {
+    auto v = 0;
+    read_json(v, jr);
+    val = glTFid<T>(v);
+}
+
+// Reads glTFProperty attributes
+void read_json_attrs(glTFProperty& val, json_reader& jr, json_key& key) {
+#if YGL_GLTFJSON
+    read_json_attr(val.extensions, jr, key, "extensions", false);
+    read_json_attr(val.extras, jr, key, "extras", false);
+#endif
+}
+
+// Reads glTFChildOfRootProperty attributes
+void read_json_attrs(
+    glTFChildOfRootProperty& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.name, jr, key, "name", false);
+}
+
+// Reads a glTFAccessorSparseIndicesComponentType enum
+void read_json(glTFAccessorSparseIndicesComponentType& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads glTFAccessorSparseIndices attributes
+void read_json_attrs(
+    glTFAccessorSparseIndices& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.bufferView, jr, key, "bufferView", true);
+    read_json_attr(val.byteOffset, jr, key, "byteOffset", false);
+    read_json_attr(val.componentType, jr, key, "componentType", true);
+}
+
+// Reads glTFAccessorSparseValues attributes
+void read_json_attrs(
+    glTFAccessorSparseValues& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.bufferView, jr, key, "bufferView", true);
+    read_json_attr(val.byteOffset, jr, key, "byteOffset", false);
+}
+
+// Reads glTFAccessorSparse attributes
+void read_json_attrs(glTFAccessorSparse& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.count, jr, key, "count", true);
+    read_json_attr(val.indices, jr, key, "indices", true);
+    read_json_attr(val.values, jr, key, "values", true);
+}
+
+// Reads a glTFAccessorComponentType enum
+void read_json(glTFAccessorComponentType& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads a glTFAccessorType enum
+void read_json(glTFAccessorType& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads glTFAccessor attributes
+void read_json_attrs(glTFAccessor& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.bufferView, jr, key, "bufferView", false);
+    read_json_attr(val.byteOffset, jr, key, "byteOffset", false);
+    read_json_attr(val.componentType, jr, key, "componentType", true);
+    read_json_attr(val.normalized, jr, key, "normalized", false);
+    read_json_attr(val.count, jr, key, "count", true);
+    read_json_attr(val.type, jr, key, "type", true);
+    read_json_attr(val.max, jr, key, "max", false);
+    read_json_attr(val.min, jr, key, "min", false);
+    read_json_attr(val.sparse, jr, key, "sparse", false);
+}
+
+// Reads a glTFAnimationChannelTargetPath enum
+void read_json(glTFAnimationChannelTargetPath& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads glTFAnimationChannelTarget attributes
+void read_json_attrs(
+    glTFAnimationChannelTarget& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.node, jr, key, "node", true);
+    read_json_attr(val.path, jr, key, "path", true);
+}
+
+// Reads glTFAnimationChannel attributes
+void read_json_attrs(
+    glTFAnimationChannel& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.sampler, jr, key, "sampler", true);
+    read_json_attr(val.target, jr, key, "target", true);
+}
+
+// Reads a glTFAnimationSamplerInterpolation enum
+void read_json(glTFAnimationSamplerInterpolation& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads glTFAnimationSampler attributes
+void read_json_attrs(
+    glTFAnimationSampler& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.input, jr, key, "input", true);
+    read_json_attr(val.interpolation, jr, key, "interpolation", false);
+    read_json_attr(val.output, jr, key, "output", true);
+}
+
+// Reads glTFAnimation attributes
+void read_json_attrs(glTFAnimation& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.channels, jr, key, "channels", true);
+    read_json_attr(val.samplers, jr, key, "samplers", true);
+}
+
+// Reads glTFAsset attributes
+void read_json_attrs(glTFAsset& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.copyright, jr, key, "copyright", false);
+    read_json_attr(val.generator, jr, key, "generator", false);
+    read_json_attr(val.version, jr, key, "version", true);
+    read_json_attr(val.minVersion, jr, key, "minVersion", false);
+}
+
+// Reads glTFBuffer attributes
+void read_json_attrs(glTFBuffer& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.uri, jr, key, "uri", false);
+    read_json_attr(val.byteLength, jr, key, "byteLength", true);
+}
+
+// Reads a glTFBufferViewTarget enum
+void read_json(glTFBufferViewTarget& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads glTFBufferView attributes
+void read_json_attrs(glTFBufferView& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.buffer, jr, key, "buffer", true);
+    read_json_attr(val.byteOffset, jr, key, "byteOffset", false);
+    read_json_attr(val.byteLength, jr, key, "byteLength", true);
+    read_json_attr(val.byteStride, jr, key, "byteStride", false);
+    read_json_attr(val.target, jr, key, "target", false);
+}
+
+// Reads glTFCameraOrthographic attributes
+void read_json_attrs(
+    glTFCameraOrthographic& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.xmag, jr, key, "xmag", true);
+    read_json_attr(val.ymag, jr, key, "ymag", true);
+    read_json_attr(val.zfar, jr, key, "zfar", true);
+    read_json_attr(val.znear, jr, key, "znear", true);
+}
+
+// Reads glTFCameraPerspective attributes
+void read_json_attrs(
+    glTFCameraPerspective& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.aspectRatio, jr, key, "aspectRatio", false);
+    read_json_attr(val.yfov, jr, key, "yfov", true);
+    read_json_attr(val.zfar, jr, key, "zfar", false);
+    read_json_attr(val.znear, jr, key, "znear", true);
+}
+
+// Reads a glTFCameraType enum
+void read_json(glTFCameraType& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads glTFCamera attributes
+void read_json_attrs(glTFCamera& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.orthographic, jr, key, "orthographic", false);
+    read_json_attr(val.perspective, jr, key, "perspective", false);
+    read_json_attr(val.type, jr, key, "type", true);
+}
+
+// Reads a glTFImageMimeType enum
+void read_json(glTFImageMimeType& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads glTFImage attributes
+void read_json_attrs(glTFImage& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.uri, jr, key, "uri", false);
+    read_json_attr(val.mimeType, jr, key, "mimeType", false);
+    read_json_attr(val.bufferView, jr, key, "bufferView", false);
+}
+
+// Reads glTFTextureInfo attributes
+void read_json_attrs(glTFTextureInfo& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.index, jr, key, "index", true);
+    read_json_attr(val.texCoord, jr, key, "texCoord", false);
+}
+
+// Reads glTFTexture attributes
+void read_json_attrs(glTFTexture& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.sampler, jr, key, "sampler", false);
+    read_json_attr(val.source, jr, key, "source", false);
+}
+
+// Reads glTFMaterialNormalTextureInfo attributes
+void read_json_attrs(
+    glTFMaterialNormalTextureInfo& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFTextureInfo&)val, jr, key);
+    read_json_attr(val.scale, jr, key, "scale", false);
+}
+
+// Reads glTFMaterialOcclusionTextureInfo attributes
+void read_json_attrs(
+    glTFMaterialOcclusionTextureInfo& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFTextureInfo&)val, jr, key);
+    read_json_attr(val.strength, jr, key, "strength", false);
+}
+
+// Reads glTFMaterialPbrMetallicRoughness attributes
+void read_json_attrs(
+    glTFMaterialPbrMetallicRoughness& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.baseColorFactor, jr, key, "baseColorFactor", false);
+    read_json_attr(val.baseColorTexture, jr, key, "baseColorTexture", false);
+    read_json_attr(val.metallicFactor, jr, key, "metallicFactor", false);
+    read_json_attr(val.roughnessFactor, jr, key, "roughnessFactor", false);
+    read_json_attr(val.metallicRoughnessTexture, jr, key,
+        "metallicRoughnessTexture", false);
+}
+
+// Reads glTFMaterialPbrSpecularGlossiness attributes
+void read_json_attrs(
+    glTFMaterialPbrSpecularGlossiness& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.diffuseFactor, jr, key, "diffuseFactor", false);
+    read_json_attr(val.diffuseTexture, jr, key, "diffuseTexture", false);
+    read_json_attr(val.specularFactor, jr, key, "specularFactor", false);
+    read_json_attr(val.glossinessFactor, jr, key, "glossinessFactor", false);
+    read_json_attr(val.specularGlossinessTexture, jr, key,
+        "specularGlossinessTexture", false);
+}
+
+// Reads a glTFMaterialAlphaMode enum
+void read_json(glTFMaterialAlphaMode& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads glTFMaterial attributes
+void read_json_attrs(glTFMaterial& val, json_reader& jr, json_key& key) {
+    // extensions are small, so they are read through the json DOM
+    if (!key.found && key.name == "extensions") {
+        static auto def = glTFMaterial();
+        auto js_ext = json();
+        read_json(js_ext, jr);
+        serialize_attr(val.pbrSpecularGlossiness, js_ext,
+            "KHR_materials_pbrSpecularGlossiness", true, false,
+            def.pbrSpecularGlossiness);
+#if YGL_GLTFJSON
+        serialize(val.extensions, js_ext, true);
+#endif
+        key.found = true;
+    }
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(
+        val.pbrMetallicRoughness, jr, key, "pbrMetallicRoughness", false);
+    read_json_attr(val.normalTexture, jr, key, "normalTexture", false);
+    read_json_attr(val.occlusionTexture, jr, key, "occlusionTexture", false);
+    read_json_attr(val.emissiveTexture, jr, key, "emissiveTexture", false);
+    read_json_attr(val.emissiveFactor, jr, key, "emissiveFactor", false);
+    read_json_attr(val.alphaMode, jr, key, "alphaMode", false);
+    read_json_attr(val.alphaCutoff, jr, key, "alphaCutoff", false);
+    read_json_attr(val.doubleSided, jr, key, "doubleSided", false);
+}
+
+// Reads a glTFMeshPrimitiveMode enum
+void read_json(glTFMeshPrimitiveMode& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads glTFMeshPrimitive attributes
+void read_json_attrs(glTFMeshPrimitive& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.attributes, jr, key, "attributes", true);
+    read_json_attr(val.indices, jr, key, "indices", false);
+    read_json_attr(val.material, jr, key, "material", false);
+    read_json_attr(val.mode, jr, key, "mode", false);
+    read_json_attr(val.targets, jr, key, "targets", false);
+}
+
+// Reads glTFMesh attributes
+void read_json_attrs(glTFMesh& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.primitives, jr, key, "primitives", true);
+    read_json_attr(val.weights, jr, key, "weights", false);
+}
+
+// Reads glTFNode attributes
+void read_json_attrs(glTFNode& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.camera, jr, key, "camera", false);
+    read_json_attr(val.children, jr, key, "children", false);
+    read_json_attr(val.skin, jr, key, "skin", false);
+    read_json_attr(val.matrix, jr, key, "matrix", false);
+    read_json_attr(val.mesh, jr, key, "mesh", false);
+    read_json_attr(val.rotation, jr, key, "rotation", false);
+    read_json_attr(val.scale, jr, key, "scale", false);
+    read_json_attr(val.translation, jr, key, "translation", false);
+    read_json_attr(val.weights, jr, key, "weights", false);
+}
+
+// Reads a glTFSamplerMagFilter enum
+void read_json(glTFSamplerMagFilter& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads a glTFSamplerMinFilter enum
+void read_json(glTFSamplerMinFilter& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads a glTFSamplerWrapS enum
+void read_json(glTFSamplerWrapS& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads a glTFSamplerWrapT enum
+void read_json(glTFSamplerWrapT& val, json_reader& jr) {
+    read_json(val, jr, enum_values(val));
+}
+
+// Reads glTFSampler attributes
+void read_json_attrs(glTFSampler& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.magFilter, jr, key, "magFilter", false);
+    read_json_attr(val.minFilter, jr, key, "minFilter", false);
+    read_json_attr(val.wrapS, jr, key, "wrapS", false);
+    read_json_attr(val.wrapT, jr, key, "wrapT", false);
+}
+
+// Reads glTFScene attributes
+void read_json_attrs(glTFScene& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(val.nodes, jr, key, "nodes", false);
+}
+
+// Reads glTFSkin attributes
+void read_json_attrs(glTFSkin& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFChildOfRootProperty&)val, jr, key);
+    read_json_attr(
+        val.inverseBindMatrices, jr, key, "inverseBindMatrices", false);
+    read_json_attr(val.skeleton, jr, key, "skeleton", false);
+    read_json_attr(val.joints, jr, key, "joints", true);
+}
+
+// Reads glTF attributes
+void read_json_attrs(glTF& val, json_reader& jr, json_key& key) {
+    read_json_attrs((glTFProperty&)val, jr, key);
+    read_json_attr(val.extensionsUsed, jr, key, "extensionsUsed", false);
+    read_json_attr(
+        val.extensionsRequired, jr, key, "extensionsRequired", false);
+    read_json_attr(val.accessors, jr, key, "accessors", false);
+    read_json_attr(val.animations, jr, key, "animations", false);
+    read_json_attr(val.asset, jr, key, "asset", true);
+    read_json_attr(val.buffers, jr, key, "buffers", false);
+    read_json_attr(val.bufferViews, jr, key, "bufferViews", false);
+    read_json_attr(val.cameras, jr, key, "cameras", false);
+    read_json_attr(val.images, jr, key, "images", false);
+    read_json_attr(val.materials, jr, key, "materials", false);
+    read_json_attr(val.meshes, jr, key, "meshes", false);
+    read_json_attr(val.nodes, jr, key, "nodes", false);
+    read_json_attr(val.samplers, jr, key, "samplers", false);
+    read_json_attr(val.scene, jr, key, "scene", false);
+    read_json_attr(val.scenes, jr, key, "scenes", false);
+    read_json_attr(val.skins, jr, key, "skins", false);
+    read_json_attr(val.textures, jr, key, "textures", false);
+}
+
+// #codegen end gltf-read
 
 // Encode in base64
 std::string base64_encode(
@@ -8262,59 +11352,38 @@ std::string base64_encode(
     return ret;
 }
 
-// Decode from base64
-std::string base64_decode(std::string const& encoded_string) {
-    static const std::string base64_chars =
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "abcdefghijklmnopqrstuvwxyz"
-        "0123456789+/";
-
-    auto is_base64 = [](unsigned char c) -> bool {
-        return (isalnum(c) || (c == '+') || (c == '/'));
-    };
-
-    int in_len = (int)encoded_string.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::string ret;
-
-    while (in_len-- && (encoded_string[in_] != '=') &&
-           is_base64(encoded_string[in_])) {
-        char_array_4[i++] = encoded_string[in_];
-        in_++;
-        if (i == 4) {
-            for (i = 0; i < 4; i++)
-                char_array_4[i] = base64_chars.find(char_array_4[i]);
-
-            char_array_3[0] =
-                (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) +
-                              ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; (i < 3); i++) ret += char_array_3[i];
-            i = 0;
-        }
-    }
-
-    if (i) {
-        for (j = i; j < 4; j++) char_array_4[j] = 0;
-
-        for (j = 0; j < 4; j++)
-            char_array_4[j] = base64_chars.find(char_array_4[j]);
-
-        char_array_3[0] =
-            (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] =
-            ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-        for (j = 0; (j < i - 1); j++) ret += char_array_3[j];
+// Decode from base64 directly into data. Decoding stops at the first
+// character outside the base64 alphabet, like the padding.
+void base64_decode(const char* str, size_t len, std::vector<byte>& data) {
+    static const auto table = []() {
+        auto table = std::array<signed char, 256>();
+        table.fill(-1);
+        auto chars =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (auto i = 0; i < 64; i++) table[(byte)chars[i]] = i;
+        return table;
+    }();
+
+    // size the output once, then decode in groups of four characters
+    auto nchars = (size_t)0;
+    while (nchars < len && table[(byte)str[nchars]] >= 0) nchars++;
+    auto nrem = (int)(nchars % 4);
+    data.resize(nchars / 4 * 3 + ((nrem) ? nrem - 1 : 0));
+    auto out = data.data();
+    auto in = (const byte*)str;
+    for (auto i = (size_t)0; i < nchars / 4; i++, in += 4, out += 3) {
+        auto v = (uint32_t)table[in[0]] << 18 | (uint32_t)table[in[1]] << 12 |
+                 (uint32_t)table[in[2]] << 6 | (uint32_t)table[in[3]];
+        out[0] = (byte)(v >> 16);
+        out[1] = (byte)(v >> 8);
+        out[2] = (byte)v;
+    }
+    if (nrem) {
+        auto v = (uint32_t)0;
+        for (auto i = 0; i < nrem; i++)
+            v |= (uint32_t)table[in[i]] << (18 - 6 * i);
+        for (auto i = 0; i < nrem - 1; i++) out[i] = (byte)(v >> (16 - 8 * i));
     }
-
-    return ret;
 }
 
 // Load buffer data.
@@ -8330,10 +11399,8 @@ void load_buffers(glTF* gltf, const std::string& dirname, bool skip_missing) {
                     throw std::runtime_error("could not decode base64 data");
                 }
                 // decode
-                auto data = base64_decode(buffer->uri.substr(pos + 1));
-                buffer->data =
-                    std::vector<unsigned char>((unsigned char*)data.c_str(),
-                        (unsigned char*)data.c_str() + data.length());
+                base64_decode(buffer->uri.data() + pos + 1,
+                    buffer->uri.size() - pos - 1, buffer->data);
             } else {
                 buffer->data =
                     load_binary(path_convert_eparator(dirname + buffer->uri));
@@ -8354,16 +11421,16 @@ void load_buffers(glTF* gltf, const std::string& dirname, bool skip_missing) {
     }
 }
 
-// Loads images.
+// Loads images. Images are decoded in parallel.
 void load_images(glTF* gltf, const std::string& dirname, bool skip_missing) {
-    for (auto image : gltf->images) {
+    auto jobs = std::vector<image_decode_job>(gltf->images.size());
+    auto buffers = std::vector<std::vector<byte>>(gltf->images.size());
+    auto valid = std::vector<bool>(gltf->images.size(), false);
+    for (auto iid = 0; iid < gltf->images.size(); iid++) {
+        auto image = gltf->images[iid];
+        auto& job = jobs[iid];
         image->data = image_data();
-        auto filename = std::string();
-#if YGL_IMAGEIO
         if (image->bufferView || startswith(image->uri, "data:")) {
-            auto buffer = std::string();
-            auto data = (unsigned char*)nullptr;
-            auto data_size = 0;
             if (image->bufferView) {
                 auto view = gltf->get(image->bufferView);
                 auto buffer = gltf->get(view->buffer);
@@ -8372,15 +11439,15 @@ void load_images(glTF* gltf, const std::string& dirname, bool skip_missing) {
                     throw std::runtime_error("invalid image buffer view");
                 }
                 if (image->mimeType == glTFImageMimeType::ImagePng)
-                    filename = "internal_data.png";
+                    job.filename = "internal_data.png";
                 else if (image->mimeType == glTFImageMimeType::ImageJpeg)
-                    filename = "internal_data.jpg";
+                    job.filename = "internal_data.jpg";
                 else {
                     if (skip_missing) continue;
                     throw std::runtime_error("unsupported image format");
                 }
-                data = buffer->data.data() + view->byteOffset;
-                data_size = view->byteLength;
+                job.data = buffer->data.data() + view->byteOffset;
+                job.size = view->byteLength;
             } else {
                 // assume it is base64 and find ','
                 auto pos = image->uri.find(',');
@@ -8391,68 +11458,84 @@ void load_images(glTF* gltf, const std::string& dirname, bool skip_missing) {
                 auto header = image->uri.substr(0, pos);
                 for (auto format : {"png", "jpg", "jpeg", "tga", "ppm", "hdr"})
                     if (header.find(format) != header.npos)
-                        filename = std::string("fake.") + format;
-                if (is_hdr_filename(filename)) {
+                        job.filename = std::string("fake.") + format;
+                if (is_hdr_filename(job.filename)) {
                     if (skip_missing) continue;
                     throw std::runtime_error(
                         "unsupported embedded image format " +
                         header.substr(0, pos));
                 }
                 // decode
-                buffer = base64_decode(image->uri.substr(pos + 1));
-                data_size = (int)buffer.size();
-                data = (unsigned char*)buffer.data();
-            }
-            if (is_hdr_filename(filename)) {
-                image->data.dataf = load_imagef_from_memory(filename, data,
-                    data_size, image->data.width, image->data.height,
-                    image->data.ncomp);
-            } else {
-                image->data.datab = load_image_from_memory(filename, data,
-                    data_size, image->data.width, image->data.height,
-                    image->data.ncomp);
+                base64_decode(image->uri.data() + pos + 1,
+                    image->uri.size() - pos - 1, buffers[iid]);
+                job.data = buffers[iid].data();
+                job.size = (int)buffers[iid].size();
             }
         } else {
-            filename = path_convert_eparator(dirname + image->uri);
-            if (is_hdr_filename(filename)) {
-                image->data.dataf = load_imagef(filename, image->data.width,
-                    image->data.height, image->data.ncomp);
-            } else {
-                image->data.datab = load_image(filename, image->data.width,
-                    image->data.height, image->data.ncomp);
-            }
+            job.filename = path_convert_eparator(dirname + image->uri);
         }
+        valid[iid] = true;
+    }
+#if YGL_IMAGEIO
+    decode_images(jobs);
 #endif
+    for (auto iid = 0; iid < gltf->images.size(); iid++) {
+        if (!valid[iid]) continue;
+        auto image = gltf->images[iid];
+        auto& job = jobs[iid];
+        image->data.width = job.width;
+        image->data.height = job.height;
+        image->data.ncomp = job.ncomp;
+        image->data.datab = std::move(job.datab);
+        image->data.dataf = std::move(job.dataf);
         if (image->data.dataf.empty() && image->data.datab.empty()) {
             if (skip_missing) continue;
-            throw std::runtime_error("cannot load image " + filename);
+            throw std::runtime_error("cannot load image " + job.filename);
         }
     }
 }
 
 // Loads a gltf.
 glTF* load_gltf(const std::string& filename, bool load_bin, bool load_image,
-    bool skip_missing) {
+    bool skip_missing, bool json_dom) {
     // clear data
     auto gltf = std::unique_ptr<glTF>(new glTF());
 
     // load json
-    std::ifstream stream(filename.c_str());
-    if (!stream) throw std::runtime_error("could not load json " + filename);
-    auto js = json();
-    try {
-        stream >> js;
-    } catch (const std::exception& e) {
-        throw std::runtime_error(
-            std::string("could not load json with error ") + e.what());
-    }
+    if (json_dom) {
+        std::ifstream stream(filename.c_str());
+        if (!stream)
+            throw std::runtime_error("could not load json " + filename);
+        auto js = json();
+        try {
+            stream >> js;
+        } catch (const std::exception& e) {
+            throw std::runtime_error(
+                std::string("could not load json with error ") + e.what());
+        }
 
-    // parse json
-    auto gltf_ = gltf.get();
-    try {
-        serialize(gltf_, js, true);
-    } catch (const std::exception& e) {
-        throw std::runtime_error("error parsing gltf " + std::string(e.what()));
+        // parse json
+        auto gltf_ = gltf.get();
+        try {
+            serialize(gltf_, js, true);
+        } catch (const std::exception& e) {
+            throw std::runtime_error(
+                "error parsing gltf " + std::string(e.what()));
+        }
+    } else {
+        // read json from a view of the file
+        auto view = file_view();
+        try {
+            open_file_view(view, filename);
+        } catch (std::exception&) {
+            throw std::runtime_error("could not load json " + filename);
+        }
+        try {
+            read_json_text(*gltf, view.data, view.data + view.size);
+        } catch (const std::exception& e) {
+            throw std::runtime_error(
+                "error parsing gltf " + std::string(e.what()));
+        }
     }
 
     // load external resources
@@ -8529,13 +11612,6 @@ void save_gltf(const std::string& filename, const glTF* gltf, bool save_bin,
     if (save_image) save_images(gltf, dirname, false);
 }
 
-// reading shortcut
-template <typename T>
-void gltf_fread(FILE* f, T* v, int count) {
-    if (fread(v, sizeof(T), count, f) != count)
-        throw std::runtime_error("could not read binary file");
-}
-
 // writing shortcut
 template <typename T>
 void gltf_fwrite(FILE* f, const T* v, int count) {
@@ -8543,116 +11619,114 @@ void gltf_fwrite(FILE* f, const T* v, int count) {
         std::runtime_error("could not write binary file");
 }
 
-// Loads a binary gltf.
+// Loads a binary gltf. The file is memory-mapped, so the json is parsed in
+// place and the binary chunk is copied once into its buffer.
 glTF* load_binary_gltf(const std::string& filename, bool load_bin,
-    bool load_image, bool skip_missing) {
+    bool load_image, bool skip_missing, bool json_dom) {
     // clear data
     auto gltf = std::unique_ptr<glTF>(new glTF());
 
     // opens binary file
-    auto f = fopen(filename.c_str(), "rb");
-    if (!f) throw std::runtime_error("could not load binary file " + filename);
+    auto view = file_view();
+    try {
+        open_file_view(view, filename);
+    } catch (std::exception&) {
+        throw std::runtime_error("could not load binary file " + filename);
+    }
+
+    // reading shortcuts, checking for truncated files
+    auto pos = (size_t)0;
+    auto read_bytes = [&view, &pos](size_t size) {
+        if (size > view.size - pos)
+            throw std::runtime_error("could not read binary file");
+        auto bytes = view.data + pos;
+        pos += size;
+        return bytes;
+    };
+    auto read_uint = [&read_bytes]() {
+        auto val = (uint32_t)0;
+        memcpy(&val, read_bytes(4), 4);
+        return val;
+    };
 
     // read magic
-    uint32_t magic;
-    gltf_fread(f, &magic, 1);
+    auto magic = read_uint();
     if (magic != 0x46546C67) throw std::runtime_error("corrupted glb format");
 
     // read version
-    uint32_t version;
-    gltf_fread(f, &version, 1);
+    auto version = read_uint();
     if (version != 1 && version != 2)
         throw std::runtime_error("unsupported glb version");
 
     // read length
-    uint32_t length;
-    gltf_fread(f, &length, 1);
+    auto length = read_uint();
 
-    // data
-    auto json_bytes = std::vector<char>();
-    auto buffer_bytes = std::vector<unsigned char>();
-    uint32_t buffer_length = 0;
-
-    if (version == 1) {
-        // read content length and format
-        uint32_t json_length, json_format;
-        gltf_fread(f, &json_length, 1);
-        gltf_fread(f, &json_format, 1);
+    // read content length and format
+    auto json_length = read_uint();
+    auto json_format = read_uint();
+    if (version == 2 && json_format != 0x4E4F534A)
+        throw std::runtime_error("corrupt binary format");
 
-        // read json bytes
-        json_bytes.resize(json_length);
-        gltf_fread(f, json_bytes.data(), json_length);
+    // json bytes
+    auto json_bytes = read_bytes(json_length);
 
-        // read buffer bytes
-        if (load_bin) {
-            buffer_bytes.resize(length - json_length - 20);
-            gltf_fread(f, buffer_bytes.data(), (int)buffer_bytes.size());
-            buffer_length = (int)buffer_bytes.size();
-        }
+    // buffer bytes
+    auto buffer_bytes = (const char*)nullptr;
+    auto buffer_length = (uint32_t)0;
+    if (version == 1) {
+        if (length < json_length + 20)
+            throw std::runtime_error("corrupt binary format");
+        buffer_length = length - json_length - 20;
     }
-
     if (version == 2) {
-        // read content length and format
-        uint32_t json_length, json_format;
-        gltf_fread(f, &json_length, 1);
-        gltf_fread(f, &json_format, 1);
-        if (json_format != 0x4E4F534A) {
-            throw std::runtime_error("corrupt binary format");
-            return nullptr;
-        }
-
-        // read json bytes
-        json_bytes.resize(json_length);
-        gltf_fread(f, json_bytes.data(), (int)json_bytes.size());
-
-        // read content length and format
-        uint32_t buffer_format;
-        gltf_fread(f, &buffer_length, 1);
-        gltf_fread(f, &buffer_format, 1);
+        buffer_length = read_uint();
+        auto buffer_format = read_uint();
         if (buffer_format != 0x004E4942)
             throw std::runtime_error("corrupt binary format");
-
-        // read buffer bytes
-        if (load_bin) {
-            buffer_bytes.resize(buffer_length);
-            gltf_fread(f, buffer_bytes.data(), (int)buffer_bytes.size());
-        }
     }
+    if (load_bin) buffer_bytes = read_bytes(buffer_length);
 
     // load json
-    auto js = json();
-    try {
-        json_bytes.push_back(0);
-        js = json::parse(json_bytes.data());
-    } catch (const std::exception& e) {
-        throw std::runtime_error(
-            std::string("could not load json with error ") + e.what());
-    }
+    if (json_dom) {
+        auto js = json();
+        try {
+            js = json::parse(json_bytes, json_bytes + json_length);
+        } catch (const std::exception& e) {
+            throw std::runtime_error(
+                std::string("could not load json with error ") + e.what());
+        }
 
-    // parse json
-    auto gltf_ = gltf.get();
-    try {
-        serialize(gltf_, js, true);
-    } catch (const std::exception& e) {
-        throw std::runtime_error(
-            "cannot parse gltf json " + std::string(e.what()));
-        return nullptr;
+        // parse json
+        auto gltf_ = gltf.get();
+        try {
+            serialize(gltf_, js, true);
+        } catch (const std::exception& e) {
+            throw std::runtime_error(
+                "cannot parse gltf json " + std::string(e.what()));
+        }
+    } else {
+        try {
+            read_json_text(*gltf, json_bytes, json_bytes + json_length);
+        } catch (const std::exception& e) {
+            throw std::runtime_error(
+                "cannot parse gltf json " + std::string(e.what()));
+        }
     }
 
     // fix internal buffer
     auto buffer = gltf->buffers.at(0);
     buffer->byteLength = buffer_length;
     if (version == 2) buffer->uri = "";
-    if (load_bin) { buffer->data = buffer_bytes; }
+    if (load_bin) {
+        auto bytes = (const byte*)buffer_bytes;
+        buffer->data.assign(bytes, bytes + buffer_length);
+    }
 
     // load external resources
     auto dirname = path_dirname(filename);
     if (load_bin) load_buffers(gltf.get(), dirname, skip_missing);
     if (load_image) load_images(gltf.get(), dirname, skip_missing);
 
-    // close
-    fclose(f);
-
     // done
     return gltf.release();
 }
@@ -8711,6 +11785,588 @@ void save_binary_gltf(const std::string& filename, const glTF* gltf,
     if (save_image) save_images(gltf, dirname, false);
 }
 
+// Accessor of a streamed binary gltf. Data is read from the scene when the
+// binary chunk is written.
+struct gltf_stream_accessor {
+    const void* data = nullptr;                 // data written as is
+    const std::vector<vec4i>* quads = nullptr;  // quads written as triangles
+    std::vector<float> values;                  // data owned by the accessor
+    size_t offset = 0, size = 0;                // range in the binary chunk
+    int count = 0, ncomp = 0;                   // number of values
+    bool indices = false;                       // unsigned int indices
+    bool bounds = false;                        // write min and max
+};
+
+// Checks whether two materials are converted to the same gltf material.
+inline bool same_gltf_material(const material* a, const material* b) {
+    auto same_info = [](const texture_info* a, const texture_info* b) {
+        if (!a || !b) return a == b;
+        return a->wrap_s == b->wrap_s && a->wrap_t == b->wrap_t &&
+               a->linear == b->linear && a->mipmap == b->mipmap &&
+               a->scale == b->scale;
+    };
+    return a->type == b->type && a->double_sided == b->double_sided &&
+           a->ke == b->ke && a->kd == b->kd && a->ks == b->ks &&
+           a->rs == b->rs && a->op == b->op && a->ke_txt == b->ke_txt &&
+           a->kd_txt == b->kd_txt && a->ks_txt == b->ks_txt &&
+           a->norm_txt == b->norm_txt && a->occ_txt == b->occ_txt &&
+           same_info(a->ke_txt_info, b->ke_txt_info) &&
+           same_info(a->kd_txt_info, b->kd_txt_info) &&
+           same_info(a->ks_txt_info, b->ks_txt_info) &&
+           same_info(a->norm_txt_info, b->norm_txt_info) &&
+           same_info(a->occ_txt_info, b->occ_txt_info);
+}
+
+// Save a scene as a binary gltf without building the glTF object graph.
+// The json is written to the file as the scene is traversed and the binary
+// chunk is written from the shape arrays, so the only memory used besides
+// the scene is for the accessor list. The chunk lengths are patched in the
+// header at the end. Identical accessors are shared and materials that
+// differ only by name are merged.
+void save_binary_gltf_scene(
+    const std::string& filename, const scene* scn, const save_options& opts) {
+    // open file
+    auto fs = fopen(filename.c_str(), "wb");
+    if (!fs) throw std::runtime_error("cannot open filename " + filename);
+    auto fs_guard = std::unique_ptr<FILE, int (*)(FILE*)>(fs, fclose);
+    auto write = [fs, &filename](const void* data, size_t size) {
+        if (size && fwrite(data, 1, size, fs) != size)
+            throw std::runtime_error("cannot write file " + filename);
+    };
+    auto write_uint = [&write](uint32_t val) { write(&val, 4); };
+
+    // json text, flushed to file as it grows
+    auto w = text_writer();
+    w.precision = 9;
+    auto flush = [&w, fs, &filename](bool force) {
+        if (force || w.text.size() > (1 << 20)) w.flush(fs, filename);
+    };
+    auto write_floats = [&w](const float* vals, int num) {
+        w.write('[');
+        for (auto i = 0; i < num; i++) {
+            if (i) w.write(',');
+            // json integers have no negative zero
+            if (vals[i] == 0 && std::signbit(vals[i])) {
+                w.write("-0.0");
+            } else {
+                w.write(vals[i]);
+            }
+        }
+        w.write(']');
+    };
+
+    // header and json chunk header, patched at the end
+    for (auto i = 0; i < 5; i++) write_uint(0);
+
+    // index of an object
+    auto make_index_map = [](const auto& vec) {
+        auto map = std::unordered_map<const void*, int>();
+        for (auto idx = 0; idx < (int)vec.size(); idx++)
+            map.insert({vec[idx], idx});
+        return map;
+    };
+    auto find_index = [](const auto& map, const void* val) -> int {
+        auto it = map.find(val);
+        return (it == map.end()) ? -1 : it->second;
+    };
+    auto texture_ids = make_index_map(scn->textures);
+    auto camera_ids = make_index_map(scn->cameras);
+    auto shape_ids = make_index_map(scn->shapes);
+    auto node_ids = make_index_map(scn->nodes);
+
+    // asset
+    w.write("{\"asset\":{\"generator\":\"Yocto/gltf\",\"version\":\"2.0\"}");
+
+    // cameras
+    if (!scn->cameras.empty()) {
+        w.write(",\"cameras\":[");
+        for (auto cid = 0; cid < (int)scn->cameras.size(); cid++) {
+            auto cam = scn->cameras[cid];
+            if (cid) w.write(',');
+            w.write("{\"name\":");
+            w.write_json(cam->name);
+            if (cam->ortho) {
+                w.write(",\"type\":\"orthographic\",\"orthographic\":{");
+                w.write("\"xmag\":", cam->aspect * cam->yfov, ",\"ymag\":",
+                    cam->yfov, ",\"zfar\":", cam->far, ",\"znear\":",
+                    cam->near, "}}");
+            } else {
+                w.write(",\"type\":\"perspective\",\"perspective\":{");
+                w.write("\"aspectRatio\":", cam->aspect, ",\"yfov\":",
+                    cam->yfov, ",\"zfar\":", cam->far, ",\"znear\":",
+                    cam->near, "}}");
+            }
+        }
+        w.write(']');
+    }
+
+    // images
+    if (!scn->textures.empty()) {
+        w.write(",\"images\":[");
+        for (auto tid = 0; tid < (int)scn->textures.size(); tid++) {
+            if (tid) w.write(',');
+            w.write("{\"uri\":");
+            w.write_json(scn->textures[tid]->path);
+            w.write('}');
+        }
+        w.write(']');
+    }
+
+    // textures and samplers are created for each use
+    auto textures = std::vector<std::pair<int, int>>();
+    auto samplers = std::vector<const texture_info*>();
+    auto write_texture_info = [&](const char* name, const texture* txt,
+                                  const texture_info* info, const char* scale) {
+        if (!txt) return;
+        auto is_default = !info || (info->wrap_s && info->wrap_t &&
+                                       info->linear && info->mipmap);
+        textures.push_back({find_index(texture_ids, txt), -1});
+        if (!is_default) {
+            textures.back().second = (int)samplers.size();
+            samplers.push_back(info);
+        }
+        w.write(",\"", name, "\":{\"index\":", (int)textures.size() - 1);
+        if (scale) w.write(",\"", scale, "\":", (info) ? info->scale : 1.0f);
+        w.write('}');
+    };
+
+    // materials; they are few, so duplicates are found by pairwise comparison
+    auto material_ids = std::unordered_map<const void*, int>();
+    auto nmaterials = 0;
+    if (!scn->materials.empty()) w.write(",\"materials\":[");
+    for (auto mid = 0; mid < (int)scn->materials.size(); mid++) {
+        auto mat = scn->materials[mid];
+        if (material_ids.count(mat)) continue;
+        auto found = -1;
+        for (auto pid = 0; pid < mid && found < 0; pid++) {
+            if (same_gltf_material(scn->materials[pid], mat))
+                found = material_ids.at(scn->materials[pid]);
+        }
+        if (found >= 0) {
+            material_ids[mat] = found;
+            continue;
+        }
+        material_ids[mat] = nmaterials++;
+        if (nmaterials > 1) w.write(',');
+        w.write("{\"name\":");
+        w.write_json(mat->name);
+        w.write(",\"emissiveFactor\":");
+        write_floats(&mat->ke.x, 3);
+        write_texture_info(
+            "emissiveTexture", mat->ke_txt, mat->ke_txt_info, nullptr);
+        auto kd = vec4f{mat->kd.x, mat->kd.y, mat->kd.z, mat->op};
+        if (mat->type == material_type::metallic_roughness) {
+            w.write(",\"pbrMetallicRoughness\":{\"baseColorFactor\":");
+            write_floats(&kd.x, 4);
+            w.write(",\"metallicFactor\":", mat->ks.x, ",\"roughnessFactor\":",
+                mat->rs);
+            write_texture_info(
+                "baseColorTexture", mat->kd_txt, mat->kd_txt_info, nullptr);
+            write_texture_info("metallicRoughnessTexture", mat->ks_txt,
+                mat->ks_txt_info, nullptr);
+            w.write('}');
+        }
+        write_texture_info(
+            "normalTexture", mat->norm_txt, mat->norm_txt_info, "scale");
+        write_texture_info(
+            "occlusionTexture", mat->occ_txt, mat->occ_txt_info, "strength");
+        if (mat->double_sided) w.write(",\"doubleSided\":true");
+        if (mat->type != material_type::metallic_roughness) {
+            auto gloss = (mat->type == material_type::specular_roughness) ?
+                             1 - mat->rs :
+                             mat->rs;
+            w.write(",\"extensions\":{\"KHR_materials_pbrSpecularGlossiness\":"
+                    "{\"diffuseFactor\":");
+            write_floats(&kd.x, 4);
+            w.write(",\"specularFactor\":");
+            write_floats(&mat->ks.x, 3);
+            w.write(",\"glossinessFactor\":", gloss);
+            write_texture_info(
+                "diffuseTexture", mat->kd_txt, mat->kd_txt_info, nullptr);
+            write_texture_info("specularGlossinessTexture", mat->ks_txt,
+                mat->ks_txt_info, nullptr);
+            w.write("}}");
+        }
+        w.write('}');
+    }
+    if (!scn->materials.empty()) w.write(']');
+
+    // accessors, shared if identical
+    auto accessors = std::vector<gltf_stream_accessor>();
+    auto accessor_map = std::unordered_multimap<uint64_t, int>();
+    auto buffer_size = (size_t)0;
+    auto accessor_data = [](const gltf_stream_accessor& acc) {
+        if (acc.quads) return (const void*)acc.quads->data();
+        if (!acc.values.empty()) return (const void*)acc.values.data();
+        return acc.data;
+    };
+    auto add_accessor = [&](gltf_stream_accessor&& acc, size_t data_size) {
+        auto data = (const byte*)accessor_data(acc);
+        auto hash = hash_bytes(data, data_size);
+        auto range = accessor_map.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            auto& other = accessors[it->second];
+            if (other.count != acc.count || other.ncomp != acc.ncomp ||
+                other.indices != acc.indices ||
+                (other.quads != nullptr) != (acc.quads != nullptr) ||
+                (acc.quads && other.quads->size() != acc.quads->size()))
+                continue;
+            if (!memcmp(accessor_data(other), data, data_size))
+                return it->second;
+        }
+        acc.offset = buffer_size;
+        acc.size = (size_t)acc.count * (size_t)acc.ncomp * 4;
+        buffer_size += acc.size;
+        accessors.push_back(std::move(acc));
+        accessor_map.insert({hash, (int)accessors.size() - 1});
+        return (int)accessors.size() - 1;
+    };
+    auto add_values = [&](const auto& vals, int ncomp, bool bounds = false) {
+        auto acc = gltf_stream_accessor();
+        acc.data = vals.data();
+        acc.count = (int)vals.size();
+        acc.ncomp = ncomp;
+        acc.bounds = bounds;
+        return add_accessor(std::move(acc), vals.size() * sizeof(vals[0]));
+    };
+    auto add_indices = [&](const auto& elems, int ncomp) {
+        auto acc = gltf_stream_accessor();
+        acc.data = elems.data();
+        acc.count = (int)elems.size() * ncomp;
+        acc.ncomp = 1;
+        acc.indices = true;
+        return add_accessor(std::move(acc), elems.size() * sizeof(elems[0]));
+    };
+
+    // meshes
+    if (!scn->shapes.empty()) {
+        w.write(",\"meshes\":[");
+        for (auto sid = 0; sid < (int)scn->shapes.size(); sid++) {
+            auto sgr = scn->shapes[sid];
+            if (sid) w.write(',');
+            w.write("{\"name\":");
+            w.write_json(sgr->name);
+            w.write(",\"primitives\":[");
+            for (auto pid = 0; pid < (int)sgr->shapes.size(); pid++) {
+                auto shp = sgr->shapes[pid];
+                if (pid) w.write(',');
+                w.write("{\"attributes\":{");
+                auto sep = "";
+                auto write_attribute = [&](const char* name, int aid) {
+                    w.write(sep, '"', name, "\":", aid);
+                    sep = ",";
+                };
+                if (!shp->pos.empty())
+                    write_attribute("POSITION", add_values(shp->pos, 3, true));
+                if (!shp->norm.empty())
+                    write_attribute("NORMAL", add_values(shp->norm, 3));
+                if (!shp->texcoord.empty())
+                    write_attribute("TEXCOORD_0", add_values(shp->texcoord, 2));
+                if (!shp->texcoord1.empty())
+                    write_attribute(
+                        "TEXCOORD_1", add_values(shp->texcoord1, 2));
+                if (!shp->color.empty())
+                    write_attribute("COLOR_0", add_values(shp->color, 4));
+                if (!shp->radius.empty())
+                    write_attribute("RADIUS", add_values(shp->radius, 1));
+                w.write('}');
+                if (!shp->points.empty()) {
+                    w.write(",\"indices\":", add_indices(shp->points, 1),
+                        ",\"mode\":0");
+                } else if (!shp->lines.empty()) {
+                    w.write(",\"indices\":", add_indices(shp->lines, 2),
+                        ",\"mode\":1");
+                } else if (!shp->triangles.empty()) {
+                    w.write(",\"indices\":", add_indices(shp->triangles, 3),
+                        ",\"mode\":4");
+                } else if (!shp->quads.empty()) {
+                    auto acc = gltf_stream_accessor();
+                    acc.quads = &shp->quads;
+                    for (auto& q : shp->quads)
+                        acc.count += (q.z != q.w) ? 6 : 3;
+                    acc.ncomp = 1;
+                    acc.indices = true;
+                    auto aid = add_accessor(
+                        std::move(acc), shp->quads.size() * sizeof(vec4i));
+                    w.write(",\"indices\":", aid, ",\"mode\":4");
+                } else if (!shp->quads_pos.empty()) {
+                    throw std::runtime_error(
+                        "face varying not supported in glTF");
+                } else {
+                    throw std::runtime_error("empty mesh");
+                }
+                auto mid = find_index(material_ids, shp->mat);
+                if (mid >= 0) w.write(",\"material\":", mid);
+                w.write('}');
+            }
+            w.write("]}");
+            flush(false);
+        }
+        w.write(']');
+    }
+
+    // nodes, with an identity matrix or a default transform omitted
+    auto write_node = [&](const std::string& name, const frame3f& frame,
+                          int mesh, int camera) {
+        w.write("{\"name\":");
+        w.write_json(name);
+        if (mesh >= 0) w.write(",\"mesh\":", mesh);
+        if (camera >= 0) w.write(",\"camera\":", camera);
+        if (frame != identity_frame3f) {
+            auto mat = frame_to_mat(frame);
+            w.write(",\"matrix\":");
+            write_floats(&mat.x.x, 16);
+        }
+    };
+    auto roots = std::vector<int>();
+    w.write(",\"nodes\":[");
+    if (scn->nodes.empty()) {
+        for (auto ist : scn->instances) {
+            if (!roots.empty()) w.write(',');
+            roots.push_back((int)roots.size());
+            write_node(
+                ist->name, ist->frame, find_index(shape_ids, ist->shp), -1);
+            w.write('}');
+            flush(false);
+        }
+        for (auto cam : scn->cameras) {
+            if (!roots.empty()) w.write(',');
+            roots.push_back((int)roots.size());
+            write_node(cam->name, cam->frame, -1, find_index(camera_ids, cam));
+            w.write('}');
+        }
+    } else {
+        auto children = std::vector<std::vector<int>>(scn->nodes.size());
+        for (auto idx = 0; idx < (int)scn->nodes.size(); idx++) {
+            auto nde = scn->nodes[idx];
+            if (nde->parent) {
+                children.at(find_index(node_ids, nde->parent)).push_back(idx);
+            } else {
+                roots.push_back(idx);
+            }
+        }
+        for (auto idx = 0; idx < (int)scn->nodes.size(); idx++) {
+            auto nde = scn->nodes[idx];
+            if (idx) w.write(',');
+            write_node(nde->name, nde->frame,
+                (nde->ist) ? find_index(shape_ids, nde->ist->shp) : -1,
+                find_index(camera_ids, nde->cam));
+            if (!children[idx].empty()) {
+                w.write(",\"children\":[");
+                for (auto cid = 0; cid < (int)children[idx].size(); cid++) {
+                    if (cid) w.write(',');
+                    w.write(children[idx][cid]);
+                }
+                w.write(']');
+            }
+            if (nde->translation != zero3f) {
+                w.write(",\"translation\":");
+                write_floats(&nde->translation.x, 3);
+            }
+            if (nde->rotation != quat4f{0, 0, 0, 1}) {
+                w.write(",\"rotation\":");
+                write_floats(&nde->rotation.x, 4);
+            }
+            if (nde->scaling != vec3f{1, 1, 1}) {
+                w.write(",\"scale\":");
+                write_floats(&nde->scaling.x, 3);
+            }
+            w.write('}');
+            flush(false);
+        }
+    }
+    w.write(']');
+
+    // scene with root nodes
+    if (!roots.empty()) {
+        w.write(",\"scene\":0,\"scenes\":[{\"name\":\"scene\",\"nodes\":[");
+        for (auto idx = 0; idx < (int)roots.size(); idx++) {
+            if (idx) w.write(',');
+            w.write(roots[idx]);
+            flush(false);
+        }
+        w.write("]}]");
+    }
+
+    // animations
+    static const auto interpolation_names =
+        std::map<keyframe_type, std::string>{{keyframe_type::step, "STEP"},
+            {keyframe_type::linear, "LINEAR"},
+            {keyframe_type::bezier, "CUBICSPLINE"},
+            {keyframe_type::catmull_rom, "CATMULLROMSPLINE"}};
+    if (!scn->animations.empty()) {
+        w.write(",\"animations\":[");
+        for (auto gid = 0; gid < (int)scn->animations.size(); gid++) {
+            auto agr = scn->animations[gid];
+            if (gid) w.write(',');
+            w.write("{\"name\":");
+            w.write_json(agr->name);
+            w.write(",\"samplers\":[");
+            auto paths = std::unordered_map<const animation*, std::string>();
+            for (auto kid = 0; kid < (int)agr->animations.size(); kid++) {
+                auto anm = agr->animations[kid];
+                if (kid) w.write(',');
+                auto input = add_values(anm->times, 1);
+                auto output = -1;
+                if (!anm->translation.empty()) {
+                    output = add_values(anm->translation, 3);
+                    paths[anm] = "translation";
+                } else if (!anm->rotation.empty()) {
+                    output = add_values(anm->rotation, 4);
+                    paths[anm] = "rotation";
+                } else if (!anm->scaling.empty()) {
+                    output = add_values(anm->scaling, 3);
+                    paths[anm] = "scale";
+                } else if (!anm->weights.empty()) {
+                    auto acc = gltf_stream_accessor();
+                    for (auto& weights : anm->weights)
+                        acc.values.insert(
+                            acc.values.end(), weights.begin(), weights.end());
+                    acc.count = (int)acc.values.size();
+                    acc.ncomp = 1;
+                    auto size = acc.values.size() * sizeof(float);
+                    output = add_accessor(std::move(acc), size);
+                    paths[anm] = "weights";
+                } else {
+                    throw std::runtime_error("should not have gotten here");
+                }
+                w.write("{\"input\":", input, ",\"output\":", output,
+                    ",\"interpolation\":\"",
+                    interpolation_names.at(anm->type), "\"}");
+            }
+            w.write("],\"channels\":[");
+            auto sep = "";
+            for (auto target : agr->targets) {
+                auto sid = (int)(std::find(agr->animations.begin(),
+                                     agr->animations.end(), target.first) -
+                                 agr->animations.begin());
+                w.write(sep, "{\"sampler\":", sid, ",\"target\":{\"node\":",
+                    find_index(node_ids, target.second), ",\"path\":\"",
+                    paths.at(target.first), "\"}}");
+                sep = ",";
+            }
+            w.write("]}");
+        }
+        w.write(']');
+    }
+
+    // textures and samplers
+    if (!textures.empty()) {
+        w.write(",\"textures\":[");
+        for (auto tid = 0; tid < (int)textures.size(); tid++) {
+            if (tid) w.write(',');
+            w.write("{\"source\":", textures[tid].first);
+            if (textures[tid].second >= 0)
+                w.write(",\"sampler\":", textures[tid].second);
+            w.write('}');
+        }
+        w.write(']');
+    }
+    if (!samplers.empty()) {
+        w.write(",\"samplers\":[");
+        for (auto sid = 0; sid < (int)samplers.size(); sid++) {
+            auto info = samplers[sid];
+            if (sid) w.write(',');
+            w.write("{\"wrapS\":", (info->wrap_s) ? 10497 : 33071,
+                ",\"wrapT\":", (info->wrap_t) ? 10497 : 33071,
+                ",\"minFilter\":", (info->mipmap) ? 9987 : 9728,
+                ",\"magFilter\":", (info->linear) ? 9729 : 9728, '}');
+        }
+        w.write(']');
+    }
+
+    // accessors and buffer views, one for each accessor
+    if (!accessors.empty()) {
+        static const char* type_names[] = {
+            "", "SCALAR", "VEC2", "VEC3", "VEC4"};
+        w.write(",\"accessors\":[");
+        for (auto aid = 0; aid < (int)accessors.size(); aid++) {
+            auto& acc = accessors[aid];
+            if (aid) w.write(',');
+            w.write("{\"bufferView\":", aid, ",\"componentType\":",
+                (acc.indices) ? 5125 : 5126, ",\"count\":", acc.count,
+                ",\"type\":\"", type_names[acc.ncomp], '"');
+            if (acc.bounds && acc.ncomp == 3 && acc.count) {
+                auto bbox = make_bbox(acc.count, (const vec3f*)acc.data);
+                w.write(",\"max\":");
+                write_floats(&bbox.max.x, 3);
+                w.write(",\"min\":");
+                write_floats(&bbox.min.x, 3);
+            }
+            w.write('}');
+            flush(false);
+        }
+        w.write("],\"bufferViews\":[");
+        for (auto aid = 0; aid < (int)accessors.size(); aid++) {
+            auto& acc = accessors[aid];
+            if (aid) w.write(',');
+            w.write("{\"buffer\":0,\"byteLength\":", (int)acc.size,
+                ",\"byteOffset\":", (int)acc.offset, ",\"target\":34962}");
+            flush(false);
+        }
+        w.write(']');
+    }
+    if (buffer_size > (size_t)std::numeric_limits<int>::max())
+        throw std::runtime_error("scene too large for binary gltf");
+    w.write(",\"buffers\":[{\"byteLength\":", (int)buffer_size, "}]}");
+
+    // pad the json with spaces
+    auto json_length = ftell(fs) - 20 + (long)w.text.size();
+    while (json_length % 4) {
+        w.write(' ');
+        json_length++;
+    }
+    flush(true);
+
+    // binary chunk, with quads converted a block at a time
+    auto buffer_length = (buffer_size + 3) / 4 * 4;
+    write_uint((uint32_t)buffer_length);
+    write_uint(0x004E4942);
+    for (auto& acc : accessors) {
+        if (acc.quads) {
+            auto& quads = *acc.quads;
+            for (auto start = (size_t)0; start < quads.size();
+                 start += 1 << 16) {
+                auto end = min(start + (1 << 16), quads.size());
+                auto triangles = convert_quads_to_triangles(
+                    {quads.begin() + start, quads.begin() + end});
+                write(triangles.data(), triangles.size() * sizeof(vec3i));
+            }
+        } else {
+            write(accessor_data(acc), acc.size);
+        }
+    }
+    auto pad = std::array<byte, 4>{{0, 0, 0, 0}};
+    write(pad.data(), buffer_length - buffer_size);
+
+    // patch the header
+    if (fseek(fs, 0, SEEK_SET))
+        throw std::runtime_error("cannot write file " + filename);
+    write_uint(0x46546C67);
+    write_uint(2);
+    write_uint((uint32_t)(12 + 8 + json_length + 8 + buffer_length));
+    write_uint((uint32_t)json_length);
+    write_uint(0x4E4F534A);
+
+    // save textures from the scene
+    if (!opts.save_textures) return;
+    auto dirname = path_dirname(filename);
+    for (auto txt : scn->textures) {
+        auto ok = false;
+#if YGL_IMAGEIO
+        if (!txt->ldr.empty()) {
+            ok = save_image(dirname + txt->path, txt->ldr.width(),
+                txt->ldr.height(), 4, (const byte*)data(txt->ldr));
+        } else if (!txt->hdr.empty()) {
+            ok = save_imagef(dirname + txt->path, txt->hdr.width(),
+                txt->hdr.height(), 4, (const float*)data(txt->hdr));
+        }
+#endif
+        if (!ok && !opts.skip_missing)
+            throw std::runtime_error("cannot save image " + txt->path);
+    }
+}
+
 accessor_view::accessor_view(const glTF* gltf, const glTFAccessor* accessor) {
     _size = accessor->count;
     _ncomp = _num_components(accessor->type);
@@ -8738,7 +12394,8 @@ float accessor_view::get(int idx, int c) const {
         switch (_ctype) {
             case glTFAccessorComponentType::Float:
                 return (float)(*(float*)valb);
-            case glTFAccessorComponentType::Byte: return (float)(*(char*)valb);
+            case glTFAccessorComponentType::Byte:
+                return (float)(*(int8_t*)valb);
             case glTFAccessorComponentType::UnsignedByte:
                 return (float)(*(unsigned char*)valb);
             case glTFAccessorComponentType::Short:
@@ -8757,15 +12414,16 @@ float accessor_view::get(int idx, int c) const {
             case glTFAccessorComponentType::Float:
                 return (float)(*(float*)valb);
             case glTFAccessorComponentType::Byte:
-                return (float)max((float)(c / 127.0), -1.0f);
+                return (float)max((float)(*(int8_t*)valb / 127.0), -1.0f);
             case glTFAccessorComponentType::UnsignedByte:
-                return (float)(c / 255.0);
+                return (float)(*(unsigned char*)valb / 255.0);
             case glTFAccessorComponentType::Short:
-                return (float)(max((float)(c / 32767.0), -1.0f));
+                return (float)(max((float)(*(short*)valb / 32767.0), -1.0f));
             case glTFAccessorComponentType::UnsignedShort:
-                return (float)(c / 65535.0);
+                return (float)(*(unsigned short*)valb / 65535.0);
             case glTFAccessorComponentType::UnsignedInt:
-                return (float)(max((float)(c / 2147483647.0), -1.0f));
+                return (float)(max(
+                    (float)(*(unsigned int*)valb / 2147483647.0), -1.0f));
             case glTFAccessorComponentType::NotSet:
                 throw std::runtime_error("bad enum value");
                 break;
@@ -8781,7 +12439,7 @@ int accessor_view::geti(int idx, int c) const {
     // precision
     switch (_ctype) {
         case glTFAccessorComponentType::Float: return (int)(*(float*)valb);
-        case glTFAccessorComponentType::Byte: return (int)(*(char*)valb);
+        case glTFAccessorComponentType::Byte: return (int)(*(int8_t*)valb);
         case glTFAccessorComponentType::UnsignedByte:
             return (int)(*(unsigned char*)valb);
         case glTFAccessorComponentType::Short: return (int)(*(short*)valb);
@@ -8796,6 +12454,91 @@ int accessor_view::geti(int idx, int c) const {
     return 0;
 }
 
+// Converts the values of an accessor with components of type T into
+// elements of nvals components, normalizing by norm if not zero.
+template <typename T, typename R>
+void get_accessor_values(const unsigned char* data, int size, int stride,
+    int ncomp, R* vals, int nvals, double norm) {
+    for (auto idx = 0; idx < size; idx++) {
+        auto valb = data + (size_t)stride * idx;
+        auto val = vals + (size_t)nvals * idx;
+        for (auto c = 0; c < ncomp; c++) {
+            auto v = T();
+            memcpy(&v, valb + c * sizeof(T), sizeof(T));
+            val[c] = (norm) ? (R)max((float)(v / norm), -1.0f) : (R)v;
+        }
+    }
+}
+
+template <typename T>
+void accessor_view::_get_all(T* vals, int nvals, bool normalize) const {
+    auto ncomp = min(_ncomp, nvals);
+    // tightly packed data of the same type is copied in bulk
+    auto same_type =
+        (std::is_same<T, float>::value &&
+            _ctype == glTFAccessorComponentType::Float) ||
+        (std::is_same<T, int>::value &&
+            _ctype == glTFAccessorComponentType::UnsignedInt);
+    if (same_type && ncomp == nvals && _stride == (int)sizeof(T) * nvals) {
+        memcpy(vals, _data, (size_t)_size * _stride);
+        return;
+    }
+    switch (_ctype) {
+        case glTFAccessorComponentType::Float:
+            get_accessor_values<float>(
+                _data, _size, _stride, ncomp, vals, nvals, 0);
+            break;
+        case glTFAccessorComponentType::Byte:
+            get_accessor_values<int8_t>(_data, _size, _stride, ncomp, vals,
+                nvals, (normalize) ? 127.0 : 0);
+            break;
+        case glTFAccessorComponentType::UnsignedByte:
+            get_accessor_values<unsigned char>(_data, _size, _stride, ncomp,
+                vals, nvals, (normalize) ? 255.0 : 0);
+            break;
+        case glTFAccessorComponentType::Short:
+            get_accessor_values<short>(_data, _size, _stride, ncomp, vals,
+                nvals, (normalize) ? 32767.0 : 0);
+            break;
+        case glTFAccessorComponentType::UnsignedShort:
+            get_accessor_values<unsigned short>(_data, _size, _stride, ncomp,
+                vals, nvals, (normalize) ? 65535.0 : 0);
+            break;
+        case glTFAccessorComponentType::UnsignedInt:
+            get_accessor_values<unsigned int>(_data, _size, _stride, ncomp,
+                vals, nvals, (normalize) ? 2147483647.0 : 0);
+            break;
+        case glTFAccessorComponentType::NotSet:
+            throw std::runtime_error("bad enum value");
+            break;
+    }
+}
+
+void accessor_view::get_all(std::vector<float>& vals) const {
+    vals.assign(_size, 0);
+    _get_all(vals.data(), 1, _normalize);
+}
+
+void accessor_view::get_all(std::vector<vec2f>& vals, const vec2f& def) const {
+    vals.assign(_size, def);
+    _get_all((float*)vals.data(), 2, _normalize);
+}
+
+void accessor_view::get_all(std::vector<vec3f>& vals, const vec3f& def) const {
+    vals.assign(_size, def);
+    _get_all((float*)vals.data(), 3, _normalize);
+}
+
+void accessor_view::get_all(std::vector<vec4f>& vals, const vec4f& def) const {
+    vals.assign(_size, def);
+    _get_all((float*)vals.data(), 4, _normalize);
+}
+
+void accessor_view::get_all(std::vector<int>& vals) const {
+    vals.assign(_size, 0);
+    _get_all(vals.data(), 1, false);
+}
+
 int accessor_view::_num_components(glTFAccessorType type) {
     switch (type) {
         case glTFAccessorType::Scalar: return 1;
@@ -11047,30 +14790,139 @@ void serialize(proc_scene& val, json& js, bool reading) {
         val.environments, js, "environments", reading, false, def.environments);
 }
 
+// Reads a proc_camera object
+void read_json_attrs(proc_camera& val, json_reader& jr, json_key& key) {
+    read_json_attr(val.name, jr, key, "name");
+    read_json_attr(val.from, jr, key, "from");
+    read_json_attr(val.to, jr, key, "to");
+    read_json_attr(val.yfov, jr, key, "yfov");
+    read_json_attr(val.aspect, jr, key, "aspect");
+}
+
+// Reads a proc_texture_type enum
+void read_json(proc_texture_type& val, json_reader& jr) {
+    read_json(val, jr, enum_names(val));
+}
+
+// Reads a proc_texture object
+void read_json_attrs(proc_texture& val, json_reader& jr, json_key& key) {
+    read_json_attr(val.name, jr, key, "name");
+    read_json_attr(val.type, jr, key, "type");
+    read_json_attr(val.resolution, jr, key, "resolution");
+    read_json_attr(val.tile_size, jr, key, "tile_size", false);
+    read_json_attr(val.noise_scale, jr, key, "noise_scale", false);
+    read_json_attr(val.sky_sunangle, jr, key, "sky_sunangle", false);
+    read_json_attr(val.bump_to_normal, jr, key, "bump_to_normal", false);
+    read_json_attr(val.bump_scale, jr, key, "bump_scale", false);
+}
+
+// Reads a proc_material_type enum
+void read_json(proc_material_type& val, json_reader& jr) {
+    read_json(val, jr, enum_names(val));
+}
+
+// Reads a proc_material object
+void read_json_attrs(proc_material& val, json_reader& jr, json_key& key) {
+    read_json_attr(val.name, jr, key, "name");
+    read_json_attr(val.type, jr, key, "type");
+    read_json_attr(val.emission, jr, key, "emission", false);
+    read_json_attr(val.color, jr, key, "color", false);
+    read_json_attr(val.opacity, jr, key, "opacity", false);
+    read_json_attr(val.roughness, jr, key, "roughness", false);
+    read_json_attr(val.texture, jr, key, "texture", false);
+    read_json_attr(val.normal, jr, key, "normal", false);
+}
+
+// Reads a proc_shape_type enum
+void read_json(proc_shape_type& val, json_reader& jr) {
+    read_json(val, jr, enum_names(val));
+}
+
+// Reads a proc_shape object
+void read_json_attrs(proc_shape& val, json_reader& jr, json_key& key) {
+    read_json_attr(val.name, jr, key, "name");
+    read_json_attr(val.type, jr, key, "type");
+    read_json_attr(val.material, jr, key, "material", false);
+    read_json_attr(val.tesselation, jr, key, "tesselation", false);
+    read_json_attr(val.subdivision, jr, key, "subdivision", false);
+    read_json_attr(val.scale, jr, key, "scale", false);
+    read_json_attr(val.radius, jr, key, "radius", false);
+    read_json_attr(val.faceted, jr, key, "faceted", false);
+    read_json_attr(val.num, jr, key, "num", false);
+}
+
+// Reads a proc_instance object
+void read_json_attrs(proc_instance& val, json_reader& jr, json_key& key) {
+    read_json_attr(val.name, jr, key, "name");
+    read_json_attr(val.shape, jr, key, "shape");
+    read_json_attr(val.frame, jr, key, "frame", false);
+    read_json_attr(val.rotation, jr, key, "rotation", false);
+}
+
+// Reads a proc_environment object
+void read_json_attrs(proc_environment& val, json_reader& jr, json_key& key) {
+    read_json_attr(val.name, jr, key, "name");
+    read_json_attr(val.emission, jr, key, "emission", false);
+    read_json_attr(val.color, jr, key, "color", false);
+    read_json_attr(val.texture, jr, key, "texture", false);
+    read_json_attr(val.frame, jr, key, "frame", false);
+    read_json_attr(val.rotation, jr, key, "rotation", false);
+}
+
+// Reads a proc_scene object
+void read_json_attrs(proc_scene& val, json_reader& jr, json_key& key) {
+    read_json_attr(val.name, jr, key, "name", false);
+    read_json_attr(val.cameras, jr, key, "cameras", false);
+    read_json_attr(val.textures, jr, key, "textures", false);
+    read_json_attr(val.materials, jr, key, "materials", false);
+    read_json_attr(val.shapes, jr, key, "shapes", false);
+    read_json_attr(val.environments, jr, key, "environments", false);
+}
+
 // Load test scene
-proc_scene* load_proc_scene(const std::string& filename) {
+proc_scene* load_proc_scene(const std::string& filename, bool json_dom) {
+    // clear data
+    auto scn = std::unique_ptr<proc_scene>(new proc_scene());
+
     // load json
-    std::ifstream stream(filename.c_str());
-    if (!stream) throw std::runtime_error("could not load json " + filename);
-    auto js = json();
-    try {
-        stream >> js;
-    } catch (const std::exception& e) {
-        throw std::runtime_error(
-            std::string("could not load json with error ") + e.what());
-    }
+    if (json_dom) {
+        std::ifstream stream(filename.c_str());
+        if (!stream)
+            throw std::runtime_error("could not load json " + filename);
+        auto js = json();
+        try {
+            stream >> js;
+        } catch (const std::exception& e) {
+            throw std::runtime_error(
+                std::string("could not load json with error ") + e.what());
+        }
 
-    // clear data
-    auto scn = new proc_scene();
-    try {
-        serialize(scn, js, true);
-    } catch (const std::exception& e) {
-        throw std::runtime_error(
-            "error parsing test scene " + std::string(e.what()));
+        // parse json
+        auto scn_ = scn.get();
+        try {
+            serialize(scn_, js, true);
+        } catch (const std::exception& e) {
+            throw std::runtime_error(
+                "error parsing test scene " + std::string(e.what()));
+        }
+    } else {
+        // read json from a view of the file
+        auto view = file_view();
+        try {
+            open_file_view(view, filename);
+        } catch (std::exception&) {
+            throw std::runtime_error("could not load json " + filename);
+        }
+        try {
+            read_json_text(*scn, view.data, view.data + view.size);
+        } catch (const std::exception& e) {
+            throw std::runtime_error(
+                "error parsing test scene " + std::string(e.what()));
+        }
     }
 
     // done
-    return scn;
+    return scn.release();
 }
 
 // Save test scene
@@ -324,6 +324,8 @@
 /// applications and tuned for quick creating viewers, renderers and simulators.
 ///
 /// 1. load a scene with `load_scene()` and save it with `save_scene()`.
+///    Scenes can be cached in the binary `.ybin` format, that stores
+///    decoded textures and reloads with bulk copies from a mapped file.
 /// 2. add missing data with `add_elements()`
 /// 3. use `compute_bounds()` to compute element bounds
 /// 4. can merge scene together with `merge_into()`
@@ -390,6 +392,9 @@
 /// 5. start the progressive renderer with `trace_async_start()`
 /// 7. stop the progressive renderer with `trace_async_stop()`
 ///
+/// Ambient occlusion and irradiance can also be baked in the texture space
+/// of shapes with texcoords using `trace_bake()`.
+///
 ///
 /// ### Wavefront OBJ
 ///
@@ -709,6 +714,7 @@ namespace ygl {}
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <cmath>
@@ -2570,6 +2576,16 @@ inline bbox<T, 3> line_bbox(
         v1 - vec<T, 3>{r1, r1, r1}, v1 + vec<T, 3>{r1, r1, r1}});
 }
 
+/// Cubic Bezier bounds, from the convex hull of the control points.
+template <typename T, typename T1>
+inline bbox<T, 3> bezier_bbox(const vec<T, 3>& v0, const vec<T, 3>& v1,
+    const vec<T, 3>& v2, const vec<T, 3>& v3, T1 r0 = 0, T1 r1 = 0, T1 r2 = 0,
+    T1 r3 = 0) {
+    auto r = max(max(r0, r1), max(r2, r3));
+    auto bbox = make_bbox({v0, v1, v2, v3});
+    return {bbox.min - vec<T, 3>{r, r, r}, bbox.max + vec<T, 3>{r, r, r}};
+}
+
 /// Triangle bounds.
 template <typename T>
 inline bbox<T, 3> triangle_bbox(
@@ -3424,6 +3440,59 @@ inline uint32_t hash_uint64_32(uint64_t a) {
     // clang-format on
 }
 
+/// Reverses the bits of a 32 bit integer.
+inline uint32_t reverse_bits(uint32_t x) {
+    // clang-format off
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+    // clang-format on
+}
+
+/// Owen scrambling of the bits of x keyed by seed, computed as a nested
+/// uniform scramble. From Practical Hash-based Owen Scrambling by Burley.
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+    // clang-format off
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu; x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u; x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+    // clang-format on
+}
+
+/// Computes the i-th term of the second dimension of the Sobol sequence in
+/// 32 bit fixed point. The first dimension is just reverse_bits(i).
+inline uint32_t sobol_dim1(uint32_t i) {
+    auto r = 0u;
+    for (auto v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+        if (i & 1) r ^= v;
+    return r;
+}
+
+/// Computes the i-th term of a 1D Owen-scrambled Sobol sequence keyed by p.
+/// The index is shuffled too, so that the sequence can be used to pad
+/// many independent dimensions. From Practical Hash-based Owen Scrambling by
+/// Burley.
+inline float sobol_owen1f(uint32_t i, uint32_t p) {
+    i = owen_scramble(i, p);
+    auto x = owen_scramble(reverse_bits(i), p * 0x9e3779b9u + 1);
+    return x * (1.0f / 4294967808.0f);
+}
+
+/// Computes the i-th term of a 2D Owen-scrambled Sobol sequence keyed by p.
+/// The index is shuffled too, so that the sequence can be used to pad
+/// many independent dimensions. From Practical Hash-based Owen Scrambling by
+/// Burley.
+inline vec2f sobol_owen2f(uint32_t i, uint32_t p) {
+    i = owen_scramble(i, p);
+    auto x = owen_scramble(reverse_bits(i), p * 0x9e3779b9u + 1);
+    auto y = owen_scramble(sobol_dim1(i), p * 0x9e3779b9u + 2);
+    return {x * (1.0f / 4294967808.0f), y * (1.0f / 4294967808.0f)};
+}
+
 /// Combines two 64 bit hashes as in boost::hash_combine.
 inline size_t hash_combine(size_t a, size_t b) {
     return a ^ (b + 0x9e3779b9 + (a << 6) + (a >> 2));
@@ -3907,7 +3976,7 @@ inline T interpolate_bezier(
 template <typename T, typename T1>
 inline T interpolate_bezier(const std::vector<T>& vals, const vec4i& b, T1 u) {
     if (vals.empty()) return T();
-    return eval_bezier(vals[b.x], vals[b.y], vals[b.z], vals[b.w], u);
+    return interpolate_bezier(vals[b.x], vals[b.y], vals[b.z], vals[b.w], u);
 }
 /// Computes the derivative of a cubic Bezier segment parametrized by u.
 template <typename T, typename T1>
@@ -4738,7 +4807,8 @@ image4f load_image4f(const std::string& filename);
 
 /// Saves a 4 channel ldr image.
 bool save_image4b(const std::string& filename, const image4b& img);
-/// Saves a 4 channel hdr image.
+/// Saves a 4 channel hdr image. EXR files are stored as zip compressed half
+/// floats.
 bool save_image4f(const std::string& filename, const image4f& img);
 
 /// Loads an image with variable number of channels.
@@ -4766,6 +4836,15 @@ bool save_image(const std::string& filename, int width, int height, int ncomp,
 bool save_image(const std::string& filename, const image4f& hdr, float exposure,
     float gamma, bool filmic = false);
 
+/// Saves 4 channel HDR images as layers of a single EXR file. Layer channels
+/// are named `<name>.R`, `<name>.G`, `<name>.B`, `<name>.A`, or just `R`, `G`,
+/// `B`, `A` for an empty name. All layers should have the same size.
+/// Channels are zip compressed in blocks of scanlines, encoded in parallel,
+/// and stored as half floats if `half` is set, or as floats otherwise.
+bool save_image4f_layers(const std::string& filename,
+    const std::vector<std::string>& names,
+    const std::vector<const image4f*>& layers, bool half = false);
+
 /// Filter type for resizing.
 enum struct resize_filter {
     /// default
@@ -4830,6 +4909,15 @@ bool intersect_point(const ray3f& ray, const vec3f& p, float r, float& ray_t);
 bool intersect_line(const ray3f& ray, const vec3f& v0, const vec3f& v1,
     float r0, float r1, float& ray_t, vec2f& euv);
 
+/// Intersect a ray with a cubic Bezier curve of varying radius (approximate).
+/// The curve is subdivided until flat with respect to its radius and the
+/// chords are intersected as lines, skipping the parts whose bounds are
+/// missed. Returns the curve parameter and the relative distance from the
+/// curve axis in `euv`, as for lines.
+bool intersect_bezier(const ray3f& ray, const vec3f& v0, const vec3f& v1,
+    const vec3f& v2, const vec3f& v3, float r0, float r1, float r2, float r3,
+    float& ray_t, vec2f& euv);
+
 /// Intersect a ray with a triangle.
 bool intersect_triangle(const ray3f& ray, const vec3f& v0, const vec3f& v1,
     const vec3f& v2, float& ray_t, vec2f& euv);
@@ -4917,6 +5005,8 @@ enum struct bvh_node_type : uint32_t {
     triangle = 3,
     /// Quads.
     quad = 4,
+    /// Cubic Bezier curves.
+    bezier = 5,
     /// Vertices.
     vertex = 8,
     /// Instances.
@@ -4983,12 +5073,17 @@ struct bvh_tree {
     std::vector<float> radius;
     /// Points for shape BVHs.
     std::vector<int> points;
-    /// Lines for shape BVHs.
+    /// Lines for shape BVHs. Long diagonal lines are referenced more than
+    /// once, each time bounding only part of the line.
     std::vector<vec2i> lines;
+    /// Parameter range of the part of each line bounded by the leaf.
+    std::vector<vec2f> line_ranges;
     /// Triangles for shape BVHs.
     std::vector<vec3i> triangles;
     /// Quads for shape BVHs.
     std::vector<vec4i> quads;
+    /// Cubic Bezier curves for shape BVHs.
+    std::vector<vec4i> beziers;
 
     /// Instance ids (iid, sid, shape bvh index).
     std::vector<bvh_instance> instances;
@@ -5001,11 +5096,13 @@ struct bvh_tree {
     ~bvh_tree();
 };
 
-/// Build a shape BVH from a set of primitives.
+/// Build a shape BVH from a set of primitives. Bezier curves are intersected
+/// directly, without tesselating them into lines.
 bvh_tree* make_bvh(const std::vector<int>& points,
     const std::vector<vec2i>& lines, const std::vector<vec3i>& triangles,
-    const std::vector<vec4i>& quads, const std::vector<vec3f>& pos,
-    const std::vector<float>& radius, float def_radius, bool equalsize);
+    const std::vector<vec4i>& quads, const std::vector<vec4i>& beziers,
+    const std::vector<vec3f>& pos, const std::vector<float>& radius,
+    float def_radius, bool equalsize);
 /// Build a scene BVH from a set of shape instances.
 bvh_tree* make_bvh(const std::vector<bvh_instance>& instances,
     const std::vector<bvh_tree*>& shape_bvhs, bool own_shape_bvhs,
@@ -5555,8 +5652,8 @@ struct load_options {
     bool preserve_hierarchy = false;
 };
 
-/// Loads a scene. For now OBJ or glTF are supported.
-/// Throws an exception if an error occurs.
+/// Loads a scene. For now OBJ, glTF, binary glTF and the binary `.ybin`
+/// cache are supported. Throws an exception if an error occurs.
 scene* load_scene(const std::string& filename, const load_options& opts = {});
 
 /// Save options.
@@ -5569,11 +5666,17 @@ struct save_options {
     bool obj_flip_texcoord = true;
     /// Whether to flip tr in OBJ.
     bool obj_flip_tr = true;
+    /// Significant digits of floats in OBJ (9 preserves the exact values).
+    int obj_precision = 6;
     /// Whether to use separate buffers in gltf.
     bool gltf_separate_buffers = false;
 };
 
-/// Saves a scene. For now OBJ and glTF are supported.
+/// Saves a scene. For now OBJ, glTF, binary glTF and the binary `.ybin`
+/// cache are supported. Binary glTF is streamed directly from the shape
+/// arrays and merges materials that differ only by name. The binary cache
+/// embeds the texture images, but it is tied to the library version and is
+/// not meant for interchange.
 void save_scene(
     const std::string& filename, const scene* scn, const save_options& opts);
 
@@ -6232,8 +6335,11 @@ std::unordered_map<std::string, proc_scene*>& proc_scene_presets();
 /// Remove duplicates based on name.
 void remove_duplicates(proc_scene* tscn);
 
-/// Load test scene.
-proc_scene* load_proc_scene(const std::string& filename);
+/// Load test scene. The json is read directly into the scene, unless
+/// `json_dom` is true, where it is first parsed into a json DOM as in
+/// earlier versions, which is slower and is kept for comparison.
+proc_scene* load_proc_scene(
+    const std::string& filename, bool json_dom = false);
 
 /// Save test scene.
 void save_proc_scene(const std::string& filename, const proc_scene* scn);
@@ -6610,6 +6716,9 @@ enum struct trace_rng_type {
     uniform = 0,
     /// Stratified random numbers.
     stratified,
+    /// Owen-scrambled Sobol numbers. Progressive, so they do not depend on
+    /// the number of samples.
+    sobol,
 };
 
 /// Filter type.
@@ -6656,28 +6765,106 @@ struct trace_params {
     bool parallel = true;
     /// Seed for the random number generators. @refl_uilimits(0,1000)
     uint32_t seed = 0;
+    /// Shard of interleaved image rows to render. @refl_uilimits(0,16)
+    int shard = 0;
+    /// Number of shards the image is split into. @refl_uilimits(1,16)
+    int nshards = 1;
+    /// Crop window as min x, min y, max x, max y, with max excluded. Empty
+    /// renders the full image. @refl_uilimits(0,4096)
+    vec4i crop = {0, 0, 0, 0};
 };
 
 // #codegen end refl-trace
 
-/// Trace pixel state. Handles image accumulation and random number generation
-/// for uniform and stratified sequences. The members are not part of the
-/// the public API.
+/// Trace pixel state. Handles image accumulation. Random numbers are
+/// derived from the seed, the pixel coordinates and the sample index, so
+/// they are not stored. The members are not part of the the public API.
 struct trace_pixel {
     /// Accumulated radiance.
     vec3f col = zero3f;
     /// Accumulated coverage.
-    float alpha = 1;
-    /// Random number state.
-    rng_pcg32 rng = rng_pcg32();
-    /// Pixel coordinates.
-    int i = 0, j = 0;
-    /// Number of samples computed.
-    int sample = 0;
-    /// Current dimension.
-    int dimension = 0;
+    float alpha = 0;
     /// Pixel weight for filtering.
     float weight = 0;
+    /// Number of samples computed.
+    int sample = 0;
+};
+
+/// Trace statistics. Counted per thread and summed at the end of each
+/// `trace_samples()` call.
+struct trace_stats {
+    /// Camera rays.
+    uint64_t primary_rays = 0;
+    /// Shadow rays.
+    uint64_t shadow_rays = 0;
+    /// Rays traced for path bounces.
+    uint64_t bounce_rays = 0;
+    /// BVH nodes visited.
+    uint64_t bvh_nodes = 0;
+    /// Primitive intersection tests.
+    uint64_t prim_tests = 0;
+    /// Samples discarded because of NaNs.
+    uint64_t nan_samples = 0;
+};
+
+/// Trace output variables (AOVs) computed in the same pass as the rendered
+/// image. Surface values are averaged over the pixel samples, while ids are
+/// taken from the first sample. Misses have zero values and -1 ids.
+struct trace_aovs {
+    /// First-hit albedo, with coverage in alpha.
+    image4f albedo;
+    /// First-hit shading normal in world space, with coverage in alpha.
+    image4f normal;
+    /// First-hit distance from the camera, with coverage in alpha.
+    image4f depth;
+    /// First-hit instance, shape and material indices.
+    image4f id;
+    /// Radiance variance over the pixel samples, with sample count in alpha.
+    image4f variance;
+    /// Accumulated squared radiance [private].
+    image<vec3f> col2;
+    /// Material indices [private].
+    std::unordered_map<const material*, int> material_ids;
+};
+
+/// Denoising params for the AOV-guided filter.
+struct trace_denoise_params {
+    /// Filter radius in pixels.
+    int radius = 6;
+    /// Spatial standard deviation in pixels.
+    float spatial_sigma = 3;
+    /// Color standard deviation, relative to the estimated pixel noise.
+    float color_sigma = 4;
+    /// Albedo standard deviation.
+    float albedo_sigma = 0.1f;
+    /// Normal standard deviation.
+    float normal_sigma = 0.25f;
+    /// Depth standard deviation, relative to the pixel depth.
+    float depth_sigma = 0.05f;
+    /// Window of rendered pixels as min x, min y, max x, max y, with max
+    /// excluded. Pixels outside are neither denoised nor used as neighbors.
+    /// Empty denoises the whole image.
+    vec4i window = {0, 0, 0, 0};
+    /// Parallel execution.
+    bool parallel = true;
+};
+
+/// Quantity computed when baking.
+enum struct trace_bake_type {
+    /// Ambient occlusion, as the unoccluded fraction of the hemisphere.
+    ao = 0,
+    /// Irradiance computed with the trace shader.
+    irradiance = 1,
+};
+
+/// Baking params. Sampling, shading and threading follow the trace params.
+struct trace_bake_params {
+    /// Baked quantity.
+    trace_bake_type type = trace_bake_type::ao;
+    /// Maximum occlusion distance, or 0 for unlimited.
+    float ao_distance = 0;
+    /// Number of dilation passes that extend texels across uv seams.
+    int dilate = 4;
 };
 
 /// Trace light as either instances or environments. The members are not part of
@@ -6687,10 +6874,64 @@ struct trace_light {
     const instance* ist = nullptr;
     /// Environment pointer for environment lights.
     const environment* env = nullptr;
+    /// Compiled material index for instance lights.
+    int mat = -1;
 };
 
-/// Trace lights. Handles sampling of illumination. The members are not part of
-/// the the public API.
+/// Trace material, compiled from a scene material before rendering. Texture
+/// lookups are resolved once and the shading values of untextured materials
+/// are precomputed. The members are not part of the the public API.
+struct trace_material {
+    /// Bitmask of the textures present and of the double-sided flag.
+    uint32_t flags = 0;
+    /// Material type.
+    material_type type = material_type::specular_roughness;
+    /// Emission color.
+    vec3f ke = zero3f;
+    /// Diffuse color / base color.
+    vec3f kd = zero3f;
+    /// Specular color / metallic factor.
+    vec3f ks = zero3f;
+    /// Transmission color.
+    vec3f kt = zero3f;
+    /// Roughness.
+    float rs = 0;
+    /// Shading diffuse for untextured points.
+    vec3f shade_kd = zero3f;
+    /// Shading specular for untextured points.
+    vec3f shade_ks = zero3f;
+    /// Shading transmission for untextured points.
+    vec3f shade_kt = zero3f;
+    /// Shading squared roughness for untextured points.
+    float shade_rs = 0;
+    /// Emission texture.
+    const texture* ke_txt = nullptr;
+    /// Diffuse texture.
+    const texture* kd_txt = nullptr;
+    /// Specular texture.
+    const texture* ks_txt = nullptr;
+    /// Transmission texture.
+    const texture* kt_txt = nullptr;
+    /// Normal texture.
+    const texture* norm_txt = nullptr;
+    /// Occlusion texture.
+    const texture* occ_txt = nullptr;
+    /// Emission texture info.
+    texture_info ke_txt_info = {};
+    /// Diffuse texture info.
+    texture_info kd_txt_info = {};
+    /// Specular texture info.
+    texture_info ks_txt_info = {};
+    /// Transmission texture info.
+    texture_info kt_txt_info = {};
+    /// Normal texture info.
+    texture_info norm_txt_info = {};
+    /// Occlusion texture info.
+    texture_info occ_txt_info = {};
+};
+
+/// Trace lights. Handles sampling of illumination and holds the compiled
+/// materials. The members are not part of the the public API.
 struct trace_lights {
     /// Shape instances.
     std::vector<trace_light> lights;
@@ -6698,6 +6939,12 @@ struct trace_lights {
     std::unordered_map<const shape*, std::vector<float>> shape_cdfs;
     /// Shape areas.
     std::unordered_map<const shape*, float> shape_areas;
+    /// Compiled materials, with the default material last.
+    std::vector<trace_material> materials;
+    /// Compiled material index for each instance shape, in BVH order.
+    std::vector<int> shape_materials;
+    /// Offset of each instance in the shape materials.
+    std::vector<int> instance_offsets;
     /// Check whether there are any lights.
     bool empty() const { return lights.empty(); }
     /// Number of lights.
@@ -6707,18 +6954,69 @@ struct trace_lights {
 /// Initialize trace pixels.
 image<trace_pixel> make_trace_pixels(
     const image4f& img, const trace_params& params);
-/// Initialize trace lights.
+/// Initialize trace lights and compile materials. Call again after changing
+/// materials or lights.
 trace_lights make_trace_lights(const scene* scn);
-
-/// Trace the next `nsamples` samples.
+/// Initialize trace AOVs.
+trace_aovs make_trace_aovs(const scene* scn, const image4f& img);
+
+/// Saves the trace pixels state to a binary checkpoint file, together with
+/// the trace params, except `parallel`, and a hash of the camera. The file
+/// is written to a temporary and then renamed, so that an interrupted save
+/// does not corrupt a previous checkpoint. Throws on error.
+void save_trace_pixels(const std::string& filename,
+    const image<trace_pixel>& pixels, const trace_params& params,
+    const camera* cam = nullptr);
+/// Loads the trace pixels state from a binary checkpoint file, and sets the
+/// params stored with it in `params`. If `cam` is not null, checks that the
+/// checkpoint was rendered with the same camera. Rendering can continue from
+/// the loaded state with the same results as an uninterrupted run, if the
+/// stored params are used. Throws on error.
+image<trace_pixel> load_trace_pixels(const std::string& filename,
+    trace_params& params, const camera* cam = nullptr);
+/// Names of the trace params that differ between `a` and `b`, except
+/// `parallel`. Used to check that checkpoints can be resumed or merged.
+std::vector<std::string> diff_trace_params(
+    const trace_params& a, const trace_params& b);
+/// Merges the trace pixels state of a shard into pixels by summing the
+/// accumulated values of all pixels. Filtered shards also gather samples
+/// into the rows of other shards, so merged filtered images are normalized
+/// by the pixel weight, and box filtered ones by the number of samples.
+void merge_trace_pixels(
+    image<trace_pixel>& pixels, const image<trace_pixel>& shard);
+
+/// Trace the next `nsamples` samples. If `aovs` is not null, also
+/// accumulates the output variables at the first hit. If `stats` is not
+/// null, adds the trace statistics of these samples to it.
 void trace_samples(const scene* scn, const camera* cam, const bvh_tree* bvh,
     const trace_lights& lights, image4f& img, image<trace_pixel>& pixels,
-    int nsamples, const trace_params& params);
-
-/// Trace the next `nsamples` samples with image filtering.
+    int nsamples, const trace_params& params, trace_aovs* aovs = nullptr,
+    trace_stats* stats = nullptr);
+
+/// Trace the next `nsamples` samples for multiple cameras, each with its own
+/// image and pixels. Threads are shared across all images.
+void trace_samples(const scene* scn, const std::vector<const camera*>& cams,
+    const bvh_tree* bvh, const trace_lights& lights,
+    const std::vector<image4f*>& imgs,
+    const std::vector<image<trace_pixel>*>& pixels, int nsamples,
+    const trace_params& params, trace_stats* stats = nullptr);
+
+/// Denoises a rendered image with a cross-bilateral filter guided by the
+/// albedo, normal and depth AOVs, with color weights scaled by the per-pixel
+/// variance so that converged pixels are left mostly untouched.
+image4f denoise_trace_image(const image4f& img, const trace_aovs& aovs,
+    const trace_denoise_params& params = {});
+
+/// Trace the next `nsamples` samples with image filtering. Samples are
+/// gathered by each pixel in a fixed order, so the result does not depend on
+/// the number of threads. Crop windows also trace the pixels within the
+/// filter size around them. Shards trace their own rows but gather into all
+/// rows of the crop, so they are merged by weight. If `stats` is not null,
+/// adds the trace statistics of these samples to it.
 void trace_samples_filtered(const scene* scn, const camera* cam,
     const bvh_tree* bvh, const trace_lights& lights, image4f& img,
-    image<trace_pixel>& pixels, int nsamples, const trace_params& params);
+    image<trace_pixel>& pixels, int nsamples, const trace_params& params,
+    trace_stats* stats = nullptr);
 
 /// Trace the whole image.
 inline image4f trace_image(const scene* scn, const camera* cam,
@@ -6731,14 +7029,26 @@ inline image4f trace_image(const scene* scn, const camera* cam,
     return img;
 }
 
-/// Starts an anyncrhounous renderer.
+/// Starts an anyncrhounous renderer. The image is first previewed at 1/8,
+/// 1/4 and 1/2 resolution before refining at full resolution. If `stats` is
+/// not null, the trace statistics of each worker are added to it when the
+/// worker finishes, so it should be read after `trace_async_stop()`.
 void trace_async_start(const scene* scn, const camera* cam, const bvh_tree* bvh,
     const trace_lights& lights, image4f& img, image<trace_pixel>& pixels,
     std::vector<std::thread>& threads, bool& stop_flag,
-    const trace_params& params);
+    const trace_params& params, trace_stats* stats = nullptr);
 /// Stop the asynchronous renderer.
 void trace_async_stop(std::vector<std::thread>& threads, bool& stop_flag);
 
+/// Bakes ambient occlusion or irradiance into `img` in the texture space of
+/// the shape `sid` of the instance `ist`, tracing `params.nsamples` rays per
+/// texel. The shape needs triangles or quads with texcoords. Covered texels,
+/// and the ones filled by dilation, have alpha 1. Since shapes are baked
+/// independently, only the changed shapes need to be baked again.
+void trace_bake(const scene* scn, const bvh_tree* bvh,
+    const trace_lights& lights, const instance* ist, int sid, image4f& img,
+    const trace_params& params, const trace_bake_params& bake_params = {});
+
 // #codegen begin reflgen-trace
 
 /// Names of enum values.
@@ -6764,6 +7074,7 @@ enum_names<trace_rng_type>() {
     static auto names = std::vector<std::pair<std::string, trace_rng_type>>{
         {"uniform", trace_rng_type::uniform},
         {"stratified", trace_rng_type::stratified},
+        {"sobol", trace_rng_type::sobol},
     };
     return names;
 }
@@ -6816,6 +7127,17 @@ inline void visit(trace_params& val, Visitor&& visitor) {
     visitor(
         val.seed, visit_var{"seed", visit_var_type::value,
                       "Seed for the random number generators.", 0, 1000, ""});
+    visitor(val.shard,
+        visit_var{"shard", visit_var_type::value,
+            "Shard of interleaved image rows to render.", 0, 16, ""});
+    visitor(val.nshards,
+        visit_var{"nshards", visit_var_type::value,
+            "Number of shards the image is split into.", 1, 16, ""});
+    visitor(val.crop,
+        visit_var{"crop", visit_var_type::value,
+            "Crop window as min x, min y, max x, max y, with max excluded. "
+            "Empty renders the full image.",
+            0, 4096, ""});
 }
 
 // #codegen end reflgen-trace
@@ -7085,17 +7407,21 @@ struct obj_scene {
 /// Load an OBJ from file `filename`. Load textures if `load_textures` is true,
 /// and report errors only if `skip_missing` is false.
 /// Texture coordinates and material Tr are flipped if `flip_texcoord` and
-/// `flip_tp` are respectively true.
+/// `flip_tp` are respectively true. The file is memory-mapped, when supported,
+/// and parsed in place.
 obj_scene* load_obj(const std::string& filename, bool load_textures = false,
     bool skip_missing = false, bool flip_texcoord = true, bool flip_tr = true);
 
 /// Save an OBJ to file `filename`. Save textures if `save_textures` is true,
 /// and report errors only if `skip_missing` is false.
 /// Texture coordinates and material Tr are flipped if `flip_texcoord` and
-/// `flip_tp` are respectively true.
+/// `flip_tp` are respectively true. Floats are written with `precision`
+/// significant digits, as printf's `%g`; 6 matches the default stream output,
+/// while 9 is enough to read back the exact same values. Text is formatted
+/// in blocks, in parallel, and written in order.
 void save_obj(const std::string& filename, const obj_scene* model,
     bool save_textures = false, bool skip_missing = false,
-    bool flip_texcoord = true, bool flip_tr = true);
+    bool flip_texcoord = true, bool flip_tr = true, int precision = 6);
 
 /// @}
 
@@ -7995,15 +8321,17 @@ struct glTF : glTFProperty {
 
 /// Load a gltf file `filename` from disk. Load binaries and images only if
 /// `load_bin` and `load_img` are true, reporting errors only if `skip_missing`
-/// is false.
+/// is false. The json is read directly into the glTF objects, unless
+/// `json_dom` is true, where it is first parsed into a json DOM as in earlier
+/// versions, which is slower and is kept for comparison.
 glTF* load_gltf(const std::string& filename, bool load_bin = true,
-    bool load_img = false, bool skip_missing = false);
+    bool load_img = false, bool skip_missing = false, bool json_dom = false);
 
 /// Load a binary gltf file `filename` from disk. Load binaries and images only
 /// if `load_bin` and `load_img` are true, reporting errors only if
-/// `skip_missing` is false.
+/// `skip_missing` is false. The json chunk is read as in `load_gltf()`.
 glTF* load_binary_gltf(const std::string& filename, bool load_bin = true,
-    bool load_img = false, bool skip_missing = false);
+    bool load_img = false, bool skip_missing = false, bool json_dom = false);
 
 /// Save a gltf file `filename` to disk. Save binaries and images only if
 /// `save_bin` and `save_img` are true.
@@ -8090,6 +8418,20 @@ struct accessor_view {
     /// Get the c-th component of the idx-th element as integer.
     int geti(int idx, int c = 0) const;
 
+    /// Get all elements. Component types are dispatched once per view and
+    /// tightly packed floats are copied in bulk.
+    void get_all(std::vector<float>& vals) const;
+    /// Get all elements of fixed length with default values.
+    void get_all(std::vector<vec2f>& vals, const vec2f& def = {0, 0}) const;
+    /// Get all elements of fixed length with default values.
+    void get_all(
+        std::vector<vec3f>& vals, const vec3f& def = {0, 0, 0}) const;
+    /// Get all elements of fixed length with default values.
+    void get_all(
+        std::vector<vec4f>& vals, const vec4f& def = {0, 0, 0, 0}) const;
+    /// Get all elements as integers.
+    void get_all(std::vector<int>& vals) const;
+
    private:
     const unsigned char* _data = nullptr;
     int _size = 0;
@@ -8101,6 +8443,8 @@ struct accessor_view {
 
     static int _num_components(glTFAccessorType type);
     static int _ctype_size(glTFAccessorComponentType componentType);
+    template <typename T>
+    void _get_all(T* vals, int nvals, bool normalize) const;
 };
 
 /// @}
@@ -8502,8 +8846,10 @@ inline void save_binary(
 #else
     auto f = fopen(filename.c_str(), "wb");
     if (!f) throw std::runtime_error("cannot write file " + filename);
-    fwrite(data.data(), 1, (int)data.size(), f);
+    auto written = fwrite(data.data(), 1, data.size(), f);
     fclose(f);
+    if (written != data.size())
+        throw std::runtime_error("cannot write file " + filename);
 #endif
 }
 
@@ -10458,6 +10804,8 @@ inline cmdline_parser make_parser(
 
 }  // namespace ygl
 
+#if YGL_OPENGL
+
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION FOR OPENGL WIDGETS
 // -----------------------------------------------------------------------------
@@ -10583,3 +10931,5 @@ inline bool draw_params_widgets(
 }  // namespace ygl
 
 #endif
+
+#endif